@@ -0,0 +1,723 @@
+#include "chunk.h"
+#include "codec.h"
+#include "context.h"
+#include "slab.h"
+#include "assets.h"
+#include "perf_counter.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Set by CMake to the resources of the source tree.
+#ifndef CMINE_BENCH_RESOURCE_DIR
+#define CMINE_BENCH_RESOURCE_DIR ASSETS_DEFAULT_DIR
+#endif
+
+// Chunks generated for the cases working on terrain.
+#define BENCH_AREA_SIDELEN 8
+#define BENCH_AREA_COUNT (BENCH_AREA_SIDELEN * BENCH_AREA_SIDELEN * BENCH_AREA_SIDELEN)
+
+typedef struct BenchCase BenchCase;
+struct BenchCase
+{
+	const char *name;
+	const char *summary;
+	void (*run)(void);
+};
+
+// Results are summed in here, so the measured work is never optimized out.
+static volatile u64 bench_sink;
+
+static void bench_report(const char *name, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	printf("\t%s = `", name);
+	vprintf(format, args);
+	printf("`\n");
+	va_end(args);
+}
+
+static f64 bench_ms_since(f64 start)
+{
+	return (context_clock() - start) * 1000.0;
+}
+
+static const char *bench_chunk_layout_name(void)
+{
+#if CHUNK_LAYOUT == CHUNK_LAYOUT_X_MAJOR
+	return "X_MAJOR";
+#elif CHUNK_LAYOUT == CHUNK_LAYOUT_Z_MAJOR
+	return "Z_MAJOR";
+#else
+	return "MORTON";
+#endif
+}
+
+// Settings `main` generates worlds with.
+static TerrainSettings bench_terrain_settings(TerrainKind kind)
+{
+	return (TerrainSettings){
+		.kind = kind,
+		.heightmap = {
+			.octave_count = 1,
+			.frequency = 0.2f,
+			.intensity = 8,
+			.persistance = 1,
+			.lacunarity = 1,
+		},
+		.density = {
+			.octave_count = 2,
+			.frequency = 0.08f,
+			.intensity = 16,
+			.persistance = 0.5f,
+			.lacunarity = 2,
+			.noise = fbm_noise_simplex,
+		},
+		.density_threshold = 8,
+		.density_falloff = 0.5f,
+	};
+}
+
+static const char *bench_terrain_kind_name(TerrainKind kind)
+{
+	switch (kind)
+	{
+	case terrain_kind_heightmap: return "heightmap";
+	case terrain_kind_density:   return "density";
+	default:                     return "unknown";
+	}
+}
+
+// Generates `BENCH_AREA_COUNT` chunks at full detail around the origin.
+static Chunk *bench_generate_area(const Perlin *perlin, TerrainKind kind)
+{
+	Chunk *chunks = malloc(BENCH_AREA_COUNT * sizeof(*chunks));
+	if (!chunks) abort();
+	Terrain terrain;
+	terrain_init(&terrain, perlin, bench_terrain_settings(kind), std_allocator_alloc());
+	for (size_t i = 0; i < BENCH_AREA_COUNT; i++)
+	{
+		CPos pos = {
+			(int)(i % BENCH_AREA_SIDELEN) - BENCH_AREA_SIDELEN / 2,
+			(int)(i / BENCH_AREA_SIDELEN % BENCH_AREA_SIDELEN) - BENCH_AREA_SIDELEN / 2,
+			(int)(i / BENCH_AREA_SIDELEN / BENCH_AREA_SIDELEN) - BENCH_AREA_SIDELEN / 2,
+		};
+		chunk_init(&chunks[i]);
+		chunk_generate_blocks(&chunks[i], &terrain, cp2bp(pos), 0);
+	}
+	terrain_deinit(&terrain);
+	return chunks;
+}
+
+#define BENCH_CODEC_ROUNDS 8
+
+static void bench_codec(void)
+{
+	Perlin perlin;
+	perlin_init(&perlin, 3);
+	size_t count = CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN;
+	Alloc *scratch = std_allocator_alloc();
+	u8 *encoded = malloc(BENCH_AREA_COUNT * CODEC_BOUND(count));
+	size_t *sizes = malloc(BENCH_AREA_COUNT * sizeof(*sizes));
+	Block *decoded = malloc(count * sizeof(*decoded));
+	if (!encoded || !sizes || !decoded) abort();
+	for (TerrainKind kind = 0; kind < terrain_kind_count; kind++)
+	{
+		Chunk *chunks = bench_generate_area(&perlin, kind);
+		size_t encoded_size = 0;
+		f64 start = context_clock();
+		for (int round = 0; round < BENCH_CODEC_ROUNDS; round++)
+		{
+			encoded_size = 0;
+			for (size_t i = 0; i < BENCH_AREA_COUNT; i++)
+			{
+				sizes[i] = codec_encode_blocks(chunks[i].blocks, count, encoded + i * CODEC_BOUND(count), scratch);
+				encoded_size += sizes[i];
+			}
+		}
+		f64 encode_ms = bench_ms_since(start);
+		start = context_clock();
+		for (int round = 0; round < BENCH_CODEC_ROUNDS; round++)
+		{
+			for (size_t i = 0; i < BENCH_AREA_COUNT; i++)
+			{
+				bench_sink += codec_decode_blocks(encoded + i * CODEC_BOUND(count), sizes[i], decoded, count, scratch);
+				bench_sink += decoded[i % count];
+			}
+		}
+		f64 decode_ms = bench_ms_since(start);
+		f64 raw_mb = (f64)(BENCH_AREA_COUNT * count * BENCH_CODEC_ROUNDS) / 1e6;
+		bench_report("terrain", "%s", bench_terrain_kind_name(kind));
+		bench_report("compression ratio", "%.1f", (f64)(BENCH_AREA_COUNT * count) / (f64)encoded_size);
+		bench_report("encode MB/s", "%.0f", raw_mb / (encode_ms / 1000.0));
+		bench_report("decode MB/s", "%.0f", raw_mb / (decode_ms / 1000.0));
+		free(chunks);
+	}
+	free(decoded);
+	free(sizes);
+	free(encoded);
+}
+
+#define BENCH_NOISE_SAMPLES 4000000
+
+typedef enum BenchNoise BenchNoise;
+enum BenchNoise
+{
+	bench_noise_perlin2,
+	bench_noise_simplex2,
+	bench_noise_perlin3,
+	bench_noise_simplex3,
+	bench_noise_count
+};
+
+static void bench_noise(void)
+{
+	static const char *names[bench_noise_count] = {
+		[bench_noise_perlin2] = "perlin2 ns/sample",
+		[bench_noise_simplex2] = "simplex2 ns/sample",
+		[bench_noise_perlin3] = "perlin3 ns/sample",
+		[bench_noise_simplex3] = "simplex3 ns/sample",
+	};
+	Perlin perlin;
+	perlin_init(&perlin, 1);
+	for (BenchNoise noise = 0; noise < bench_noise_count; noise++)
+	{
+		float sum = 0.0f;
+		f64 start = context_clock();
+		for (int i = 0; i < BENCH_NOISE_SAMPLES; i++)
+		{
+			float x = (float)i * 0.31f;
+			float y = (float)i * 0.17f;
+			float z = (float)i * 0.23f;
+			switch (noise)
+			{
+			case bench_noise_perlin2:  sum += perlin2(&perlin, x, y); break;
+			case bench_noise_simplex2: sum += simplex2(&perlin, x, y); break;
+			case bench_noise_perlin3:  sum += perlin3(&perlin, x, y, z); break;
+			case bench_noise_simplex3: sum += simplex3(&perlin, x, y, z); break;
+			default: break;
+			}
+		}
+		f64 ms = bench_ms_since(start);
+		bench_sink += (u64)sum;
+		bench_report(names[noise], "%.1f", ms * 1e6 / BENCH_NOISE_SAMPLES);
+	}
+}
+
+// Chunks kept while flying, which span far more pages than the TLB maps.
+#define BENCH_FLIGHT_SIDELEN 24
+#define BENCH_FLIGHT_STEPS 48
+// Slots every worker allocates and frees at once, and how many times.
+#define BENCH_SLAB_BURST 256
+#define BENCH_SLAB_BURSTS 4000
+
+typedef struct BenchFlight BenchFlight;
+struct BenchFlight
+{
+	f64 churn_ns;
+	f64 pass_ms;
+	u64 tlb_misses;
+	bool has_tlb_misses;
+};
+
+// Flies along x through an area of chunks from `alloc`, replacing the
+// plane of chunks left behind every step and reading every chunk after.
+static BenchFlight bench_fly(Alloc *alloc)
+{
+	size_t sidelen = BENCH_FLIGHT_SIDELEN;
+	size_t count = sidelen * sidelen * sidelen;
+	Chunk **chunks = malloc(count * sizeof(*chunks));
+	if (!chunks) abort();
+	for (size_t i = 0; i < count; i++)
+	{
+		allocate(alloc, (void**)&chunks[i], sizeof(Chunk));
+		memset(chunks[i]->blocks, 0, sizeof(chunks[i]->blocks));
+	}
+	BenchFlight flight = {.has_tlb_misses = true};
+	f64 churn_ms = 0.0;
+	for (int step = 0; step < BENCH_FLIGHT_STEPS; step++)
+	{
+		size_t x = (size_t)step % sidelen;
+		f64 start = context_clock();
+		for (size_t i = x; i < count; i += sidelen) deallocate(alloc, (void**)&chunks[i]);
+		for (size_t i = x; i < count; i += sidelen) allocate(alloc, (void**)&chunks[i], sizeof(Chunk));
+		churn_ms += bench_ms_since(start);
+		for (size_t i = x; i < count; i += sidelen)
+		{
+			memset(chunks[i]->blocks, step, sizeof(chunks[i]->blocks));
+		}
+
+		// Touches every cache line of every chunk, like meshing does.
+		PerfCounter counter;
+		bool is_counting = perf_counter_start_dtlb_misses(&counter);
+		start = context_clock();
+		u64 sum = 0;
+		for (size_t i = 0; i < count; i++)
+		{
+			for (size_t j = 0; j < sizeof(chunks[i]->blocks); j += 64) sum += chunks[i]->blocks[j];
+		}
+		flight.pass_ms += bench_ms_since(start);
+		if (is_counting) flight.tlb_misses += perf_counter_stop(&counter);
+		flight.has_tlb_misses = flight.has_tlb_misses && is_counting;
+		bench_sink += sum;
+	}
+	for (size_t i = 0; i < count; i++) deallocate(alloc, (void**)&chunks[i]);
+	free(chunks);
+	flight.churn_ns = churn_ms * 1e6 / (f64)(BENCH_FLIGHT_STEPS * sidelen * sidelen * 2);
+	flight.pass_ms /= BENCH_FLIGHT_STEPS;
+	flight.tlb_misses /= BENCH_FLIGHT_STEPS;
+	return flight;
+}
+
+static void bench_report_flight(const char *alloc_name, BenchFlight flight)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "%s churn ns/op", alloc_name);
+	bench_report(name, "%.1f", flight.churn_ns);
+	snprintf(name, sizeof(name), "%s pass ms", alloc_name);
+	bench_report(name, "%.2f", flight.pass_ms);
+	snprintf(name, sizeof(name), "%s dTLB misses/pass", alloc_name);
+	if (flight.has_tlb_misses) bench_report(name, "%llu", (unsigned long long)flight.tlb_misses);
+	else bench_report(name, "unavailable");
+}
+
+typedef struct BenchSlabWorker BenchSlabWorker;
+struct BenchSlabWorker
+{
+	Slab *slab;
+	thrd_t thread;
+};
+
+// Allocates and frees bursts of chunks, from the slab if there is one.
+static int bench_slab_worker_run(void *data)
+{
+	BenchSlabWorker *worker = data;
+	SlabCache cache;
+	if (worker->slab) slab_cache_init(&cache, worker->slab);
+	Alloc *alloc = worker->slab ? slab_cache_alloc(&cache) : std_allocator_alloc();
+	void *slots[BENCH_SLAB_BURST];
+	for (int burst = 0; burst < BENCH_SLAB_BURSTS; burst++)
+	{
+		for (int i = 0; i < BENCH_SLAB_BURST; i++)
+		{
+			allocate(alloc, &slots[i], sizeof(Chunk));
+			*(u8*)slots[i] = (u8)i;
+		}
+		for (int i = 0; i < BENCH_SLAB_BURST; i++) deallocate(alloc, &slots[i]);
+	}
+	if (worker->slab) slab_cache_deinit(&cache);
+	return 0;
+}
+
+// Millions of allocations and frees per second of all workers at once.
+static f64 bench_slab_workers(Slab *slab)
+{
+	BenchSlabWorker workers[CMINE_WORKER_COUNT];
+	f64 start = context_clock();
+	for (int i = 0; i < CMINE_WORKER_COUNT; i++)
+	{
+		workers[i].slab = slab;
+		if (thrd_create(&workers[i].thread, bench_slab_worker_run, &workers[i]) != thrd_success) abort();
+	}
+	for (int i = 0; i < CMINE_WORKER_COUNT; i++) thrd_join(workers[i].thread, NULL);
+	f64 ms = bench_ms_since(start);
+	f64 ops = (f64)CMINE_WORKER_COUNT * BENCH_SLAB_BURSTS * BENCH_SLAB_BURST * 2;
+	return ops / (ms * 1000.0);
+}
+
+static void bench_slab(void)
+{
+	Slab slab;
+	slab_init(&slab, std_allocator_alloc(), sizeof(Chunk));
+	SlabCache cache;
+	slab_cache_init(&cache, &slab);
+	bench_report_flight("malloc", bench_fly(std_allocator_alloc()));
+	bench_report_flight("slab", bench_fly(slab_cache_alloc(&cache)));
+	slab_cache_deinit(&cache);
+	bench_report("workers", "%d", CMINE_WORKER_COUNT);
+	bench_report("malloc Mops/s", "%.1f", bench_slab_workers(NULL));
+	bench_report("slab Mops/s", "%.1f", bench_slab_workers(&slab));
+	slab_deinit(&slab);
+}
+
+// Passes over the chunks measured for every render distance.
+#define BENCH_ITERATION_PASSES 64
+
+// How a chunk was stored before its metadata was split from its blocks.
+typedef struct BenchInterleavedChunk BenchInterleavedChunk;
+struct BenchInterleavedChunk
+{
+	Chunk chunk;
+	u8 stage;
+	u8 flags;
+	u8 mesh_lod;
+	ChunkBounds bounds;
+	u32 mesh;
+};
+
+static bool bench_bounds_overlap(ChunkBounds a, ChunkBounds b)
+{
+	return
+		a.min.x <= b.max.x && b.min.x <= a.max.x &&
+		a.min.y <= b.max.y && b.min.y <= a.max.y &&
+		a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+// State of the chunk at `idx` the passes look at. About a third of the
+// chunks are empty, as are most of those above the surface.
+static void bench_chunk_state(size_t idx, size_t sidelen, u8 *flags, ChunkBounds *bounds)
+{
+	Vec3 min = {
+		(f32)(idx % sidelen * CHUNK_SIDELEN),
+		(f32)(idx / sidelen % sidelen * CHUNK_SIDELEN),
+		(f32)(idx / sidelen / sidelen * CHUNK_SIDELEN),
+	};
+	*flags = idx % 3 == 0 ? chunk_flag_empty : 0;
+	*bounds = (ChunkBounds){min, v3_add(min, (Vec3){CHUNK_SIDELEN, CHUNK_SIDELEN, CHUNK_SIDELEN})};
+}
+
+// Culls the chunks against a box covering half of the area on every axis,
+// which like `chunks_draw` only reads the stages, flags and bounds.
+static void bench_iteration(void)
+{
+	static const size_t sidelens[] = {8, 16, 32};
+	Slab slab;
+	slab_init(&slab, std_allocator_alloc(), sizeof(BenchInterleavedChunk));
+	SlabCache cache;
+	slab_cache_init(&cache, &slab);
+	for (size_t s = 0; s < sizeof(sidelens) / sizeof(*sidelens); s++)
+	{
+		size_t sidelen = sidelens[s];
+		size_t count = sidelen * sidelen * sidelen;
+		f32 extent = (f32)(sidelen * CHUNK_SIDELEN);
+		ChunkBounds view = {{extent / 4, extent / 4, extent / 4}, {extent * 3 / 4, extent * 3 / 4, extent * 3 / 4}};
+
+		Chunks chunks;
+		chunks_init(&chunks, (CPos){0}, sidelen, std_allocator_alloc(), slab_cache_alloc(&cache));
+		BenchInterleavedChunk **interleaved = malloc(count * sizeof(*interleaved));
+		if (!interleaved) abort();
+		for (size_t i = 0; i < count; i++)
+		{
+			interleaved[i] = slab_cache_allocate(&cache);
+			interleaved[i]->stage = chunk_generation_stage_ready;
+			chunks.stages[i] = chunk_generation_stage_ready;
+			bench_chunk_state(i, sidelen, &chunks.flags[i], &chunks.bounds[i]);
+			bench_chunk_state(i, sidelen, &interleaved[i]->flags, &interleaved[i]->bounds);
+		}
+
+		size_t visible = 0;
+		f64 start = context_clock();
+		for (int pass = 0; pass < BENCH_ITERATION_PASSES; pass++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				if (chunks.stages[i] != chunk_generation_stage_ready) continue;
+				if (chunks.flags[i] & chunk_flag_empty) continue;
+				visible += bench_bounds_overlap(chunks.bounds[i], view);
+			}
+		}
+		f64 split_ms = bench_ms_since(start);
+		start = context_clock();
+		for (int pass = 0; pass < BENCH_ITERATION_PASSES; pass++)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				const BenchInterleavedChunk *chunk = interleaved[i];
+				if (chunk->stage != chunk_generation_stage_ready) continue;
+				if (chunk->flags & chunk_flag_empty) continue;
+				visible += bench_bounds_overlap(chunk->bounds, view);
+			}
+		}
+		f64 interleaved_ms = bench_ms_since(start);
+		bench_sink += visible;
+
+		bench_report("area sidelen", "%zu", sidelen);
+		bench_report("split ns/chunk", "%.2f", split_ms * 1e6 / (f64)(count * BENCH_ITERATION_PASSES));
+		bench_report("interleaved ns/chunk", "%.2f", interleaved_ms * 1e6 / (f64)(count * BENCH_ITERATION_PASSES));
+
+		for (size_t i = 0; i < count; i++)
+		{
+			slab_cache_free(&cache, interleaved[i]);
+			// No meshes were made, so there are none to release.
+			chunks.stages[i] = chunk_generation_stage_awaits_blocks;
+		}
+		free(interleaved);
+		chunks_deinit(&chunks);
+	}
+	slab_cache_deinit(&cache);
+	slab_deinit(&slab);
+}
+
+// Sums the six neighbors of every block inside the chunk, the access
+// pattern of face culling and lighting.
+static u64 bench_sum_neighbors(const Chunk *chunk)
+{
+	u64 sum = 0;
+	for (int z = 1; z < CHUNK_SIDELEN - 1; z++)
+		for (int y = 1; y < CHUNK_SIDELEN - 1; y++)
+			for (int x = 1; x < CHUNK_SIDELEN - 1; x++)
+			{
+				sum +=
+					chunk->blocks[CHUNK_BLOCK_IDX(x - 1, y, z)] +
+					chunk->blocks[CHUNK_BLOCK_IDX(x + 1, y, z)] +
+					chunk->blocks[CHUNK_BLOCK_IDX(x, y - 1, z)] +
+					chunk->blocks[CHUNK_BLOCK_IDX(x, y + 1, z)] +
+					chunk->blocks[CHUNK_BLOCK_IDX(x, y, z - 1)] +
+					chunk->blocks[CHUNK_BLOCK_IDX(x, y, z + 1)];
+			}
+	return sum;
+}
+
+static void bench_layout(void)
+{
+	Perlin perlin;
+	perlin_init(&perlin, 3);
+	MeshBuilder scratch;
+	mb_init(&scratch, std_allocator_alloc());
+	for (TerrainKind kind = 0; kind < terrain_kind_count; kind++)
+	{
+		f64 start = context_clock();
+		Chunk *chunks = bench_generate_area(&perlin, kind);
+		f64 generate_ms = bench_ms_since(start);
+		start = context_clock();
+		for (size_t i = 0; i < BENCH_AREA_COUNT; i++)
+		{
+			chunk_build_mesh(&chunks[i], 0, &scratch);
+			bench_sink += (u64)scratch.count;
+		}
+		f64 mesh_ms = bench_ms_since(start);
+		start = context_clock();
+		for (size_t i = 0; i < BENCH_AREA_COUNT; i++) bench_sink += bench_sum_neighbors(&chunks[i]);
+		f64 neighbors_ms = bench_ms_since(start);
+
+		bench_report("terrain", "%s", bench_terrain_kind_name(kind));
+		bench_report("generate us/chunk", "%.2f", generate_ms * 1000.0 / BENCH_AREA_COUNT);
+		bench_report("mesh us/chunk", "%.2f", mesh_ms * 1000.0 / BENCH_AREA_COUNT);
+		bench_report("neighbors us/chunk", "%.2f", neighbors_ms * 1000.0 / BENCH_AREA_COUNT);
+		free(chunks);
+	}
+	mb_deinit(&scratch);
+}
+
+// Volume of the world generated for every chunk size, in blocks.
+#define BENCH_SIZES_WIDTH 128
+#define BENCH_SIZES_HEIGHT 64
+
+static void bench_sizes(void)
+{
+	size_t width = BENCH_SIZES_WIDTH / CHUNK_SIDELEN;
+	size_t height = BENCH_SIZES_HEIGHT / CHUNK_SIDELEN;
+	size_t count = width * width * height;
+	// Chunks are allocated from slabs, which align their slots.
+	size_t slot_size = (sizeof(Chunk) + SLAB_SLOT_ALIGNMENT - 1) / SLAB_SLOT_ALIGNMENT * SLAB_SLOT_ALIGNMENT;
+	Chunk *chunks = malloc(count * sizeof(*chunks));
+	if (!chunks) abort();
+	Perlin perlin;
+	perlin_init(&perlin, 3);
+	MeshBuilder scratch;
+	mb_init(&scratch, std_allocator_alloc());
+	bench_report("chunks", "%zu", count);
+	for (TerrainKind kind = 0; kind < terrain_kind_count; kind++)
+	{
+		Terrain terrain;
+		terrain_init(&terrain, &perlin, bench_terrain_settings(kind), std_allocator_alloc());
+		f64 start = context_clock();
+		for (size_t i = 0; i < count; i++)
+		{
+			CPos pos = {
+				(int)(i % width) - (int)width / 2,
+				(int)(i / width % width) - (int)width / 2,
+				(int)(i / width / width) - (int)height / 2,
+			};
+			chunk_init(&chunks[i]);
+			chunk_generate_blocks(&chunks[i], &terrain, cp2bp(pos), 0);
+		}
+		f64 generate_ms = bench_ms_since(start);
+		terrain_deinit(&terrain);
+
+		size_t draw_count = 0;
+		size_t vertex_count = 0;
+		start = context_clock();
+		for (size_t i = 0; i < count; i++)
+		{
+			chunk_build_mesh(&chunks[i], 0, &scratch);
+			draw_count += scratch.count > 0;
+			vertex_count += (size_t)scratch.count;
+		}
+		f64 mesh_ms = bench_ms_since(start);
+
+		bench_report("terrain", "%s", bench_terrain_kind_name(kind));
+		bench_report("generate ms", "%.2f", generate_ms);
+		bench_report("mesh ms", "%.2f", mesh_ms);
+		bench_report("draw count", "%zu", draw_count);
+		bench_report("block KiB", "%zu", count * slot_size / 1024);
+		bench_report("vertex KiB", "%zu", vertex_count * sizeof(MeshVertex) / 1024);
+	}
+	mb_deinit(&scratch);
+	free(chunks);
+}
+
+// Path of a resource, taken from `ASSETS_DIR_VARIABLE` if it is set,
+// like the engine does.
+static void bench_resource_path(char *path, size_t capacity, const char *name)
+{
+	const char *dir = getenv(ASSETS_DIR_VARIABLE);
+	if (!dir) dir = CMINE_BENCH_RESOURCE_DIR;
+	int length = snprintf(path, capacity, "%s/%s", dir, name);
+	if (length < 0 || (size_t)length >= capacity) abort();
+}
+
+static size_t bench_file_size(const char *path)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file) return 0;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fclose(file);
+	return size > 0 ? (size_t)size : 0;
+}
+
+#define BENCH_BMP_LOADS 200
+
+static void bench_bmp(void)
+{
+	char path[512];
+	bench_resource_path(path, sizeof(path), "mc_atlas.bmp");
+	Alloc *alloc = std_allocator_alloc();
+	f64 start = context_clock();
+	for (int i = 0; i < BENCH_BMP_LOADS; i++)
+	{
+		Image image;
+		ImageError error = image_load_bmp(&image, path, alloc);
+		if (error)
+		{
+			fprintf(stderr, "\nCaught runtime error:\n\tFailed to load a bitmap.\n\tpath = `%s`\n\terror = `%d`\n", path, (int)error);
+			return;
+		}
+		bench_sink += ((const u8*)image.pixels)[0];
+		image_deinit(&image, alloc);
+	}
+	f64 ms = bench_ms_since(start) / BENCH_BMP_LOADS;
+	size_t size = bench_file_size(path);
+	bench_report("file KiB", "%zu", size / 1024);
+	bench_report("load ms", "%.3f", ms);
+	bench_report("load MB/s", "%.0f", (f64)size / 1e6 / (ms / 1000.0));
+}
+
+// Side of the texture pack the atlas is tiled into.
+#define BENCH_QOI_SIDELEN 2048
+#define BENCH_QOI_DECODES 8
+// Written to and removed from the working directory.
+#define BENCH_QOI_PATH "bench_pack.qoi"
+
+static void bench_qoi(void)
+{
+	char path[512];
+	bench_resource_path(path, sizeof(path), "mc_atlas.bmp");
+	Alloc *alloc = std_allocator_alloc();
+	Image atlas;
+	if (image_load_bmp(&atlas, path, alloc))
+	{
+		fprintf(stderr, "\nCaught runtime error:\n\tFailed to load a bitmap.\n\tpath = `%s`\n", path);
+		return;
+	}
+	Image pack = {
+		.width = BENCH_QOI_SIDELEN,
+		.height = BENCH_QOI_SIDELEN,
+		.format = atlas.format,
+	};
+	size_t pixel_size = image_pixel_size(pack.format);
+	size_t pack_size = image_row_size(&pack) * pack.height;
+	pack.pixels = malloc(pack_size);
+	if (!pack.pixels) abort();
+	for (size_t y = 0; y < pack.height; y++)
+		for (size_t x = 0; x < pack.width; x++)
+		{
+			const u8 *from = (const u8*)atlas.pixels +
+				y % atlas.height * image_row_size(&atlas) +
+				x % atlas.width * pixel_size;
+			u8 *to = (u8*)pack.pixels + y * image_row_size(&pack) + x * pixel_size;
+			memcpy(to, from, pixel_size);
+		}
+	image_deinit(&atlas, alloc);
+
+	f64 start = context_clock();
+	ImageError error = image_store_qoi(&pack, BENCH_QOI_PATH, alloc);
+	f64 encode_ms = bench_ms_since(start);
+	free(pack.pixels);
+	if (error)
+	{
+		fprintf(stderr, "\nCaught runtime error:\n\tFailed to store an image.\n\tpath = `%s`\n", BENCH_QOI_PATH);
+		return;
+	}
+	start = context_clock();
+	for (int i = 0; i < BENCH_QOI_DECODES; i++)
+	{
+		Image image;
+		if (image_load_qoi(&image, BENCH_QOI_PATH, alloc)) break;
+		bench_sink += ((const u8*)image.pixels)[0];
+		image_deinit(&image, alloc);
+	}
+	f64 decode_ms = bench_ms_since(start) / BENCH_QOI_DECODES;
+	size_t size = bench_file_size(BENCH_QOI_PATH);
+	remove(BENCH_QOI_PATH);
+
+	f64 pixels_mb = (f64)(BENCH_QOI_SIDELEN * BENCH_QOI_SIDELEN * 4) / 1e6;
+	bench_report("image", "%dx%d", BENCH_QOI_SIDELEN, BENCH_QOI_SIDELEN);
+	bench_report("bmp KiB", "%zu", (pack_size + 54) / 1024);
+	bench_report("qoi KiB", "%zu", size / 1024);
+	bench_report("encode ms", "%.2f", encode_ms);
+	bench_report("decode ms", "%.2f", decode_ms);
+	bench_report("decode MB/s of pixels", "%.0f", pixels_mb / (decode_ms / 1000.0));
+}
+
+static const BenchCase bench_cases[] = {
+	{"noise", "Cost of a simplex noise sample against a Perlin noise sample.", bench_noise},
+	{"slab", "Chunk allocation while flying across the world, and from every worker at once.", bench_slab},
+	{"iteration", "Per-frame pass over chunk metadata, split from and interleaved with blocks.", bench_iteration},
+	{"layout", "Generation, meshing and neighbor reads under the configured block layout.", bench_layout},
+	{"sizes", "Generation, meshing, draw count and memory of a fixed volume under the configured chunk size.", bench_sizes},
+	{"bmp", "Load time of the block atlas bitmap.", bench_bmp},
+	{"qoi", "QOI decode throughput of a texture pack tiled from the block atlas.", bench_qoi},
+	{"codec", "Block codec throughput and compression ratio on terrain chunks.", bench_codec},
+};
+#define BENCH_CASE_COUNT (sizeof(bench_cases) / sizeof(*bench_cases))
+
+static void bench_run(const BenchCase *bench_case)
+{
+	printf("\n%s:\n\t%s\n", bench_case->name, bench_case->summary);
+	bench_case->run();
+	fflush(stdout);
+}
+
+// Runs the cases named on the command line, or every case without any.
+int main(int argc, char **argv)
+{
+	// Both are fixed at compile time, so other builds compare them.
+	printf("Configuration:\n");
+	bench_report("chunk layout", "%s", bench_chunk_layout_name());
+	bench_report("chunk sidelen", "%d", CHUNK_SIDELEN);
+	if (argc < 2)
+	{
+		for (size_t i = 0; i < BENCH_CASE_COUNT; i++) bench_run(&bench_cases[i]);
+		return 0;
+	}
+	for (int arg = 1; arg < argc; arg++)
+	{
+		const BenchCase *bench_case = NULL;
+		for (size_t i = 0; i < BENCH_CASE_COUNT; i++)
+		{
+			if (!strcmp(bench_cases[i].name, argv[arg])) bench_case = &bench_cases[i];
+		}
+		if (!bench_case)
+		{
+			fprintf(stderr, "\nCaught runtime error:\n\tUnknown benchmark case.\n\tname = `%s`\n", argv[arg]);
+			return 1;
+		}
+		bench_run(bench_case);
+	}
+	return 0;
+}
@@ -0,0 +1,54 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+#include "perf_counter.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <string.h>
+#include <unistd.h>
+
+bool perf_counter_start_dtlb_misses(PerfCounter *counter)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config =
+		PERF_COUNT_HW_CACHE_DTLB |
+		PERF_COUNT_HW_CACHE_OP_READ << 8 |
+		PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counter->fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (counter->fd < 0) return false;
+	ioctl(counter->fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(counter->fd, PERF_EVENT_IOC_ENABLE, 0);
+	return true;
+}
+
+u64 perf_counter_stop(PerfCounter *counter)
+{
+	u64 count = 0;
+	ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+	if (read(counter->fd, &count, sizeof(count)) != sizeof(count)) count = 0;
+	close(counter->fd);
+	counter->fd = -1;
+	return count;
+}
+#else
+bool perf_counter_start_dtlb_misses(PerfCounter *counter)
+{
+	counter->fd = -1;
+	return false;
+}
+
+u64 perf_counter_stop(PerfCounter *counter)
+{
+	(void)counter;
+	return 0;
+}
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+#include "types.h"
+
+// Hardware event counter of the calling thread, where the platform
+// exposes one. Counting is usually refused to unprivileged processes
+// by `perf_event_paranoid`, in which case benchmarks report time only.
+typedef struct PerfCounter PerfCounter;
+struct PerfCounter
+{
+	int fd;
+};
+
+// Starts counting the data TLB misses of loads.
+// Returns false if they cannot be counted here.
+bool perf_counter_start_dtlb_misses(PerfCounter *counter);
+// Stops the counter and returns the amount of events counted.
+u64 perf_counter_stop(PerfCounter *counter);
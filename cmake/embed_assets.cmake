@@ -0,0 +1,105 @@
+# Generates a C source defining the tables of `include/assets.h`.
+# Run in script mode with:
+#   RESOURCE_DIR - directory of the resources
+#   FILES        - names of files embedded as they are, separated by `|`
+#   IMAGES       - names of bitmaps embedded as their pixels, separated by `|`
+#   OUTPUT       - path of the generated source
+
+string(REPLACE "|" ";" FILES "${FILES}")
+string(REPLACE "|" ";" IMAGES "${IMAGES}")
+
+# Turns hexadecimal digits into the items of a C array initializer,
+# 16 bytes to a line.
+function(hex_to_c_array hex out)
+	set(line "")
+	foreach(i RANGE 1 32)
+		set(line "${line}[0-9a-f]")
+	endforeach()
+	string(REGEX REPLACE "(${line})" "\\1\n" lines "${hex}")
+	string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," items "${lines}")
+	string(REPLACE "\n" "\n\t" items "${items}")
+	set(${out} "${items}" PARENT_SCOPE)
+endfunction()
+
+# Reads a little endian integer of `size` bytes at `offset` of the header.
+# Digits are converted one by one, `math` only reads hexadecimal since 3.13.
+function(read_le header offset size out)
+	set(value 0)
+	math(EXPR last "${offset} + ${size} - 1")
+	foreach(i RANGE ${last} ${offset} -1)
+		math(EXPR pos "${i} * 2")
+		string(SUBSTRING "${header}" ${pos} 2 byte)
+		foreach(k 0 1)
+			string(SUBSTRING "${byte}" ${k} 1 digit)
+			string(FIND "0123456789abcdef" "${digit}" digit)
+			math(EXPR value "${value} * 16 + ${digit}")
+		endforeach()
+	endforeach()
+	set(${out} ${value} PARENT_SCOPE)
+endfunction()
+
+set(source "// Generated by cmake/embed_assets.cmake, do not edit.\n#include \"assets.h\"\n\n")
+set(file_items "")
+set(index 0)
+foreach(name ${FILES})
+	file(READ "${RESOURCE_DIR}/${name}" hex HEX)
+	string(LENGTH "${hex}" length)
+	math(EXPR size "${length} / 2")
+	hex_to_c_array("${hex}" items)
+	# A trailing zero keeps empty files valid C.
+	set(source "${source}static const u8 file_${index}[] = {\n\t${items}0\n};\n")
+	set(file_items "${file_items}\t{\"${name}\", file_${index}, ${size}},\n")
+	math(EXPR index "${index} + 1")
+endforeach()
+set(file_count ${index})
+
+# Bitmaps are stored from the bottom up with rows padded to 4 bytes, which
+# is the layout of `Image`, so only the pixel array is kept.
+set(image_items "")
+set(index 0)
+foreach(name ${IMAGES})
+	set(path "${RESOURCE_DIR}/${name}")
+	file(READ "${path}" header LIMIT 54 HEX)
+	string(SUBSTRING "${header}" 0 4 signature)
+	read_le("${header}" 10 4 pixel_data_offset)
+	read_le("${header}" 14 4 header_size)
+	read_le("${header}" 18 4 width)
+	read_le("${header}" 22 4 height)
+	read_le("${header}" 28 2 bit_count)
+	read_le("${header}" 30 4 compression)
+	if(NOT signature STREQUAL "424d" OR NOT header_size EQUAL 40 OR NOT compression EQUAL 0)
+		message(FATAL_ERROR "${path} is not an uncompressed bitmap with a 40 byte header")
+	endif()
+	# Negative sizes are stored mirrored, which would need converting.
+	if(width GREATER 2147483647 OR height GREATER 2147483647)
+		message(FATAL_ERROR "${path} is stored mirrored or from the top down")
+	endif()
+	if(bit_count EQUAL 24)
+		set(format image_format_bgr)
+	elseif(bit_count EQUAL 32)
+		set(format image_format_bgra)
+	else()
+		message(FATAL_ERROR "${path} has ${bit_count} bits per pixel, not 24 or 32")
+	endif()
+	math(EXPR row_size "(${width} * ${bit_count} / 8 + 3) / 4 * 4")
+	math(EXPR size "${row_size} * ${height}")
+	file(READ "${path}" hex OFFSET ${pixel_data_offset} LIMIT ${size} HEX)
+	string(LENGTH "${hex}" length)
+	math(EXPR read_size "${length} / 2")
+	if(NOT read_size EQUAL size)
+		message(FATAL_ERROR "${path} is truncated")
+	endif()
+	hex_to_c_array("${hex}" items)
+	set(source "${source}static const u8 image_${index}[] = {\n\t${items}\n};\n")
+	set(image_items "${image_items}\t{\"${name}\", ${width}, ${height}, ${format}, image_${index}},\n")
+	math(EXPR index "${index} + 1")
+endforeach()
+set(image_count ${index})
+
+# Arrays of no elements are not valid C, so the tables end with a sentinel.
+set(source "${source}\nconst EmbeddedFile embedded_files[] = {\n${file_items}\t{0},\n};\n")
+set(source "${source}const size_t embedded_file_count = ${file_count};\n\n")
+set(source "${source}const EmbeddedImage embedded_images[] = {\n${image_items}\t{0},\n};\n")
+set(source "${source}const size_t embedded_image_count = ${image_count};\n")
+
+file(WRITE "${OUTPUT}" "${source}")
@@ -0,0 +1,60 @@
+#pragma once
+#include "alloc.h"
+#include "types.h"
+
+typedef enum AioBackend AioBackend;
+enum AioBackend {
+	// Requests are submitted to the kernel in batches through a shared ring.
+	aio_backend_uring,
+	// Requests are run by threads blocking on each of them.
+	aio_backend_threads,
+};
+
+typedef struct AioCompletion AioCompletion;
+struct AioCompletion {
+	// Of the completed request.
+	u32 buffer;
+	// Bytes transferred, or a negated error code.
+	i32 result;
+};
+
+typedef struct AioUring AioUring;
+typedef struct AioThreads AioThreads;
+
+// Asynchronous reads into a fixed set of buffers, one request per buffer.
+// Requests are queued, submitted together and completed in any order.
+// Only used on the calling thread.
+typedef struct Aio Aio;
+struct Aio {
+	Alloc* alloc;
+	AioBackend backend;
+	u8* buffers;
+	size_t buffer_size;
+	size_t buffer_count;
+	u32* free_buffers;
+	size_t free_count;
+	// Queued requests that are not submitted yet.
+	size_t queued_count;
+	// Submitted requests that are not completed yet.
+	size_t in_flight;
+	AioUring* uring;
+	AioThreads* threads;
+};
+
+// Uses io_uring if it is enabled and available, and threads otherwise.
+void aio_init(Aio* aio, Alloc* alloc, size_t buffer_count, size_t buffer_size);
+// Waits for the submitted requests, discarding their completions.
+void aio_deinit(Aio* aio);
+u8* aio_buffer(Aio* aio, u32 buffer);
+// Returns false if every buffer is taken.
+bool aio_acquire_buffer(Aio* aio, u32* buffer);
+void aio_release_buffer(Aio* aio, u32 buffer);
+// Queues a read of `size` bytes at `offset` of the file into the buffer.
+// The file must stay open until the read completes.
+void aio_read(Aio* aio, int fd, u64 offset, u32 size, u32 buffer);
+// Submits the queued requests at once.
+void aio_submit(Aio* aio);
+// Returns the amount of completions written to `out`, without waiting.
+size_t aio_poll(Aio* aio, AioCompletion* out, size_t capacity);
+// Like `aio_poll`, but waits for a completion if any request is submitted.
+size_t aio_wait(Aio* aio, AioCompletion* out, size_t capacity);
@@ -41,3 +41,69 @@ static inline Alloc* std_allocator_alloc(void) {
 	};
 	return &alloc;
 }
+
+// Bump allocator which frees everything at once on reset.
+// Memory is taken from `parent` in blocks that are kept across resets,
+// so after warming up it makes no calls to `parent`.
+typedef struct ArenaBlock ArenaBlock;
+typedef struct ArenaAllocator ArenaAllocator;
+struct ArenaAllocator {
+	Alloc alloc;
+	Alloc* parent;
+	size_t block_size;
+	ArenaBlock* first;
+	ArenaBlock* current;
+	void* last;
+};
+
+void arena_allocator_init(ArenaAllocator* arena, Alloc* parent, size_t block_size);
+void arena_allocator_deinit(ArenaAllocator* arena);
+void arena_allocator_reset(ArenaAllocator* arena);
+static inline Alloc* arena_allocator_alloc(ArenaAllocator* arena) {
+	return &arena->alloc;
+}
+
+// Allocator of slots of a fixed size, which are recycled through a free list.
+// Reallocating to at most `slot_size` bytes never moves the memory.
+typedef struct PoolBlock PoolBlock;
+typedef struct PoolAllocator PoolAllocator;
+struct PoolAllocator {
+	Alloc alloc;
+	Alloc* parent;
+	size_t slot_size;
+	size_t slots_per_block;
+	PoolBlock* blocks;
+	void* free_list;
+};
+
+void pool_allocator_init(
+	PoolAllocator* pool,
+	Alloc* parent,
+	size_t slot_size,
+	size_t slots_per_block);
+void pool_allocator_deinit(PoolAllocator* pool);
+static inline Alloc* pool_allocator_alloc(PoolAllocator* pool) {
+	return &pool->alloc;
+}
+
+// Linear allocator over a single buffer which is reset every frame.
+// Allocations that do not fit spill into an arena, and the buffer grows
+// on the next reset to fit the whole frame.
+typedef struct FrameAllocator FrameAllocator;
+struct FrameAllocator {
+	Alloc alloc;
+	Alloc* parent;
+	unsigned char* buffer;
+	size_t capacity;
+	size_t used;
+	void* last;
+	ArenaAllocator overflow;
+	size_t overflow_size;
+};
+
+void frame_allocator_init(FrameAllocator* frame, Alloc* parent, size_t capacity);
+void frame_allocator_deinit(FrameAllocator* frame);
+void frame_allocator_reset(FrameAllocator* frame);
+static inline Alloc* frame_allocator_alloc(FrameAllocator* frame) {
+	return &frame->alloc;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "image.h"
+#include "types.h"
+
+// Directory core assets are read from when they are not embedded.
+#define ASSETS_DEFAULT_DIR "./resources"
+// Environment variable naming a directory to read core assets from instead
+// of the embedded ones, so they can be edited without rebuilding.
+#define ASSETS_DIR_VARIABLE "CMINE_RESOURCES"
+
+// File of the resources compiled into the executable.
+typedef struct EmbeddedFile EmbeddedFile;
+struct EmbeddedFile
+{
+	const char *name;
+	const u8 *data;
+	size_t size;
+};
+
+// Bitmap of the resources compiled into the executable, already in the
+// layout of the pixels of an `Image` loaded from it.
+typedef struct EmbeddedImage EmbeddedImage;
+struct EmbeddedImage
+{
+	const char *name;
+	size_t width;
+	size_t height;
+	ImageFormat format;
+	const u8 *pixels;
+};
+
+// Defined by the source generated with `cmake/embed_assets.cmake`.
+extern const EmbeddedFile embedded_files[];
+extern const size_t embedded_file_count;
+extern const EmbeddedImage embedded_images[];
+extern const size_t embedded_image_count;
+
+// Returns the contents of a resource file followed by a zero byte,
+// or NULL if it cannot be found. Must be freed with `free`.
+char *assets_read_text(const char *name);
+// Loads a bitmap of the resources, see `image_load_bmp`.
+ImageError assets_load_image(Image *image, const char *name, Alloc *alloc);
@@ -72,6 +72,7 @@ enum
 	block_count
 };
 
+// Textures of block faces, which are also their layers in the block texture array.
 typedef enum AtlasTexture AtlasTexture;
 enum AtlasTexture {
 	atlas_none,
@@ -79,6 +80,27 @@ enum AtlasTexture {
 	atlas_count
 };
 
+// `mc_atlas.bmp` is a grid of this many square tiles along each side.
+#define ATLAS_TILES_PER_SIDE 16
+
+// Position of a texture's tile in `mc_atlas.bmp`, counted from the top left.
+typedef struct AtlasTile AtlasTile;
+struct AtlasTile {
+	int x;
+	int y;
+};
+
+// Returns false for textures without a tile in the atlas.
+static inline int atlas_texture_tile(AtlasTexture texture, AtlasTile *tile) {
+	switch (texture) {
+	case atlas_none:  return 0;
+	case atlas_stone: *tile = (AtlasTile){1, 0}; return 1;
+	default:
+		ASSERT(0);
+		return 0;
+	}
+}
+
 typedef enum FaceCulling FaceCulling;
 enum FaceCulling
 {
@@ -1,29 +1,95 @@
 #pragma once
-#include "perlin.h"
+#include "terrain.h"
 #include "block.h"
 #include "render.h"
+#include "mesh_pool.h"
+#include "config.h"
 
 typedef enum ChunkGenerationStage ChunkGenerationStage;
 enum ChunkGenerationStage 
 {
 	chunk_generation_stage_awaits_blocks,
+	// Holds generated blocks while its edits are read from the journal.
+	chunk_generation_stage_awaits_edits,
 	chunk_generation_stage_awaits_mesh,
 	chunk_generation_stage_ready,
 	chunk_generation_stage_count
 };
 
-#define CHUNK_SIDELEN 8
+// Amount of levels of detail a chunk may be generated at.
+// A chunk of level `lod` stores cubic cells of `1 << lod` blocks.
+#define CHUNK_LOD_COUNT 4
+#define CHUNK_LOD_SIDELEN(lod) (CHUNK_SIDELEN >> (lod))
 
+_Static_assert(
+	CHUNK_SIDELEN == 8 || CHUNK_SIDELEN == 16 || CHUNK_SIDELEN == 32,
+	"CHUNK_SIDELEN must be 8, 16 or 32");
+
+// Bitmask of a row of cells along x, one bit per cell.
+#if CHUNK_SIDELEN == 8
+typedef u8 ChunkRow;
+#elif CHUNK_SIDELEN == 16
+typedef u16 ChunkRow;
+#else
+typedef u32 ChunkRow;
+#endif
+#define CHUNK_ROW_BITS ((int)sizeof(ChunkRow) * 8)
+
+// Largest error in pixels a chunk mesh may have on screen before
+// a finer level of detail is used for it.
+#define CHUNK_LOD_MAX_SCREEN_ERROR 4.0f
+
+// Block storage of a chunk. Everything else about a loaded chunk is kept
+// in `Chunks`, so passes over many chunks do not stride across blocks.
 typedef struct Chunk Chunk;
 struct Chunk
 {
+	// Cells of the chunk's level of detail are packed at the front.
 	Block blocks[CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN];
-	Mesh mesh;
-	ChunkGenerationStage generation_stage;
+	u8 lod;
+	// Owners of the storage, which is shared with snapshots until either
+	// side writes to it. Only changed by the thread owning `Chunks`.
+	u32 refs;
 };
 
-#define CHUNK_BLOCK_IDX(x, y, z) (z * CHUNK_SIDELEN * CHUNK_SIDELEN + y * CHUNK_SIDELEN + x)
-#define CHUNK_BLOCK_IDX_V(v) CHUNK_BLOCK_IDX(v.x, v.y, v.z)
+#if CHUNK_LAYOUT == CHUNK_LAYOUT_MORTON
+// Spreads the low 10 bits of `v` out to every third bit.
+static inline u32 chunk_morton_spread(u32 v)
+{
+	v &= 0x3ff;
+	v = (v | v << 16) & 0x030000ff;
+	v = (v | v << 8) & 0x0300f00f;
+	v = (v | v << 4) & 0x030c30c3;
+	v = (v | v << 2) & 0x09249249;
+	return v;
+}
+#endif
+
+// Index of a cell among the cells of a chunk of the given level of detail,
+// according to `CHUNK_LAYOUT`. Cells are always packed at the front.
+static inline size_t chunk_cell_idx(int x, int y, int z, u8 lod)
+{
+#if CHUNK_LAYOUT == CHUNK_LAYOUT_X_MAJOR
+	size_t sidelen = CHUNK_LOD_SIDELEN(lod);
+	return ((size_t)z * sidelen + (size_t)y) * sidelen + (size_t)x;
+#elif CHUNK_LAYOUT == CHUNK_LAYOUT_Z_MAJOR
+	size_t sidelen = CHUNK_LOD_SIDELEN(lod);
+	return ((size_t)x * sidelen + (size_t)y) * sidelen + (size_t)z;
+#elif CHUNK_LAYOUT == CHUNK_LAYOUT_MORTON
+	// Coordinates below `1 << k` interleave into indices below `1 << 3k`,
+	// so every level of detail stays packed.
+	(void)lod;
+	return chunk_morton_spread((u32)x) |
+		chunk_morton_spread((u32)y) << 1 |
+		chunk_morton_spread((u32)z) << 2;
+#else
+#error "Unknown CHUNK_LAYOUT"
+#endif
+}
+
+#define CHUNK_CELL_IDX(x, y, z, lod) chunk_cell_idx((x), (y), (z), (lod))
+#define CHUNK_BLOCK_IDX(x, y, z) CHUNK_CELL_IDX((x), (y), (z), 0)
+#define CHUNK_BLOCK_IDX_V(v) CHUNK_BLOCK_IDX((v).x, (v).y, (v).z)
 
 typedef struct CPos CPos;
 struct CPos {
@@ -40,6 +106,15 @@ inline BPos cp2bp(CPos pos) {
 	};
 }
 
+// Returns the chunk containing the given world position.
+static inline CPos p2cp(Vec3 pos) {
+	return (CPos) {
+		.x = (int)floorf(pos.x / CHUNK_SIDELEN),
+		.y = (int)floorf(pos.y / CHUNK_SIDELEN),
+		.z = (int)floorf(pos.z / CHUNK_SIDELEN),
+	};
+}
+
 inline CPos bp2cp(BPos pos) {
 	return (CPos) {
 		.x = pos.x / CHUNK_SIDELEN,
@@ -48,32 +123,29 @@ inline CPos bp2cp(BPos pos) {
 	};
 }
 
-// A collection of adjacent chunks excluding the center chunk.
-typedef struct AdjacentChunks AdjacentChunks;
-struct AdjacentChunks
-{
-	Chunk* items[dir_count];
-};
-
 void chunk_init(
 	Chunk* chunk
 );
-void chunk_deinit(
-	Chunk* chunk
-);
 void chunk_generate_blocks(
 	Chunk *chunk, 
-	const Perlin *perlin, 
-	Fbm heightmap, 
-	BPos world_min
-);
-void chunk_generate_mesh(
-	Chunk *chunk, 
-	AdjacentChunks adjacent_chunks
+	Terrain *terrain,
+	BPos world_min,
+	u8 lod
 );
-void chunk_unload(
-	Chunk *chunk
+// Meshes the chunk at the given level of detail, downsampling its blocks
+// if they were generated at a finer level.
+// Vertices are built in `scratch`, which is cleared but kept allocated
+// so it can be reused for the next chunk.
+// Faces on the border are never culled against the neighbors, so the
+// mesh only depends on the chunk's own cells.
+Mesh chunk_generate_mesh(
+	const Chunk *chunk, 
+	u8 lod,
+	MeshBuilder *scratch
 );
+// Builds the vertices of the chunk's mesh in `scratch` like
+// `chunk_generate_mesh`, but leaves them there instead of uploading them.
+void chunk_build_mesh(const Chunk *chunk, u8 lod, MeshBuilder *scratch);
 
 // Specifies the thansformation between the world's chunk coordinates and 
 // the internal coordinates used by `Chunks`.
@@ -85,26 +157,157 @@ struct ChunkArea
 	size_t sidelen;
 };
 
+typedef enum ChunkFlags ChunkFlags;
+enum ChunkFlags
+{
+	// The chunk's mesh has no vertices, so there is nothing to draw.
+	chunk_flag_empty = 1 << 0,
+	// The chunk has edits that are not saved yet.
+	chunk_flag_edited = 1 << 1,
+};
+
+typedef struct ChunkBounds ChunkBounds;
+struct ChunkBounds
+{
+	Vec3 min;
+	Vec3 max;
+};
+
+// Marks a missing neighbor in `Chunks.neighbors`.
+#define CHUNKS_NO_NEIGHBOR UINT32_MAX
+
+// Reads of edits that may be in flight at once.
+#define CHUNKS_MAX_LOADS 32
+// Chunks given blocks per call of `chunks_generate_blocks`, so a new
+// row of chunks entering the area is spread over several frames.
+#define CHUNKS_MAX_GENERATIONS 128
+// Chunks remeshed for a new level of detail per frame, so crossing into
+// another chunk does not remesh the whole area at once.
+#define CHUNKS_MAX_LOD_UPDATES 16
+
+typedef struct Journal Journal;
+typedef struct Residency Residency;
+typedef struct Aio Aio;
+typedef struct MeshCache MeshCache;
+
+// Read of the edits of a chunk awaiting them.
+typedef struct ChunkLoad ChunkLoad;
+struct ChunkLoad
+{
+	CPos pos;
+	u32 buffer;
+	u32 size;
+	u32 checksum;
+};
+
 // A moveable area of chunks ment to be loaded and updated on the fly.
+// Metadata of the chunks is stored in separate arrays, all indexed by
+// `CHUNKS_CHUNK_IDX` of the internal coordinates.
 typedef struct Chunks Chunks;
 struct Chunks
 {
 	ChunkArea area;
-	Chunk *items;
+	// Values of `ChunkGenerationStage`.
+	u8 *stages;
+	// Combinations of `ChunkFlags`.
+	u8 *flags;
+	// Level of detail of the meshes, never finer than that of the blocks.
+	u8 *mesh_lods;
+	ChunkBounds *bounds;
+	// Handles of the meshes of ready chunks in `mesh_pool`.
+	u32 *meshes;
+	// Indices of the adjacent chunks by `Dir`.
+	u32 (*neighbors)[dir_count];
+	// Block storage is allocated chunk by chunk from `chunk_alloc`,
+	// so it can be freed and replaced while streaming.
+	Chunk **items;
+	// Indices of the chunks flagged `chunk_flag_edited`.
+	u32 *edited;
+	size_t edited_count;
+	// Reads in flight, possibly of chunks that have left the area since.
+	ChunkLoad *loads;
+	size_t load_count;
+	// Chunks with identical cells share their mesh.
+	MeshPool mesh_pool;
+	// Offsets of the drawn chunks, grouped by mesh.
+	Vec3OpenGL *instance_offsets;
+	MeshInstances instances;
+	Alloc *alloc;
+	Alloc *chunk_alloc;
+};
+
+// Chunks that were edited when the snapshot was taken. Their blocks are
+// shared with `Chunks` until it writes to them, so the snapshot stays
+// unchanged and may be read by another thread until it is released.
+typedef struct ChunkSnapshot ChunkSnapshot;
+struct ChunkSnapshot
+{
+	CPos *positions;
+	const Chunk **items;
+	// Set by the reader for the chunks it has saved.
+	bool *is_saved;
+	size_t count;
+	size_t capacity;
+	Alloc *alloc;
 };
 
 #define CHUNKS_CHUNK_IDX(x, y, z, sidelen) (z * sidelen * sidelen + y * sidelen + x)
 #define CHUNKS_CHUNK_IDX_V(v, sidelen) CHUNKS_CHUNK_IDX(v.x, v.y, v.z, sidelen)
 
-void chunks_init(Chunks* chunks, CPos min, size_t sidelen);
+void chunks_init(
+	Chunks* chunks,
+	CPos min,
+	size_t sidelen,
+	Alloc* alloc,
+	Alloc* chunk_alloc
+);
 void chunks_deinit(Chunks *chunks);
+// Generates chunks awaiting blocks, unless they are stored in `residency`.
+// Edits recorded in its journal are read through `aio`, and applied once
+// the reads complete in this or a later call. Chunks nearest to `focus`
+// are taken first, up to `CHUNKS_MAX_GENERATIONS`, and further ones are
+// generated at a coarser level of detail. Temporary buffers come from `scratch`.
 void chunks_generate_blocks(
 	Chunks* chunks,
-	const Perlin* perlin,
-	Fbm heightmap_fbm
+	Terrain* terrain,
+	Residency* residency,
+	Aio* aio,
+	CPos focus,
+	Alloc* scratch
+);
+// Waits for the reads of edits and applies them.
+void chunks_finish_loads(Chunks* chunks, Journal* journal, Aio* aio, Alloc* scratch);
+// Meshes chunks awaiting a mesh. Meshes are reused from `cache` and
+// stored into it, unless it is NULL.
+void chunks_generate_mesh(Chunks* chunks, MeshBuilder* scratch, MeshCache* cache);
+// Remeshes chunks whose level of detail no longer matches their error
+// on screen, refining their blocks if necessary. Only the nearest
+// `CHUNKS_MAX_LOD_UPDATES` of them are remeshed, the rest in later calls.
+void chunks_update_lod(
+	Chunks* chunks,
+	Terrain* terrain,
+	Vec3 eye,
+	Perspective p,
+	i32 viewport_height,
+	MeshBuilder* scratch,
+	MeshCache* cache
 );
-void chunks_generate_mesh(Chunks* chunks);
 void chunks_unload(Chunks* chunks);
 void chunks_draw(Chunks* chunks, Camera cam, Perspective p);
-
-// void chunks_move(Chunks* chunks, Vec3i delta);
+// Moves the area to start at `min`. Chunks that left it are stored in
+// `residency` and replaced with ones that await blocks, the rest keep their slots.
+void chunks_move(Chunks* chunks, CPos min, Residency* residency, Alloc* scratch);
+// Records the edits of all edited chunks.
+void chunks_save(Chunks* chunks, Journal* journal, Terrain* terrain);
+void chunk_snapshot_init(ChunkSnapshot* snapshot, Alloc* alloc);
+// The snapshot must be released.
+void chunk_snapshot_deinit(ChunkSnapshot* snapshot);
+// Takes the edited chunks into an empty snapshot, in time proportional to
+// their amount. They are no longer flagged as edited afterwards.
+void chunks_snapshot(Chunks* chunks, ChunkSnapshot* snapshot);
+// Drops the snapshot's blocks once the reader is done with them.
+// Chunks it has not saved are flagged as edited again if still loaded.
+void chunks_release_snapshot(Chunks* chunks, ChunkSnapshot* snapshot);
+// Sets a block of a generated chunk, refining the chunk to the full level
+// of detail first. Returns false if the block is not within a generated chunk.
+bool chunks_set_block(Chunks* chunks, Terrain* terrain, BPos pos, Block block);
@@ -0,0 +1,33 @@
+#pragma once
+#include "block.h"
+#include "alloc.h"
+
+// Compression of block arrays, shared by everything that stores or sends
+// chunks. Blocks are mapped through a palette to dense indices, the indices
+// are run-length encoded and the runs are compressed by an LZ back end,
+// which is only kept when it makes the result smaller.
+
+// Upper bounds of the output sizes of the individual stages.
+#define CODEC_RLE_BOUND(count) (2 * (count))
+#define CODEC_LZ_BOUND(size) ((size) + (size) / 255 + 16)
+// Upper bound of `codec_encode_blocks` for `count` blocks.
+#define CODEC_BOUND(count) (2 + 256 + 4 + CODEC_LZ_BOUND(CODEC_RLE_BOUND(count)))
+
+// Length of the run of bytes equal to `data[0]`, but at most `max`.
+size_t codec_run_length(const u8 *data, size_t max);
+
+// Writes (length - 1, value) pairs, each run being at most 256 long.
+size_t codec_rle_encode(const u8 *in, size_t size, u8 *out);
+// Returns false unless the runs add up to exactly `size` bytes.
+bool codec_rle_decode(const u8 *in, size_t in_size, u8 *out, size_t size);
+
+// Writes at most `CODEC_LZ_BOUND(size)` bytes.
+size_t codec_lz_encode(const u8 *in, size_t size, u8 *out);
+// Returns false unless the input decodes to exactly `size` bytes.
+bool codec_lz_decode(const u8 *in, size_t in_size, u8 *out, size_t size);
+
+// Encodes `count` blocks into at most `CODEC_BOUND(count)` bytes.
+// Temporary buffers are taken from `scratch`.
+size_t codec_encode_blocks(const Block *blocks, size_t count, u8 *out, Alloc *scratch);
+// Returns false if the input is malformed or does not hold `count` blocks.
+bool codec_decode_blocks(const u8 *in, size_t size, Block *blocks, size_t count, Alloc *scratch);
@@ -1,2 +1,48 @@
 #pragma once
 #define CMINE_ENABLE_GL_DEBUG
+
+// Length of a chunk side in blocks, one of 8, 16 or 32.
+// Set through the `CMINE_CHUNK_SIDELEN` CMake option.
+#ifndef CHUNK_SIDELEN
+#define CHUNK_SIDELEN 8
+#endif
+
+// Layouts of the blocks inside a chunk.
+// Blocks with consecutive x are adjacent in memory.
+#define CHUNK_LAYOUT_X_MAJOR 0
+// Blocks with consecutive z are adjacent, so vertical columns are contiguous.
+#define CHUNK_LAYOUT_Z_MAJOR 1
+// Blocks follow a Z-order curve, so neighbours in any direction are close.
+#define CHUNK_LAYOUT_MORTON 2
+// Set through the `CMINE_CHUNK_LAYOUT` CMake option.
+#ifndef CHUNK_LAYOUT
+#define CHUNK_LAYOUT CHUNK_LAYOUT_X_MAJOR
+#endif
+
+// Back slabs with transparent huge pages where the platform supports them.
+#define CMINE_ENABLE_HUGE_PAGES
+
+// Mesh chunks in two passes, counting the vertices first and then writing
+// them straight into a mapped GPU buffer of the exact size.
+// #define CMINE_ENABLE_MESH_TWO_PASS
+
+// Keep chunk meshes in the save directory, so chunks that did not change
+// since the last run are not meshed again.
+#define CMINE_ENABLE_MESH_CACHE
+
+// Keep linked shader programs in `PROGRAM_CACHE_DIR`, so they are not
+// compiled again while the driver and the shaders stay the same.
+#define CMINE_ENABLE_PROGRAM_CACHE
+
+// Core assets are compiled into the executable, rather than read from
+// `ASSETS_DEFAULT_DIR`. Set through the `CMINE_EMBED_ASSETS` CMake option.
+// #define CMINE_ENABLE_EMBEDDED_ASSETS
+
+// Amount of worker threads running background jobs.
+#define CMINE_WORKER_COUNT 3
+
+// Read from disk through io_uring where the kernel supports it,
+// rather than on a pool of threads blocking on every read.
+#define CMINE_ENABLE_IO_URING
+// Amount of threads reading from disk when io_uring is not used.
+#define CMINE_IO_THREAD_COUNT 2
@@ -71,4 +71,7 @@ bool context_is_mouse_key_pressed(MouseKey mouse_key);
 f64 conetxt_mouse_x(void);
 f64 conetxt_mouse_y(void);
 f64 context_time(void);
+// Seconds from an arbitrary point, which unlike `context_time` can be read
+// before the context exists. Monotonic where C11 offers it.
+f64 context_clock(void);
 void context_swap_buffers(void);
@@ -0,0 +1,45 @@
+#pragma once
+#include "chunk.h"
+
+// Side of a horizon tile in blocks.
+#define HORIZON_TILE_SIDELEN 128
+// Amount of tiles along a side of the horizon, which is centered at the camera.
+#define HORIZON_SIDELEN 16
+// Distance in blocks between the height samples of the closest tiles.
+// It doubles every time the distance to a tile doubles.
+#define HORIZON_MIN_STEP 4
+// Amount of tiles meshed per update, so streaming never stalls a frame.
+#define HORIZON_TILE_BUILDS_PER_UPDATE 4
+
+typedef struct HorizonTile HorizonTile;
+struct HorizonTile
+{
+	i32 x;
+	i32 y;
+	int step;
+	bool is_loaded;
+	Mesh mesh;
+};
+
+// A coarse heightfield of the terrain beyond the loaded chunks.
+// Tiles are stored toroidally and remeshed as the camera moves.
+typedef struct Horizon Horizon;
+struct Horizon
+{
+	HorizonTile tiles[HORIZON_SIDELEN * HORIZON_SIDELEN];
+	// Loaded chunks the horizon leaves a hole for.
+	ChunkArea hole;
+};
+
+void horizon_init(Horizon *horizon);
+void horizon_deinit(Horizon *horizon);
+// Forgets all tiles, for example after the terrain has changed.
+void horizon_unload(Horizon *horizon);
+void horizon_update(
+	Horizon *horizon,
+	Terrain *terrain,
+	ChunkArea loaded,
+	Vec3 eye,
+	MeshBuilder *scratch);
+// Should be drawn after chunks, so it is depth tested against them.
+void horizon_draw(const Horizon *horizon, Camera cam, Perspective p);
@@ -1,5 +1,6 @@
 #pragma once
 #include "pack.h"
+#include "alloc.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -26,12 +27,44 @@ enum ImageError
 	image_error_unsupported,  // Operation not supported for this type of input.
 };
 
+// Order of the bytes of a pixel.
+typedef enum ImageFormat ImageFormat;
+enum ImageFormat
+{
+	image_format_rgba,  // `Color32`.
+	image_format_bgr,  // Blue, green and red, without alpha.
+	image_format_bgra,  // Blue, green, red and alpha.
+};
+
+// Rows go from the bottom to the top of the image, each padded to a
+// multiple of 4 bytes, which is how OpenGL unpacks them by default.
+// Files are loaded in the format they store, so they are uploaded as is.
 typedef struct Image Image;
 struct Image
 {
 	size_t width;
 	size_t height;
-	Color32 *pixels;
+	ImageFormat format;
+	void *pixels;
 };
 
-ImageError image_load_bmp(Image *image, const char *filepath);
+static inline size_t image_pixel_size(ImageFormat format)
+{
+	return format == image_format_bgr ? 3 : 4;
+}
+
+// Size of a row of pixels in bytes, including its padding.
+static inline size_t image_row_size(const Image *image)
+{
+	return (image->width * image_pixel_size(image->format) + 3) & ~(size_t)3;
+}
+
+// Pixels are allocated from `alloc` and must be freed with `image_deinit`.
+ImageError image_load_bmp(Image *image, const char *filepath, Alloc *alloc);
+// Decodes a QOI image in a single pass over the file, into `image_format_rgba`
+// pixels allocated from `alloc`, which also holds the buffer of the file.
+ImageError image_load_qoi(Image *image, const char *filepath, Alloc *alloc);
+// Encodes the image as QOI, with an alpha channel unless it is `image_format_bgr`.
+// The buffer of the file is allocated from `alloc`.
+ImageError image_store_qoi(const Image *image, const char *filepath, Alloc *alloc);
+void image_deinit(Image *image, Alloc *alloc);
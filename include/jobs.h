@@ -0,0 +1,25 @@
+#pragma once
+#include "alloc.h"
+#include "types.h"
+
+typedef void (*JobFn)(void* data);
+
+// Pool of worker threads running jobs in the order they were submitted.
+// Jobs must not submit further jobs or wait for them.
+typedef struct JobsShared JobsShared;
+typedef struct Jobs Jobs;
+struct Jobs {
+	Alloc* alloc;
+	JobsShared* shared;
+	size_t worker_count;
+};
+
+// With no workers, jobs run on the submitting thread.
+void jobs_init(Jobs* jobs, Alloc* alloc, size_t worker_count);
+// Waits for all submitted jobs before stopping the workers.
+void jobs_deinit(Jobs* jobs);
+void jobs_submit(Jobs* jobs, JobFn fn, void* data);
+// Returns once every job submitted so far has finished.
+void jobs_wait(Jobs* jobs);
+// Returns whether every job submitted so far has finished, without waiting.
+bool jobs_is_done(Jobs* jobs);
@@ -0,0 +1,95 @@
+#pragma once
+#include "chunk.h"
+#include "codec.h"
+#include <stdio.h>
+
+#define JOURNAL_PATH_CAPACITY 256
+// The journal is compacted once it has this many bytes of superseded
+// records, and they outweigh the live ones.
+#define JOURNAL_COMPACT_MIN_DEAD_SIZE (256u << 10)
+// Bound on the size of a record's payload.
+#define JOURNAL_MAX_PAYLOAD_SIZE CODEC_BOUND(CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN)
+
+// Latest record of an edited chunk.
+typedef struct JournalEntry JournalEntry;
+struct JournalEntry
+{
+	CPos pos;
+	bool is_used;
+	// Zero if the chunk no longer differs from the generated one.
+	u32 size;
+	// Offset of the payload in the file.
+	u64 offset;
+	u32 checksum;
+};
+
+// Where the payload of a chunk's latest record is, so it can be read
+// without blocking the journal.
+typedef struct JournalRead JournalRead;
+struct JournalRead
+{
+	int fd;
+	u64 offset;
+	u32 size;
+	u32 checksum;
+};
+
+typedef struct JournalLock JournalLock;
+
+// Edits of a single world, stored as an append-only file of records.
+// A record holds the difference between an edited chunk and the one
+// generated from the seed, so saves scale with the amount of edits rather
+// than with the explored area. Later records of a chunk supersede earlier ones.
+// Chunks may be loaded and saved from several threads at once.
+typedef struct Journal Journal;
+struct Journal
+{
+	char path[JOURNAL_PATH_CAPACITY];
+	FILE *file;
+	// Separate descriptor of the file for reads of payloads, which
+	// do not move the position of `file`.
+	int read_fd;
+	// Reads that have begun and not ended, the file is not compacted
+	// meanwhile.
+	u32 pending_reads;
+	// Must be thread safe.
+	Alloc *alloc;
+	// Guards the file and the entries.
+	JournalLock *lock;
+	// Open addressed by chunk position.
+	JournalEntry *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+	// End of the last intact record, where the next one is written.
+	u64 end;
+	// Bytes of the latest records of every chunk.
+	u64 live_size;
+	// Of the terrain that the records are differences from.
+	u32 terrain_hash;
+};
+
+// Opens the journal in `dir`, creating both if necessary, for edits of
+// chunks generated by `terrain`. Returns false if neither could be done,
+// or if the journal was recorded against another terrain.
+bool journal_init(Journal *journal, const char *dir, const Terrain *terrain, Alloc *alloc);
+void journal_deinit(Journal *journal);
+
+// Returns false if the chunk has no edits. Otherwise the payload stays
+// in place until `journal_read_end`.
+bool journal_read_begin(Journal *journal, CPos pos, JournalRead *read);
+void journal_read_end(Journal *journal);
+// Applies a payload read into `payload` to the chunk, which must hold
+// the blocks generated at the full level of detail. Temporary buffers
+// come from `scratch`.
+// Returns false and leaves the chunk as it was if the payload is corrupted.
+bool journal_apply_chunk(
+	Journal *journal,
+	CPos pos,
+	const JournalRead *read,
+	const u8 *payload,
+	Chunk *chunk,
+	Alloc *scratch);
+// Records how the chunk differs from the generated one. `terrain` is only
+// used by the calling thread, the chunk must not change until this returns.
+// Returns false on an IO error.
+bool journal_save_chunk(Journal *journal, Terrain *terrain, CPos pos, const Chunk *chunk);
@@ -0,0 +1,55 @@
+#pragma once
+#include "render.h"
+#include "types.h"
+#include <stdio.h>
+
+#define MESH_CACHE_PATH_CAPACITY 256
+// The cache starts over once its file grows past this many bytes, rather
+// than tracking which of its meshes are still used.
+#define MESH_CACHE_MAX_SIZE (64u << 20)
+
+typedef struct MeshCacheEntry MeshCacheEntry;
+struct MeshCacheEntry
+{
+	u64 key;
+	bool is_used;
+	// The vertices are in the mapped file. Meshes added since it was
+	// mapped are only indexed, so they are not written twice.
+	bool is_mapped;
+	// The vertices matched their checksum, which is only verified once.
+	bool is_verified;
+	u32 count;
+	u32 checksum;
+	// Offset of the vertices in the mapped file.
+	u64 offset;
+};
+
+// Vertices of meshes from earlier runs keyed by a hash of what they were
+// built from, so unchanged chunks are uploaded straight from the file
+// rather than meshed again. The file is mapped once when the cache is
+// opened, new meshes are appended to it for the next run.
+typedef struct MeshCache MeshCache;
+struct MeshCache
+{
+	char path[MESH_CACHE_PATH_CAPACITY];
+	FILE *file;
+	const u8 *data;
+	size_t data_size;
+	// End of the last intact record, where the next one is written.
+	u64 end;
+	// Open addressed by key.
+	MeshCacheEntry *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+	Alloc *alloc;
+};
+
+// Opens the cache in `dir`, which must exist, creating its file if necessary.
+// Returns false if neither could be done.
+bool mesh_cache_init(MeshCache *cache, const char *dir, Alloc *alloc);
+void mesh_cache_deinit(MeshCache *cache);
+u64 mesh_cache_hash(const void *data, size_t size, u64 seed);
+// Uploads the mesh stored under `key`. Returns false if there is none.
+bool mesh_cache_find(MeshCache *cache, u64 key, Mesh *mesh);
+// Stores a mesh under `key` for the next run, unless it is stored already.
+void mesh_cache_insert(MeshCache *cache, u64 key, const MeshVertex *items, GLsizei count);
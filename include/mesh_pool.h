@@ -0,0 +1,53 @@
+#pragma once
+#include "render.h"
+#include "types.h"
+
+// Marks a missing mesh, and the end of the list of free entries.
+#define MESH_POOL_NONE UINT32_MAX
+
+typedef struct MeshPoolEntry MeshPoolEntry;
+struct MeshPoolEntry
+{
+	u64 key;
+	Mesh mesh;
+	// Users of the mesh, the entry is free once there are none.
+	// Free entries are linked through `next_free`.
+	u32 refs;
+	u32 next_free;
+	// Range of the entry's instances while they are drawn,
+	// `MESH_POOL_NONE` and zero otherwise.
+	u32 first_instance;
+	u32 instance_count;
+};
+
+// Meshes shared by everything built from the same content, looked up by
+// a hash of that content. Each mesh is uploaded once and deleted when its
+// last user releases it, so repetitive worlds take less video memory.
+typedef struct MeshPool MeshPool;
+struct MeshPool
+{
+	MeshPoolEntry *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+	u32 free_entry;
+	// Open addressed table of entry indices plus one, zero marks an empty slot.
+	u32 *table;
+	size_t table_capacity;
+	Alloc *alloc;
+};
+
+void mesh_pool_init(MeshPool *pool, Alloc *alloc);
+// All meshes must be released.
+void mesh_pool_deinit(MeshPool *pool);
+// Returns the mesh stored under `key` with a new reference to it,
+// or `MESH_POOL_NONE` if there is none.
+u32 mesh_pool_acquire(MeshPool *pool, u64 key);
+// Stores a mesh which is not stored yet, with a single reference to it.
+u32 mesh_pool_insert(MeshPool *pool, u64 key, Mesh mesh);
+// Drops a reference, deleting the mesh if it was the last one.
+void mesh_pool_release(MeshPool *pool, u32 handle);
+
+static inline const Mesh *mesh_pool_mesh(const MeshPool *pool, u32 handle)
+{
+	return &pool->entries[handle].mesh;
+}
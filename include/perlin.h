@@ -17,6 +17,22 @@ float perlin3(const Perlin *perlin, float x, float y, float z);
 float perlin2(const Perlin *perlin, float x, float y);
 float perlin1(const Perlin *perlin, float x);
 
+// Simplex noise shares the permutation table with Perlin noise.
+// It needs fewer gradient evaluations per sample and has less visible
+// grid artifacts, especially in 3D.
+float simplex3(const Perlin *perlin, float x, float y, float z);
+float simplex2(const Perlin *perlin, float x, float y);
+
+// Gradient noise used by `Fbm`.
+typedef enum FbmNoise FbmNoise;
+enum FbmNoise
+{
+	fbm_noise_perlin,
+	// Falls back to Perlin noise for `fbm1`.
+	fbm_noise_simplex,
+	fbm_noise_count
+};
+
 // Settings for noise generation with the fractional Brownian motion algorithm.
 typedef struct Fbm Fbm;
 struct Fbm
@@ -26,6 +42,7 @@ struct Fbm
 	float intensity;
 	float lacunarity;
 	float persistance;
+	FbmNoise noise;
 };
 
 float fbm3(
@@ -0,0 +1,21 @@
+#pragma once
+#include "glad.h"  // THIS MUST ALWAYS BE INCLUDED FIRST
+#include "types.h"
+#include <stddef.h>
+
+// Directory linked programs are kept in between runs.
+#define PROGRAM_CACHE_DIR "cache/programs"
+
+// Returns whether the driver can hand out linked programs to be cached,
+// which needs OpenGL 4.1.
+bool program_cache_is_supported(void);
+// Key of a program linked from the given sources by the current driver.
+// Programs of other drivers, or of other versions of the same driver,
+// have other keys, since their binaries would be rejected or worse.
+u64 program_cache_key(const char *const *sources, size_t count);
+// Returns the program stored under `name` if it was stored with `key`,
+// or 0 if it was not stored or the driver rejected it.
+GLuint program_cache_load(const char *name, u64 key);
+// Stores a linked program under `name`, replacing the one stored before.
+// The program should be linked with `GL_PROGRAM_BINARY_RETRIEVABLE_HINT`.
+void program_cache_store(const char *name, u64 key, GLuint program);
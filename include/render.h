@@ -3,6 +3,7 @@
 #include "context.h"
 #include "vmath.h"
 #include "image.h"
+#include "alloc.h"
 
 typedef struct Perspective Perspective;
 struct Perspective
@@ -32,7 +33,10 @@ typedef struct MeshVertex MeshVertex;
 PACK(struct MeshVertex
 {
 	Vec3OpenGL pos;
+	// In blocks, textures repeat once per block.
 	Uv uv;
+	// Layer of the block texture array, an `AtlasTexture`.
+	f32 layer;
 });
 
 typedef struct Mesh Mesh;
@@ -48,19 +52,88 @@ struct MeshBuilder
 	GLsizei count;
 	GLsizei capacity;
 	MeshVertex* items;
+	Alloc* alloc;
+};
+
+// Mesh whose vertices are written straight into a mapped GPU buffer.
+typedef struct MeshWriter MeshWriter;
+struct MeshWriter
+{
+	Mesh mesh;
+	GLuint vbo;
+	MeshVertex* items;
+};
+
+// Offsets of the instances of meshes drawn by `mesh_draw_instances`,
+// uploaded again every frame.
+typedef struct MeshInstances MeshInstances;
+struct MeshInstances
+{
+	GLuint vbo;
+};
+
+// Shader programs of the renderer.
+typedef enum RenderProgram RenderProgram;
+enum RenderProgram
+{
+	render_program_chunk,
+	render_program_quad,
+	render_program_count
+};
+
+// Assets of the renderer, which are decoded without an OpenGL context,
+// so they can be loaded on a worker while the window is created.
+typedef struct RenderAssets RenderAssets;
+struct RenderAssets
+{
+	Image atlas;
+	bool has_atlas;
+	// Vertex and fragment shader sources of every program, or NULL.
+	char *shader_sources[render_program_count][2];
 };
 
 GLuint load_pixel_texture(const Image *image);
 
-int render_init(void);
+// Reports the assets that could not be loaded.
+void render_assets_load(RenderAssets *assets);
+void render_assets_deinit(RenderAssets *assets);
+
+// Shader programs only start compiling here, and are waited for on
+// their first use. Programs that fail to compile are reported then,
+// with their logs in `scratch`, which must live until then.
+int render_init(const RenderAssets *assets, Alloc *scratch);
 void render_draw_quad(GLuint texture, Mat4x4 transform);
 GLuint render_tmp_texture(void);
+// Array texture with a layer for every `AtlasTexture`.
+GLuint render_block_textures(void);
 GLuint render_chunk_shader_program(void);
 
-void mb_init(MeshBuilder* mb);
+// Vertices are stored in memory from `alloc`. Builders are meant to be
+// kept as persistent scratch, which only grows and is reused by `mb_clear`.
+void mb_init(MeshBuilder* mb, Alloc* alloc);
 void mb_deinit(MeshBuilder* mb);
+// Forgets the vertices but keeps the memory, so the builder can be reused.
+void mb_clear(MeshBuilder* mb);
+// Appends `count` uninitialized vertices and returns them.
+MeshVertex* mb_push(MeshBuilder* mb, GLsizei count);
 Mesh mb_create(const MeshBuilder* mb);
+// Uploads `count` vertices, which may be read from a mapped file.
+Mesh mesh_create(const MeshVertex* items, GLsizei count);
 void mb_append(MeshBuilder* mb, MeshVertex vertex);
 void mesh_draw(const Mesh* mesh, GLuint texture, Camera cam, Perspective p);
 void mesh_draw_matrix(const Mesh* mesh, GLuint texture, Mat4x4 transform);
+Mat4x4 camera_transform(Camera cam, Perspective p);
+void mesh_instances_deinit(MeshInstances* instances);
+void mesh_instances_upload(MeshInstances* instances, const Vec3OpenGL* offsets, GLsizei count);
+// Draws the mesh once for each of `count` offsets starting at `first`.
+void mesh_draw_instances(
+	const Mesh* mesh,
+	GLuint texture,
+	Mat4x4 transform,
+	const MeshInstances* instances,
+	GLsizei first,
+	GLsizei count);
 void mesh_deinit(Mesh* mesh);
+// Returns storage for exactly `count` vertices, which is valid until `mesh_writer_end`.
+MeshVertex* mesh_writer_begin(MeshWriter* writer, GLsizei count);
+Mesh mesh_writer_end(MeshWriter* writer);
@@ -0,0 +1,90 @@
+#pragma once
+#include "chunk.h"
+#include "journal.h"
+#include "jobs.h"
+
+typedef struct Saver Saver;
+
+// Bytes that chunks outside of the loaded area may take by default.
+#define RESIDENCY_DEFAULT_BUDGET (16u << 20)
+// Stored chunks up to this many chunks outside of the loaded area are
+// decompressed ahead of time, so they are ready when the area moves over them.
+#define RESIDENCY_PREFETCH_MARGIN 1
+// Marks the end of the lists of `ResidencyEntry`.
+#define RESIDENCY_NONE UINT32_MAX
+
+typedef struct ResidencyEntry ResidencyEntry;
+struct ResidencyEntry
+{
+	CPos pos;
+	u8 lod;
+	bool is_edited;
+	// Neighbors from the most to the least recently used entry.
+	// Free entries are linked through `lru_next`.
+	u32 lru_prev;
+	u32 lru_next;
+	// Cells compressed with `codec_encode_blocks`.
+	u8 *data;
+	u32 size;
+	// Cells decompressed by a worker, or NULL.
+	Chunk *prefetched;
+	// Waits for its prefetch job to be submitted.
+	bool is_queued;
+	// Set by the prefetch job if the cells could not be decompressed.
+	bool is_corrupted;
+	// Evicted and being saved, which is reported with `residency_end_save`.
+	// Not in the list of recently used entries meanwhile.
+	bool is_saving;
+};
+
+// Chunks that left the loaded area are kept compressed and without meshes,
+// until they take more than `budget` bytes. Then the least recently used
+// ones are evicted, edited ones are saved by the saver and the rest are
+// dropped, since they can be generated again.
+typedef struct Residency Residency;
+struct Residency
+{
+	// Only used on the calling thread.
+	Alloc *alloc;
+	Journal *journal;
+	// Saves the evicted edited chunks off the calling thread.
+	Saver *saver;
+	Jobs *jobs;
+	size_t budget;
+	size_t used;
+	ResidencyEntry *entries;
+	size_t entry_count;
+	size_t entry_capacity;
+	u32 free_entry;
+	u32 lru_head;
+	u32 lru_tail;
+	// Open addressed table of entry indices plus one, zero marks an empty slot.
+	u32 *table;
+	size_t table_capacity;
+	// Workers may still be writing into prefetched chunks.
+	bool has_pending_jobs;
+};
+
+void residency_init(
+	Residency *residency,
+	Alloc *alloc,
+	Journal *journal,
+	Saver *saver,
+	Jobs *jobs,
+	size_t budget);
+// Drops the stored chunks without saving them. The saver must have
+// reported every eviction.
+void residency_deinit(Residency *residency);
+// Saves the edited chunks and drops all of them, waiting for the saver.
+void residency_flush(Residency *residency);
+// Compresses a chunk that left the loaded area. Temporary buffers of this
+// and `residency_take` come from `scratch`.
+void residency_store(Residency *residency, CPos pos, const Chunk *chunk, bool is_edited, Alloc *scratch);
+// Moves a stored chunk back into `chunk`. Returns false if it is not
+// stored, or if it was corrupted and has to be generated again.
+bool residency_take(Residency *residency, CPos pos, Chunk *chunk, bool *is_edited, Alloc *scratch);
+// Starts decompressing the stored chunks around the area on the workers.
+void residency_prefetch(Residency *residency, ChunkArea area);
+// Removes an evicted entry once it is saved, otherwise keeps it as edited,
+// so saving is retried when it is evicted again.
+void residency_end_save(Residency *residency, CPos pos, bool is_saved);
@@ -0,0 +1,62 @@
+#pragma once
+#include "chunk.h"
+#include "journal.h"
+#include "jobs.h"
+
+// Seconds between saves that run in the background.
+#define SAVER_INTERVAL 30.0
+
+typedef struct Saver Saver;
+
+// Edited chunk evicted from the residency, which keeps its entry until
+// the outcome is reported back.
+typedef struct SaverEviction SaverEviction;
+struct SaverEviction
+{
+	// Submitted before this one.
+	SaverEviction *next;
+	Saver *saver;
+	CPos pos;
+	// Cells compressed with `codec_encode_blocks` at the full level of detail.
+	u8 *data;
+	u32 size;
+	// Set by the saver's thread.
+	bool is_saved;
+};
+
+// Saves snapshots of the edited chunks, and the edited chunks evicted from
+// the residency, on a thread of its own. Both run in the order they were
+// submitted, so no record is superseded by an older one, and the frame
+// only pays for taking the snapshot.
+struct Saver
+{
+	Jobs jobs;
+	// Thread safe.
+	Alloc *alloc;
+	Journal *journal;
+	Residency *residency;
+	// Terrain caches are not thread safe, so the thread has its own ones.
+	Terrain terrain;
+	ChunkSnapshot snapshot;
+	// The snapshot is taken and has not been released yet.
+	bool is_saving;
+	// Evictions whose outcome has not been reported yet, latest first.
+	SaverEviction *evictions;
+};
+
+// `alloc` must be thread safe. The terrain's noise must outlive the saver.
+void saver_init(Saver *saver, Alloc *alloc, Journal *journal, const Terrain *terrain, Residency *residency);
+// Waits for the current save, which must have been finished.
+void saver_deinit(Saver *saver);
+// Starts saving the edited chunks, unless a save is still running.
+void saver_start(Saver *saver, Chunks *chunks);
+// Starts saving an edited chunk evicted from the residency, whose cells are copied.
+void saver_save_evicted(Saver *saver, CPos pos, const u8 *data, u32 size);
+// Releases the snapshot and reports the evictions to the residency once
+// their saves have finished, without waiting.
+void saver_update(Saver *saver, Chunks *chunks);
+// Waits for the current save and releases its snapshot.
+void saver_finish(Saver *saver, Chunks *chunks);
+// Waits for the saves of evicted chunks and reports them to the residency.
+// The snapshot is released by the next update or finish.
+void saver_finish_evictions(Saver *saver);
@@ -0,0 +1,47 @@
+#pragma once
+#include "alloc.h"
+
+// Size of the memory regions slabs are carved from, which is the size of a
+// huge page on x86-64.
+#define SLAB_REGION_SIZE (2u << 20)
+// Slots are aligned to cache lines.
+#define SLAB_SLOT_ALIGNMENT 64
+// Amount of slots moved between a `SlabCache` and its `Slab` at once.
+#define SLAB_CACHE_BATCH 32
+
+// Thread safe allocator of slots of a fixed size.
+// Free slots form an intrusive list, and regions are never returned to the
+// system before `slab_deinit`.
+typedef struct SlabRegion SlabRegion;
+typedef struct SlabLock SlabLock;
+typedef struct Slab Slab;
+struct Slab {
+	Alloc* parent;
+	size_t slot_size;
+	size_t stride;
+	SlabLock* lock;
+	void* free_list;
+	SlabRegion* regions;
+};
+
+void slab_init(Slab* slab, Alloc* parent, size_t slot_size);
+void slab_deinit(Slab* slab);
+
+// Per-thread cache of free slots, so most allocations do not take the lock.
+// Must only be used by a single thread at a time.
+typedef struct SlabCache SlabCache;
+struct SlabCache {
+	Alloc alloc;
+	Slab* slab;
+	void* free_list;
+	size_t count;
+};
+
+void slab_cache_init(SlabCache* cache, Slab* slab);
+// Returns the cached slots to the slab.
+void slab_cache_deinit(SlabCache* cache);
+void* slab_cache_allocate(SlabCache* cache);
+void slab_cache_free(SlabCache* cache, void* slot);
+static inline Alloc* slab_cache_alloc(SlabCache* cache) {
+	return &cache->alloc;
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "perlin.h"
+#include "types.h"
+#include "config.h"
+#include "alloc.h"
+
+// Distance in blocks between the samples of the density lattice.
+// Density between the samples is trilinearly interpolated.
+#define TERRAIN_LATTICE_STEP 4
+
+// Changed whenever the same settings and noise generate other blocks,
+// which invalidates the edits recorded against them.
+#define TERRAIN_GENERATOR_VERSION 1
+
+// Amount of density samples cached by a `Terrain`, must be a power of two.
+#define TERRAIN_LATTICE_CACHE_SIZE 4096
+
+// Amount of column heightmaps cached by a `Terrain`, must be a power of two.
+#define TERRAIN_COLUMN_CACHE_SIZE 256
+
+typedef enum TerrainKind TerrainKind;
+enum TerrainKind
+{
+	// Blocks are solid below a surface sampled from 2D noise.
+	terrain_kind_heightmap,
+	// Blocks are solid wherever 3D noise is dense enough, which allows
+	// for caves and overhangs.
+	terrain_kind_density,
+	terrain_kind_count
+};
+
+// Settings for terrain generation.
+typedef struct TerrainSettings TerrainSettings;
+struct TerrainSettings
+{
+	TerrainKind kind;
+	// Surface height for `terrain_kind_heightmap`.
+	Fbm heightmap;
+	// A block is solid for `terrain_kind_density` if
+	// `fbm3(pos) > density_threshold + pos.z * density_falloff`.
+	Fbm density;
+	float density_threshold;
+	float density_falloff;
+};
+
+typedef struct TerrainLatticeSample TerrainLatticeSample;
+struct TerrainLatticeSample
+{
+	i32 x;
+	i32 y;
+	i32 z;
+	float density;
+	bool is_valid;
+};
+
+// Surface heights of a column of chunks.
+typedef struct TerrainColumn TerrainColumn;
+struct TerrainColumn
+{
+	i32 x;
+	i32 y;
+	u8 lod;
+	bool is_valid;
+	float heights[CHUNK_SIDELEN * CHUNK_SIDELEN];
+};
+
+// Terrain generator of a single world.
+// Noise samples are cached, so chunks share the ones on their borders and
+// chunks stacked on top of each other share their heightmap.
+typedef struct Terrain Terrain;
+struct Terrain
+{
+	const Perlin *perlin;
+	TerrainSettings settings;
+	TerrainLatticeSample *lattice;
+	TerrainColumn *columns;
+	Alloc *alloc;
+};
+
+void terrain_init(
+	Terrain *terrain,
+	const Perlin *perlin,
+	TerrainSettings settings,
+	Alloc *alloc);
+void terrain_deinit(Terrain *terrain);
+
+// Surface heights of the column of chunks at the given chunk coordinates.
+// Heights are sampled every `1 << lod` blocks with fewer octaves for coarser
+// levels of detail, and are laid out x fastest.
+// The result is valid until the next call.
+const float *terrain_column_heights(Terrain *terrain, i32 x, i32 y, u8 lod);
+
+// Density at the given lattice coordinates, that is at
+// block coordinates multiplied by `TERRAIN_LATTICE_STEP`.
+float terrain_lattice_density(Terrain *terrain, i32 x, i32 y, i32 z);
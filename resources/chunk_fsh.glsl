@@ -2,10 +2,11 @@
 out vec4 frag_color;
   
 in vec2 uv;
+flat in float layer;
 
-uniform sampler2D atlas;
+uniform sampler2DArray atlas;
 
 void main() 
 {
-    frag_color = texture(atlas, uv);
+    frag_color = texture(atlas, vec3(uv, layer));
 }
@@ -1,12 +1,17 @@
 #version 330 core
 layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec2 a_uv;
+// Position of the instance, zero unless the mesh is drawn instanced.
+layout (location = 2) in vec3 a_offset;
+layout (location = 3) in float a_layer;
 
 out vec2 uv;
+flat out float layer;
 uniform mat4 transform;
 
 void main() 
 {
-    gl_Position = transform * vec4(a_pos, 1.0);
+    gl_Position = transform * vec4(a_pos + a_offset, 1.0);
     uv = a_uv;
+    layer = a_layer;
 }
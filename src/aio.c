@@ -0,0 +1,400 @@
+#if !defined(_WIN32)
+#define _GNU_SOURCE
+#endif
+#include "aio.h"
+#include "jobs.h"
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#if defined(CMINE_ENABLE_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define AIO_HAS_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+static void report_aio_error(const char* what) {
+	fprintf(stderr, "\nCaught runtime error:\n\tFailed to %s for disk reads.\n", what);
+	abort();
+}
+
+#if defined(AIO_HAS_URING)
+
+struct AioUring {
+	int fd;
+	u8* ring;
+	size_t ring_size;
+	struct io_uring_sqe* sqes;
+	size_t sqes_size;
+	u32* sq_tail;
+	u32* sq_array;
+	u32 sq_mask;
+	u32* cq_head;
+	u32* cq_tail;
+	struct io_uring_cqe* cqes;
+	u32 cq_mask;
+};
+
+static void uring_close(AioUring* uring) {
+	if (uring->sqes) munmap(uring->sqes, uring->sqes_size);
+	if (uring->ring) munmap(uring->ring, uring->ring_size);
+	close(uring->fd);
+}
+
+// Sets up a ring with a submission entry per buffer, and registers the
+// buffers so the kernel does not map them again for every read.
+// Returns false if the kernel does not support it.
+static bool uring_init(AioUring* uring, Aio* aio) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, (unsigned)aio->buffer_count, &params);
+	if (fd < 0) return false;
+	*uring = (AioUring){.fd = fd};
+	// Older kernels map the rings separately, those are not worth supporting.
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		uring_close(uring);
+		return false;
+	}
+
+	size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+	size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	void* ring = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (ring == MAP_FAILED) {
+		uring_close(uring);
+		return false;
+	}
+	uring->ring = ring;
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		uring_close(uring);
+		return false;
+	}
+	uring->sqes = sqes;
+	uring->sq_tail = (u32*)(uring->ring + params.sq_off.tail);
+	uring->sq_array = (u32*)(uring->ring + params.sq_off.array);
+	uring->sq_mask = *(u32*)(uring->ring + params.sq_off.ring_mask);
+	uring->cq_head = (u32*)(uring->ring + params.cq_off.head);
+	uring->cq_tail = (u32*)(uring->ring + params.cq_off.tail);
+	uring->cqes = (struct io_uring_cqe*)(uring->ring + params.cq_off.cqes);
+	uring->cq_mask = *(u32*)(uring->ring + params.cq_off.ring_mask);
+
+	struct iovec* iovecs;
+	allocate(aio->alloc, (void**)&iovecs, aio->buffer_count * sizeof(struct iovec));
+	for (size_t i = 0; i < aio->buffer_count; i++) {
+		iovecs[i] = (struct iovec){
+			.iov_base = aio->buffers + i * aio->buffer_size,
+			.iov_len = aio->buffer_size,
+		};
+	}
+	// Fails if the buffers exceed the limit of locked memory.
+	bool is_registered = syscall(
+		__NR_io_uring_register,
+		fd,
+		IORING_REGISTER_BUFFERS,
+		iovecs,
+		(unsigned)aio->buffer_count) == 0;
+	deallocate(aio->alloc, (void**)&iovecs);
+	if (!is_registered) {
+		uring_close(uring);
+		return false;
+	}
+	return true;
+}
+
+// Only the calling thread writes the submission tail, the kernel reads it.
+static void uring_queue(AioUring* uring, Aio* aio, int fd, u64 offset, u32 size, u32 buffer) {
+	u32 tail = *uring->sq_tail;
+	u32 idx = tail & uring->sq_mask;
+	struct io_uring_sqe* sqe = &uring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ_FIXED;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = (u64)(uintptr_t)aio_buffer(aio, buffer);
+	sqe->len = size;
+	sqe->buf_index = (u16)buffer;
+	sqe->user_data = buffer;
+	uring->sq_array[idx] = idx;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void uring_enter(AioUring* uring, u32 to_submit, u32 min_complete) {
+	u32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	for (;;) {
+		long submitted = syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete, flags, NULL, 0);
+		if (submitted >= 0) {
+			to_submit -= (u32)submitted;
+			if (to_submit == 0) return;
+			continue;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY) report_aio_error("submit requests");
+	}
+}
+
+static size_t uring_reap(AioUring* uring, AioCompletion* out, size_t capacity) {
+	u32 head = *uring->cq_head;
+	u32 tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+	size_t count = 0;
+	for (; head != tail && count < capacity; head++, count++) {
+		struct io_uring_cqe* cqe = &uring->cqes[head & uring->cq_mask];
+		out[count] = (AioCompletion){
+			.buffer = (u32)cqe->user_data,
+			.result = cqe->res,
+		};
+	}
+	__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+	return count;
+}
+
+#endif
+
+typedef struct AioRequest AioRequest;
+struct AioRequest {
+	AioThreads* threads;
+	int fd;
+	u64 offset;
+	u32 size;
+	u32 buffer;
+	u8* data;
+};
+
+struct AioThreads {
+	Jobs jobs;
+	mtx_t mutex;
+	// Signaled when a request completes.
+	cnd_t has_completions;
+	// By buffer.
+	AioRequest* requests;
+	// Buffers of the queued requests.
+	u32* queued;
+	AioCompletion* completions;
+	size_t completion_count;
+};
+
+// Returns the amount of bytes read, which is less than `size` past the
+// end of the file, or a negated error code.
+static i32 read_at(int fd, u64 offset, u8* data, u32 size) {
+#if defined(_WIN32)
+	HANDLE file = (HANDLE)_get_osfhandle(fd);
+	OVERLAPPED overlapped = {0};
+	overlapped.Offset = (DWORD)offset;
+	overlapped.OffsetHigh = (DWORD)(offset >> 32);
+	DWORD count;
+	if (!ReadFile(file, data, size, &count, &overlapped)) {
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -(i32)GetLastError();
+	}
+	return (i32)count;
+#else
+	u32 done = 0;
+	while (done < size) {
+		ssize_t count = pread(fd, data + done, size - done, (off_t)(offset + done));
+		if (count < 0 && errno == EINTR) continue;
+		if (count < 0) return -errno;
+		if (count == 0) break;
+		done += (u32)count;
+	}
+	return (i32)done;
+#endif
+}
+
+static void read_job_run(void* data) {
+	AioRequest* request = data;
+	i32 result = read_at(request->fd, request->offset, request->data, request->size);
+	AioThreads* threads = request->threads;
+	mtx_lock(&threads->mutex);
+	threads->completions[threads->completion_count++] = (AioCompletion){
+		.buffer = request->buffer,
+		.result = result,
+	};
+	cnd_signal(&threads->has_completions);
+	mtx_unlock(&threads->mutex);
+}
+
+static void threads_init(AioThreads* threads, Aio* aio) {
+	*threads = (AioThreads){0};
+	jobs_init(&threads->jobs, aio->alloc, CMINE_IO_THREAD_COUNT);
+	if (mtx_init(&threads->mutex, mtx_plain) != thrd_success) report_aio_error("create a lock");
+	if (cnd_init(&threads->has_completions) != thrd_success) report_aio_error("create a condition");
+	allocate(aio->alloc, (void**)&threads->requests, aio->buffer_count * sizeof(AioRequest));
+	allocate(aio->alloc, (void**)&threads->queued, aio->buffer_count * sizeof(u32));
+	allocate(aio->alloc, (void**)&threads->completions, aio->buffer_count * sizeof(AioCompletion));
+}
+
+static void threads_deinit(AioThreads* threads, Aio* aio) {
+	jobs_deinit(&threads->jobs);
+	cnd_destroy(&threads->has_completions);
+	mtx_destroy(&threads->mutex);
+	deallocate(aio->alloc, (void**)&threads->requests);
+	deallocate(aio->alloc, (void**)&threads->queued);
+	deallocate(aio->alloc, (void**)&threads->completions);
+}
+
+static size_t threads_reap(AioThreads* threads, AioCompletion* out, size_t capacity, bool should_wait) {
+	mtx_lock(&threads->mutex);
+	while (should_wait && threads->completion_count == 0) {
+		cnd_wait(&threads->has_completions, &threads->mutex);
+	}
+	size_t count = threads->completion_count < capacity ? threads->completion_count : capacity;
+	threads->completion_count -= count;
+	memcpy(out, threads->completions + threads->completion_count, count * sizeof(AioCompletion));
+	mtx_unlock(&threads->mutex);
+	return count;
+}
+
+void aio_init(Aio* aio, Alloc* alloc, size_t buffer_count, size_t buffer_size) {
+	ASSERT(buffer_count > 0 && buffer_count <= UINT16_MAX);
+	*aio = (Aio){
+		.alloc = alloc,
+		.buffer_size = buffer_size,
+		.buffer_count = buffer_count,
+		.free_count = buffer_count,
+	};
+	allocate(alloc, (void**)&aio->buffers, buffer_count * buffer_size);
+	allocate(alloc, (void**)&aio->free_buffers, buffer_count * sizeof(u32));
+	for (size_t i = 0; i < buffer_count; i++) aio->free_buffers[i] = (u32)(buffer_count - 1 - i);
+
+#if defined(AIO_HAS_URING)
+	allocate(alloc, (void**)&aio->uring, sizeof(AioUring));
+	if (uring_init(aio->uring, aio)) {
+		aio->backend = aio_backend_uring;
+		return;
+	}
+	deallocate(alloc, (void**)&aio->uring);
+#endif
+	aio->backend = aio_backend_threads;
+	allocate(alloc, (void**)&aio->threads, sizeof(AioThreads));
+	threads_init(aio->threads, aio);
+}
+
+void aio_deinit(Aio* aio) {
+	aio_submit(aio);
+	AioCompletion completions[16];
+	while (aio->in_flight > 0) aio_wait(aio, completions, 16);
+#if defined(AIO_HAS_URING)
+	if (aio->uring) {
+		uring_close(aio->uring);
+		deallocate(aio->alloc, (void**)&aio->uring);
+	}
+#endif
+	if (aio->threads) {
+		threads_deinit(aio->threads, aio);
+		deallocate(aio->alloc, (void**)&aio->threads);
+	}
+	deallocate(aio->alloc, (void**)&aio->free_buffers);
+	deallocate(aio->alloc, (void**)&aio->buffers);
+	*aio = (Aio){0};
+}
+
+u8* aio_buffer(Aio* aio, u32 buffer) {
+	ASSERT(buffer < aio->buffer_count);
+	return aio->buffers + buffer * aio->buffer_size;
+}
+
+bool aio_acquire_buffer(Aio* aio, u32* buffer) {
+	if (aio->free_count == 0) return false;
+	*buffer = aio->free_buffers[--aio->free_count];
+	return true;
+}
+
+void aio_release_buffer(Aio* aio, u32 buffer) {
+	ASSERT(aio->free_count < aio->buffer_count);
+	aio->free_buffers[aio->free_count++] = buffer;
+}
+
+void aio_read(Aio* aio, int fd, u64 offset, u32 size, u32 buffer) {
+	ASSERT(size <= aio->buffer_size);
+	switch (aio->backend) {
+#if defined(AIO_HAS_URING)
+	case aio_backend_uring:
+		uring_queue(aio->uring, aio, fd, offset, size, buffer);
+		break;
+#endif
+	case aio_backend_threads:
+		aio->threads->requests[buffer] = (AioRequest){
+			.threads = aio->threads,
+			.fd = fd,
+			.offset = offset,
+			.size = size,
+			.buffer = buffer,
+			.data = aio_buffer(aio, buffer),
+		};
+		aio->threads->queued[aio->queued_count] = buffer;
+		break;
+	default:
+		ASSERT(0);
+		break;
+	}
+	aio->queued_count++;
+}
+
+void aio_submit(Aio* aio) {
+	if (aio->queued_count == 0) return;
+	switch (aio->backend) {
+#if defined(AIO_HAS_URING)
+	case aio_backend_uring:
+		uring_enter(aio->uring, (u32)aio->queued_count, 0);
+		break;
+#endif
+	case aio_backend_threads:
+		for (size_t i = 0; i < aio->queued_count; i++) {
+			u32 buffer = aio->threads->queued[i];
+			jobs_submit(&aio->threads->jobs, read_job_run, &aio->threads->requests[buffer]);
+		}
+		break;
+	default:
+		ASSERT(0);
+		break;
+	}
+	aio->in_flight += aio->queued_count;
+	aio->queued_count = 0;
+}
+
+static size_t aio_reap(Aio* aio, AioCompletion* out, size_t capacity, bool should_wait) {
+	if (aio->in_flight == 0 || capacity == 0) return 0;
+	size_t count = 0;
+	switch (aio->backend) {
+#if defined(AIO_HAS_URING)
+	case aio_backend_uring:
+		count = uring_reap(aio->uring, out, capacity);
+		if (count == 0 && should_wait) {
+			uring_enter(aio->uring, 0, 1);
+			count = uring_reap(aio->uring, out, capacity);
+		}
+		break;
+#endif
+	case aio_backend_threads:
+		count = threads_reap(aio->threads, out, capacity, should_wait);
+		break;
+	default:
+		ASSERT(0);
+		break;
+	}
+	aio->in_flight -= count;
+	return count;
+}
+
+size_t aio_poll(Aio* aio, AioCompletion* out, size_t capacity) {
+	return aio_reap(aio, out, capacity, false);
+}
+
+size_t aio_wait(Aio* aio, AioCompletion* out, size_t capacity) {
+	return aio_reap(aio, out, capacity, true);
+}
@@ -0,0 +1,323 @@
+#include "alloc.h"
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#define ALLOC_ALIGNMENT (_Alignof(max_align_t))
+// Arena and frame allocations are prefixed with their size,
+// since `reallocate` is not told the old one.
+#define ALLOC_HEADER_SIZE (align_up(sizeof(size_t)))
+
+static size_t align_up(size_t size) {
+	return (size + ALLOC_ALIGNMENT - 1) & ~(ALLOC_ALIGNMENT - 1);
+}
+
+static size_t header_get_size(const void* ptr) {
+	return *(const size_t*)((const unsigned char*)ptr - ALLOC_HEADER_SIZE);
+}
+
+static void header_set_size(void* ptr, size_t size) {
+	*(size_t*)((unsigned char*)ptr - ALLOC_HEADER_SIZE) = size;
+}
+
+static size_t min_size(size_t a, size_t b) {
+	return a < b ? a : b;
+}
+
+struct ArenaBlock {
+	ArenaBlock* next;
+	size_t capacity;
+	size_t used;
+};
+
+#define ARENA_BLOCK_HEADER_SIZE (align_up(sizeof(ArenaBlock)))
+
+static unsigned char* arena_block_data(ArenaBlock* block) {
+	return (unsigned char*)block + ARENA_BLOCK_HEADER_SIZE;
+}
+
+static void* arena_push(ArenaAllocator* arena, size_t size) {
+	size_t need = ALLOC_HEADER_SIZE + align_up(size);
+	// Blocks past the current one are empty, so the first one that fits is used.
+	ArenaBlock* tail = NULL;
+	ArenaBlock* block = arena->current;
+	while (block != NULL && block->capacity - block->used < need) {
+		tail = block;
+		block = block->next;
+	}
+	if (block == NULL) {
+		size_t capacity = need > arena->block_size ? need : arena->block_size;
+		void* memory;
+		allocate(arena->parent, &memory, ARENA_BLOCK_HEADER_SIZE + capacity);
+		block = memory;
+		*block = (ArenaBlock){
+			.next = NULL,
+			.capacity = capacity,
+			.used = 0,
+		};
+		if (tail == NULL) arena->first = block;
+		else tail->next = block;
+	}
+	arena->current = block;
+
+	void* result = arena_block_data(block) + block->used + ALLOC_HEADER_SIZE;
+	block->used += need;
+	header_set_size(result, size);
+	arena->last = result;
+	return result;
+}
+
+static void arena_allocate(void* allocator, void** ptr, size_t size) {
+	*ptr = arena_push(allocator, size);
+}
+
+static void arena_reallocate(void* allocator, void** ptr, size_t size) {
+	ArenaAllocator* arena = allocator;
+	if (*ptr == NULL) {
+		*ptr = arena_push(arena, size);
+		return;
+	}
+	size_t old_size = header_get_size(*ptr);
+	if (*ptr == arena->last) {
+		// The last allocation grows in place while its block has room.
+		ArenaBlock* block = arena->current;
+		size_t old_need = align_up(old_size);
+		size_t new_need = align_up(size);
+		if (new_need <= old_need || block->capacity - block->used >= new_need - old_need) {
+			block->used = block->used - old_need + new_need;
+			header_set_size(*ptr, size);
+			return;
+		}
+	}
+	void* result = arena_push(arena, size);
+	memcpy(result, *ptr, min_size(old_size, size));
+	*ptr = result;
+}
+
+static void arena_deallocate(void* allocator, void** ptr) {
+	ArenaAllocator* arena = allocator;
+	if (*ptr != NULL && *ptr == arena->last) {
+		arena->current->used -= ALLOC_HEADER_SIZE + align_up(header_get_size(*ptr));
+		arena->last = NULL;
+	}
+	*ptr = NULL;
+}
+
+void arena_allocator_init(ArenaAllocator* arena, Alloc* parent, size_t block_size) {
+	ASSERT(parent != NULL);
+	ASSERT(block_size > 0);
+	*arena = (ArenaAllocator){
+		.alloc = {
+			.allocator = arena,
+			.allocate = arena_allocate,
+			.reallocate = arena_reallocate,
+			.deallocate = arena_deallocate,
+		},
+		.parent = parent,
+		.block_size = block_size,
+	};
+}
+
+void arena_allocator_deinit(ArenaAllocator* arena) {
+	ArenaBlock* block = arena->first;
+	while (block != NULL) {
+		void* memory = block;
+		block = block->next;
+		deallocate(arena->parent, &memory);
+	}
+	*arena = (ArenaAllocator){0};
+}
+
+void arena_allocator_reset(ArenaAllocator* arena) {
+	for (ArenaBlock* block = arena->first; block != NULL; block = block->next) {
+		block->used = 0;
+	}
+	arena->current = arena->first;
+	arena->last = NULL;
+}
+
+struct PoolBlock {
+	PoolBlock* next;
+};
+
+#define POOL_BLOCK_HEADER_SIZE (align_up(sizeof(PoolBlock)))
+
+static size_t pool_slot_stride(const PoolAllocator* pool) {
+	size_t stride = align_up(pool->slot_size);
+	return stride < sizeof(void*) ? sizeof(void*) : stride;
+}
+
+static void pool_grow(PoolAllocator* pool) {
+	size_t stride = pool_slot_stride(pool);
+	void* memory;
+	allocate(pool->parent, &memory, POOL_BLOCK_HEADER_SIZE + stride * pool->slots_per_block);
+	PoolBlock* block = memory;
+	block->next = pool->blocks;
+	pool->blocks = block;
+
+	unsigned char* slots = (unsigned char*)block + POOL_BLOCK_HEADER_SIZE;
+	for (size_t i = pool->slots_per_block; i-- > 0;) {
+		void* slot = slots + i * stride;
+		*(void**)slot = pool->free_list;
+		pool->free_list = slot;
+	}
+}
+
+static void pool_allocate(void* allocator, void** ptr, size_t size) {
+	PoolAllocator* pool = allocator;
+	ASSERT(size <= pool->slot_size);
+	if (pool->free_list == NULL) pool_grow(pool);
+	void* slot = pool->free_list;
+	pool->free_list = *(void**)slot;
+	*ptr = slot;
+}
+
+static void pool_reallocate(void* allocator, void** ptr, size_t size) {
+	PoolAllocator* pool = allocator;
+	ASSERT(size <= pool->slot_size);
+	if (*ptr == NULL) pool_allocate(pool, ptr, size);
+}
+
+static void pool_deallocate(void* allocator, void** ptr) {
+	PoolAllocator* pool = allocator;
+	if (*ptr != NULL) {
+		*(void**)*ptr = pool->free_list;
+		pool->free_list = *ptr;
+	}
+	*ptr = NULL;
+}
+
+void pool_allocator_init(
+	PoolAllocator* pool,
+	Alloc* parent,
+	size_t slot_size,
+	size_t slots_per_block)
+{
+	ASSERT(parent != NULL);
+	ASSERT(slot_size > 0);
+	ASSERT(slots_per_block > 0);
+	*pool = (PoolAllocator){
+		.alloc = {
+			.allocator = pool,
+			.allocate = pool_allocate,
+			.reallocate = pool_reallocate,
+			.deallocate = pool_deallocate,
+		},
+		.parent = parent,
+		.slot_size = slot_size,
+		.slots_per_block = slots_per_block,
+	};
+}
+
+void pool_allocator_deinit(PoolAllocator* pool) {
+	PoolBlock* block = pool->blocks;
+	while (block != NULL) {
+		void* memory = block;
+		block = block->next;
+		deallocate(pool->parent, &memory);
+	}
+	*pool = (PoolAllocator){0};
+}
+
+static int frame_owns(const FrameAllocator* frame, const void* ptr) {
+	const unsigned char* p = ptr;
+	return p >= frame->buffer && p < frame->buffer + frame->capacity;
+}
+
+static void frame_allocate(void* allocator, void** ptr, size_t size) {
+	FrameAllocator* frame = allocator;
+	size_t need = ALLOC_HEADER_SIZE + align_up(size);
+	if (frame->capacity - frame->used < need) {
+		frame->overflow_size += need;
+		allocate(arena_allocator_alloc(&frame->overflow), ptr, size);
+		return;
+	}
+	void* result = frame->buffer + frame->used + ALLOC_HEADER_SIZE;
+	frame->used += need;
+	header_set_size(result, size);
+	frame->last = result;
+	*ptr = result;
+}
+
+static void frame_reallocate(void* allocator, void** ptr, size_t size) {
+	FrameAllocator* frame = allocator;
+	if (*ptr == NULL) {
+		frame_allocate(frame, ptr, size);
+		return;
+	}
+	if (!frame_owns(frame, *ptr)) {
+		frame->overflow_size += align_up(size);
+		reallocate(arena_allocator_alloc(&frame->overflow), ptr, size);
+		return;
+	}
+	size_t old_size = header_get_size(*ptr);
+	if (*ptr == frame->last) {
+		size_t old_need = align_up(old_size);
+		size_t new_need = align_up(size);
+		if (new_need <= old_need || frame->capacity - frame->used >= new_need - old_need) {
+			frame->used = frame->used - old_need + new_need;
+			header_set_size(*ptr, size);
+			return;
+		}
+	}
+	void* result;
+	frame_allocate(frame, &result, size);
+	memcpy(result, *ptr, min_size(old_size, size));
+	*ptr = result;
+}
+
+static void frame_deallocate(void* allocator, void** ptr) {
+	FrameAllocator* frame = allocator;
+	if (*ptr == NULL) return;
+	if (!frame_owns(frame, *ptr)) {
+		deallocate(arena_allocator_alloc(&frame->overflow), ptr);
+		return;
+	}
+	if (*ptr == frame->last) {
+		frame->used -= ALLOC_HEADER_SIZE + align_up(header_get_size(*ptr));
+		frame->last = NULL;
+	}
+	*ptr = NULL;
+}
+
+void frame_allocator_init(FrameAllocator* frame, Alloc* parent, size_t capacity) {
+	ASSERT(parent != NULL);
+	void* buffer;
+	allocate(parent, &buffer, capacity);
+	*frame = (FrameAllocator){
+		.alloc = {
+			.allocator = frame,
+			.allocate = frame_allocate,
+			.reallocate = frame_reallocate,
+			.deallocate = frame_deallocate,
+		},
+		.parent = parent,
+		.buffer = buffer,
+		.capacity = capacity,
+	};
+	arena_allocator_init(&frame->overflow, parent, capacity);
+}
+
+void frame_allocator_deinit(FrameAllocator* frame) {
+	void* buffer = frame->buffer;
+	deallocate(frame->parent, &buffer);
+	arena_allocator_deinit(&frame->overflow);
+	*frame = (FrameAllocator){0};
+}
+
+void frame_allocator_reset(FrameAllocator* frame) {
+	if (frame->overflow_size > 0) {
+		// Grow to fit the whole frame, so the next one does not spill.
+		void* buffer = frame->buffer;
+		deallocate(frame->parent, &buffer);
+		frame->capacity += frame->overflow_size;
+		allocate(frame->parent, &buffer, frame->capacity);
+		frame->buffer = buffer;
+		arena_allocator_deinit(&frame->overflow);
+		arena_allocator_init(&frame->overflow, frame->parent, frame->capacity);
+		frame->overflow_size = 0;
+	}
+	frame->used = 0;
+	frame->last = NULL;
+}
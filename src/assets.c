@@ -0,0 +1,104 @@
+#include "assets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ASSETS_PATH_CAPACITY 512
+
+// Returns the directory to read resources from, or NULL if the embedded
+// ones are used.
+static const char *assets_dir(void)
+{
+	const char *dir = getenv(ASSETS_DIR_VARIABLE);
+	if (dir && dir[0]) return dir;
+#ifdef CMINE_ENABLE_EMBEDDED_ASSETS
+	return NULL;
+#else
+	return ASSETS_DEFAULT_DIR;
+#endif
+}
+
+static int assets_path(char *path, const char *dir, const char *name)
+{
+	int length = snprintf(path, ASSETS_PATH_CAPACITY, "%s/%s", dir, name);
+	return length > 0 && length < ASSETS_PATH_CAPACITY;
+}
+
+static char *read_entire_file(const char* filename)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f) goto err0;
+	if (fseek(f, 0, SEEK_END)) goto err1;
+
+	size_t size = ftell(f);
+	if (fseek(f, 0, SEEK_SET)) goto err1;
+
+	char *buf = malloc(size + 1);
+	if (!buf) goto err1;
+	if (!fread(buf, size, 1, f)) goto err2;
+
+	buf[size] = 0;
+	fclose(f);
+	return buf;
+
+err2:
+	free(buf);
+err1:
+	fclose(f);
+err0:
+	return NULL;
+}
+
+char *assets_read_text(const char *name)
+{
+	const char *dir = assets_dir();
+	if (dir)
+	{
+		char path[ASSETS_PATH_CAPACITY];
+		if (!assets_path(path, dir, name)) return NULL;
+		return read_entire_file(path);
+	}
+#ifdef CMINE_ENABLE_EMBEDDED_ASSETS
+	for (size_t i = 0; i < embedded_file_count; i++)
+	{
+		const EmbeddedFile *file = &embedded_files[i];
+		if (strcmp(file->name, name)) continue;
+		char *text = malloc(file->size + 1);
+		if (!text) return NULL;
+		memcpy(text, file->data, file->size);
+		text[file->size] = 0;
+		return text;
+	}
+#endif
+	return NULL;
+}
+
+ImageError assets_load_image(Image *image, const char *name, Alloc *alloc)
+{
+	const char *dir = assets_dir();
+	if (dir)
+	{
+		char path[ASSETS_PATH_CAPACITY];
+		if (!assets_path(path, dir, name)) return image_error_io;
+		return image_load_bmp(image, path, alloc);
+	}
+#ifdef CMINE_ENABLE_EMBEDDED_ASSETS
+	for (size_t i = 0; i < embedded_image_count; i++)
+	{
+		const EmbeddedImage *embedded = &embedded_images[i];
+		if (strcmp(embedded->name, name)) continue;
+		Image tmp = {
+			.width = embedded->width,
+			.height = embedded->height,
+			.format = embedded->format,
+		};
+		// Copied, so the image is freed like any other.
+		size_t size = image_row_size(&tmp) * tmp.height;
+		allocate(alloc, (void**)&tmp.pixels, size);
+		memcpy(tmp.pixels, embedded->pixels, size);
+		*image = tmp;
+		return image_error_ok;
+	}
+#endif
+	return image_error_io;
+}
@@ -1,49 +1,199 @@
 #include "chunk.h"
+#include "residency.h"
+#include "aio.h"
+#include "mesh_cache.h"
+#include "mesh_pool.h"
 #include <limits.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #define ASSERT(x) assert(x)
 
-void chunk_init(Chunk* chunk)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FORCE_INLINE __forceinline
+#elif defined(__GNUC__)
+#define FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define FORCE_INLINE inline
+#endif
+
+static i32 floor_div(i32 value, i32 divisor)
 {
-	*chunk = (Chunk) {0};
+	ASSERT(divisor > 0);
+	i32 result = value / divisor;
+	return (value % divisor < 0) ? result - 1 : result;
 }
 
-void chunk_deinit(Chunk *chunk)
+void chunk_init(Chunk* chunk)
 {
-	chunk_unload(chunk);
+	*chunk = (Chunk) {0};
 }
 
-void chunk_generate_blocks(
+static FORCE_INLINE void generate_blocks_heightmap_sized(
 	Chunk *chunk,
-	const Perlin *perlin,
-	Fbm heightmap,
-	BPos world_min)
+	Terrain *terrain,
+	BPos world_min,
+	u8 lod,
+	int sidelen)
 {
-	ASSERT(chunk->generation_stage == chunk_generation_stage_awaits_blocks);
-	for (int x = 0; x < CHUNK_SIDELEN; x++)
+	const float *heights = terrain_column_heights(
+		terrain,
+		world_min.x / CHUNK_SIDELEN,
+		world_min.y / CHUNK_SIDELEN,
+		lod);
+	for (int x = 0; x < sidelen; x++)
 	{
-		for (int y = 0; y < CHUNK_SIDELEN; y++)
+		for (int y = 0; y < sidelen; y++)
 		{
-			float noise = fbm2(
-				perlin,
-				heightmap,
-				(float)(world_min.x + x + 0.31415f),
-				(float)(world_min.y + y + 0.31415f));
+			float noise = heights[y * sidelen + x];
 			ASSERT(noise > INT_MIN && noise < INT_MAX);  // Check for world boundaries.
 			int height = (int)noise;
-			for (int z = 0; z < CHUNK_SIDELEN; z++)
+			for (int z = 0; z < sidelen; z++)
 			{
-				int world_z = world_min.z + z;
-				chunk->blocks[CHUNK_BLOCK_IDX(x, y, z)] = (world_z > height) ? block_air : block_stone;
+				int world_z = world_min.z + (z << lod);
+				chunk->blocks[CHUNK_CELL_IDX(x, y, z, lod)] = (world_z > height) ? block_air : block_stone;
 			}
 		}
 	}
-	chunk->generation_stage++;
 }
-static void add_chunk_face(
-	MeshBuilder *mb,
+
+// Dispatches to a generator specialized for the side of the level of detail.
+static void generate_blocks_heightmap(
+	Chunk *chunk,
+	Terrain *terrain,
+	BPos world_min,
+	u8 lod)
+{
+	switch (lod)
+	{
+	case 0: generate_blocks_heightmap_sized(chunk, terrain, world_min, 0, CHUNK_LOD_SIDELEN(0)); break;
+	case 1: generate_blocks_heightmap_sized(chunk, terrain, world_min, 1, CHUNK_LOD_SIDELEN(1)); break;
+	case 2: generate_blocks_heightmap_sized(chunk, terrain, world_min, 2, CHUNK_LOD_SIDELEN(2)); break;
+	case 3: generate_blocks_heightmap_sized(chunk, terrain, world_min, 3, CHUNK_LOD_SIDELEN(3)); break;
+	default:
+		ASSERT(0);
+		break;
+	}
+}
+
+_Static_assert(
+	CHUNK_SIDELEN % TERRAIN_LATTICE_STEP == 0,
+	"Chunk borders must lie on the density lattice");
+
+static void generate_blocks_density(
+	Chunk *chunk,
+	Terrain *terrain,
+	BPos world_min,
+	u8 lod)
+{
+	enum { cells = CHUNK_SIDELEN / TERRAIN_LATTICE_STEP };
+	const float step = (float)TERRAIN_LATTICE_STEP;
+	int sidelen = CHUNK_LOD_SIDELEN(lod);
+	int cell_sidelen = 1 << lod;
+
+	// Chunk borders lie on the lattice, so the division is exact.
+	i32 lx = world_min.x / TERRAIN_LATTICE_STEP;
+	i32 ly = world_min.y / TERRAIN_LATTICE_STEP;
+	i32 lz = world_min.z / TERRAIN_LATTICE_STEP;
+
+	if (cell_sidelen >= TERRAIN_LATTICE_STEP)
+	{
+		// Cells are sampled at their minimum corner, which lies on the lattice.
+		int stride = cell_sidelen / TERRAIN_LATTICE_STEP;
+		for (int x = 0; x < sidelen; x++)
+		{
+			for (int y = 0; y < sidelen; y++)
+			{
+				for (int z = 0; z < sidelen; z++)
+				{
+					float density = terrain_lattice_density(
+						terrain,
+						lx + x * stride,
+						ly + y * stride,
+						lz + z * stride);
+					chunk->blocks[CHUNK_CELL_IDX(x, y, z, lod)] = (density > 0) ? block_stone : block_air;
+				}
+			}
+		}
+		return;
+	}
+
+	float lattice[cells + 1][cells + 1][cells + 1];
+	for (int x = 0; x <= cells; x++)
+	{
+		for (int y = 0; y <= cells; y++)
+		{
+			for (int z = 0; z <= cells; z++)
+			{
+				lattice[x][y][z] = terrain_lattice_density(terrain, lx + x, ly + y, lz + z);
+			}
+		}
+	}
+
+	for (int x = 0; x < sidelen; x++)
+	{
+		int bx = x << lod;
+		int cx = bx / TERRAIN_LATTICE_STEP;
+		float tx = (float)(bx % TERRAIN_LATTICE_STEP) / step;
+		for (int y = 0; y < sidelen; y++)
+		{
+			int by = y << lod;
+			int cy = by / TERRAIN_LATTICE_STEP;
+			float ty = (float)(by % TERRAIN_LATTICE_STEP) / step;
+
+			// Interpolate the vertical edge of the lattice column once,
+			// then walk along it.
+			float column[cells + 1];
+			for (int cz = 0; cz <= cells; cz++)
+			{
+				float y0 = lattice[cx][cy][cz] + tx * (lattice[cx + 1][cy][cz] - lattice[cx][cy][cz]);
+				float y1 = lattice[cx][cy + 1][cz] + tx * (lattice[cx + 1][cy + 1][cz] - lattice[cx][cy + 1][cz]);
+				column[cz] = y0 + ty * (y1 - y0);
+			}
+			for (int z = 0; z < sidelen; z++)
+			{
+				int bz = z << lod;
+				int cz = bz / TERRAIN_LATTICE_STEP;
+				float tz = (float)(bz % TERRAIN_LATTICE_STEP) / step;
+				float density = column[cz] + tz * (column[cz + 1] - column[cz]);
+				chunk->blocks[CHUNK_CELL_IDX(x, y, z, lod)] = (density > 0) ? block_stone : block_air;
+			}
+		}
+	}
+}
+
+void chunk_generate_blocks(
+	Chunk *chunk,
+	Terrain *terrain,
+	BPos world_min,
+	u8 lod)
+{
+	ASSERT(lod < CHUNK_LOD_COUNT);
+	ASSERT(world_min.x % CHUNK_SIDELEN == 0);
+	ASSERT(world_min.y % CHUNK_SIDELEN == 0);
+	ASSERT(world_min.z % CHUNK_SIDELEN == 0);
+	switch (terrain->settings.kind)
+	{
+	case terrain_kind_heightmap:
+		generate_blocks_heightmap(chunk, terrain, world_min, lod);
+		break;
+	case terrain_kind_density:
+		generate_blocks_density(chunk, terrain, world_min, lod);
+		break;
+	default:
+		ASSERT(0);
+		break;
+	}
+	chunk->lod = lod;
+}
+
+// Writes the 6 vertices of a face of a cubic cell with the minimum corner
+// at `pos` and a side of `size` blocks to `out`.
+static void write_chunk_face(
+	MeshVertex *out,
 	BPos pos,
+	int size,
 	Block block,
 	Dir face)
 {
@@ -98,129 +248,274 @@ static void add_chunk_face(
 	}
 
 	Vec3OpenGL vb = v3_to_opengl(bp2p(pos));
-	v1 = v3gl_add(v1, vb);
-	v2 = v3gl_add(v2, vb);
-	v3 = v3gl_add(v3, vb);
-	v4 = v3gl_add(v4, vb);
-
-	AtlasTexture texture = block_face_texture(block, face);
-	// TODO: get atlas coords form texture...
-	Uv uv_base = {
-		.u = 0,
-		.v = 0,
-	};
-	float u_step = 1;
-	float v_step = 1;
+	v1 = v3gl_add(v3gl_scale(v1, (f32)size), vb);
+	v2 = v3gl_add(v3gl_scale(v2, (f32)size), vb);
+	v3 = v3gl_add(v3gl_scale(v3, (f32)size), vb);
+	v4 = v3gl_add(v3gl_scale(v4, (f32)size), vb);
+
+	// Textures repeat once per block, so faces of any size tile them.
+	f32 layer = (f32)block_face_texture(block, face);
+	float u_step = (float)size;
+	float v_step = (float)size;
 
 	Uv uv1 = {u_step, v_step};
 	Uv uv2 = {u_step, 0};
 	Uv uv3 = {0, 0};
 	Uv uv4 = {0, v_step};
 
-	uv1.u += uv_base.u; uv1.v += uv_base.v;
-	uv2.u += uv_base.u; uv2.v += uv_base.v;
-	uv3.u += uv_base.u; uv3.v += uv_base.v;
-	uv4.u += uv_base.u; uv4.v += uv_base.v;
-
-	mb_append(mb, (MeshVertex){v1, uv1});
-	mb_append(mb, (MeshVertex){v2, uv2});
-	mb_append(mb, (MeshVertex){v4, uv4});
-	mb_append(mb, (MeshVertex){v2, uv2});
-	mb_append(mb, (MeshVertex){v3, uv3});
-	mb_append(mb, (MeshVertex){v4, uv4});
+	out[0] = (MeshVertex){v1, uv1, layer};
+	out[1] = (MeshVertex){v2, uv2, layer};
+	out[2] = (MeshVertex){v4, uv4, layer};
+	out[3] = (MeshVertex){v2, uv2, layer};
+	out[4] = (MeshVertex){v3, uv3, layer};
+	out[5] = (MeshVertex){v4, uv4, layer};
 }
 
-void chunk_generate_mesh(Chunk *chunk, AdjacentChunks adjacent_chunks)
+// Downsamples cells to a coarser level of detail.
+// A coarse cell is solid if at least half of the cells it covers are.
+static void downsample_cells(
+	const Block *src,
+	u8 src_lod,
+	Block *dst,
+	u8 dst_lod)
 {
-	ASSERT(chunk->generation_stage == chunk_generation_stage_awaits_mesh);
-	MeshBuilder mb;
-	mb_init(&mb);
-
-	for (int x = 0; x < CHUNK_SIDELEN; x++)
+	ASSERT(dst_lod > src_lod);
+	int sidelen = CHUNK_LOD_SIDELEN(dst_lod);
+	int factor = 1 << (dst_lod - src_lod);
+	int total = factor * factor * factor;
+	for (int x = 0; x < sidelen; x++)
 	{
-		for (int y = 0; y < CHUNK_SIDELEN; y++)
+		for (int y = 0; y < sidelen; y++)
 		{
-			for (int z = 0; z < CHUNK_SIDELEN; z++)
+			for (int z = 0; z < sidelen; z++)
 			{
-				BPos pos = {x, y, z};
-				Block block = chunk->blocks[CHUNK_BLOCK_IDX_V(pos)];
-				FaceCulling from = block_face_culling(block);
-				for (Dir face = 0; face < dir_count; face++)
+				int solid = 0;
+				Block solid_block = block_air;
+				for (int dx = 0; dx < factor; dx++)
 				{
-					BPos norm = dir_normal(face);
-					BPos adj = {
-						x + norm.x,
-						y + norm.y,
-						z + norm.z,
-					};
-					// TODO: cull with adjacent chunk...
-					if (from == face_culling_invisible) {
-						continue;
-					} else if (
-						adj.x >= 0 && adj.x < CHUNK_SIDELEN &&
-						adj.y >= 0 && adj.y < CHUNK_SIDELEN &&
-						adj.z >= 0 && adj.z < CHUNK_SIDELEN)
+					for (int dy = 0; dy < factor; dy++)
 					{
-						Block adj_block = chunk->blocks[CHUNK_BLOCK_IDX_V(adj)];
-						FaceCulling to = block_face_culling(adj_block);
-						if (should_cull_face(from, to)) continue;
+						for (int dz = 0; dz < factor; dz++)
+						{
+							Block block = src[CHUNK_CELL_IDX(
+								x * factor + dx,
+								y * factor + dy,
+								z * factor + dz,
+								src_lod)];
+							if (block_face_culling(block) == face_culling_invisible) continue;
+							solid++;
+							solid_block = block;
+						}
 					}
-					add_chunk_face(&mb, pos, block, face);
 				}
+				dst[CHUNK_CELL_IDX(x, y, z, dst_lod)] = (2 * solid >= total) ? solid_block : block_air;
 			}
 		}
 	}
+}
 
-	chunk->mesh = mb_create(&mb);
-	mb_deinit(&mb);
+static FORCE_INLINE int chunk_row_ctz(u32 row)
+{
+	ASSERT(row != 0);
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, row);
+	return (int)idx;
+#else
+	return __builtin_ctz(row);
+#endif
 }
 
-void chunk_unload(Chunk *chunk)
+static FORCE_INLINE int chunk_row_popcount(u32 row)
+{
+#if defined(_MSC_VER)
+	return (int)__popcnt(row);
+#else
+	return __builtin_popcount(row);
+#endif
+}
+
+// Emits the visible faces of `sidelen` cells of the given level of detail.
+// Cells are gathered into bitmask rows along x, so the faces of a whole row
+// are culled at once.
+// Faces are appended to `mb` if it is not NULL, written to `out` if it is
+// not NULL, and only counted otherwise. Returns the amount of vertices.
+static FORCE_INLINE GLsizei emit_chunk_faces_sized(
+	const Block *cells,
+	u8 lod,
+	int sidelen,
+	MeshBuilder *mb,
+	MeshVertex *out)
 {
-	switch (chunk->generation_stage)
+	ChunkRow visible[CHUNK_SIDELEN][CHUNK_SIDELEN];
+	ChunkRow solid[CHUNK_SIDELEN][CHUNK_SIDELEN];
+	for (int z = 0; z < sidelen; z++)
 	{
-	case chunk_generation_stage_ready:
-		mesh_deinit(&chunk->mesh);
-	case chunk_generation_stage_awaits_mesh:
-	case chunk_generation_stage_awaits_blocks:
-		break;
+		for (int y = 0; y < sidelen; y++)
+		{
+			ChunkRow v = 0;
+			ChunkRow s = 0;
+			for (int x = 0; x < sidelen; x++)
+			{
+				FaceCulling culling = block_face_culling(cells[CHUNK_CELL_IDX(x, y, z, lod)]);
+				v |= (ChunkRow)(culling != face_culling_invisible) << x;
+				s |= (ChunkRow)(culling == face_culling_solid) << x;
+			}
+			visible[z][y] = v;
+			solid[z][y] = s;
+		}
+	}
+
+	ChunkRow mask = (ChunkRow)~(ChunkRow)0 >> (CHUNK_ROW_BITS - sidelen);
+	GLsizei count = 0;
+	for (int z = 0; z < sidelen; z++)
+	{
+		for (int y = 0; y < sidelen; y++)
+		{
+			ChunkRow v = visible[z][y];
+			ChunkRow s = solid[z][y];
+			if (v == 0) continue;
+			for (Dir face = 0; face < dir_count; face++)
+			{
+				// Faces on the chunk border are never culled. They double as
+				// skirts hiding cracks between chunks of different levels of detail.
+				ChunkRow adj_v = 0;
+				ChunkRow adj_s = 0;
+				switch (face)
+				{
+				case dir_px:
+					adj_v = v >> 1;
+					adj_s = s >> 1;
+					break;
+				case dir_nx:
+					adj_v = (ChunkRow)(v << 1) & mask;
+					adj_s = (ChunkRow)(s << 1) & mask;
+					break;
+				case dir_py:
+					if (y + 1 < sidelen) adj_v = visible[z][y + 1], adj_s = solid[z][y + 1];
+					break;
+				case dir_ny:
+					if (y > 0) adj_v = visible[z][y - 1], adj_s = solid[z][y - 1];
+					break;
+				case dir_pz:
+					if (z + 1 < sidelen) adj_v = visible[z + 1][y], adj_s = solid[z + 1][y];
+					break;
+				case dir_nz:
+					if (z > 0) adj_v = visible[z - 1][y], adj_s = solid[z - 1][y];
+					break;
+				default:
+					ASSERT(0);
+				}
+				// Same as `should_cull_face`: a face is kept if its cell is
+				// visible next to an invisible one, or solid next to a non-solid one.
+				ChunkRow faces = (v & ~adj_v) | (s & ~adj_s);
+				if (mb == NULL && out == NULL)
+				{
+					count += 6 * chunk_row_popcount(faces);
+					continue;
+				}
+				while (faces != 0)
+				{
+					int x = chunk_row_ctz(faces);
+					faces &= faces - 1;
+					Block block = cells[CHUNK_CELL_IDX(x, y, z, lod)];
+					BPos pos = {x << lod, y << lod, z << lod};
+					if (mb != NULL) write_chunk_face(mb_push(mb, 6), pos, 1 << lod, block, face);
+					else write_chunk_face(out + count, pos, 1 << lod, block, face);
+					count += 6;
+				}
+			}
+		}
+	}
+	return count;
+}
+
+_Static_assert(CHUNK_LOD_COUNT == 4, "emit_chunk_faces must handle every level of detail");
+
+// Dispatches to a kernel specialized for the side of the level of detail.
+static GLsizei emit_chunk_faces(
+	const Block *cells,
+	u8 lod,
+	MeshBuilder *mb,
+	MeshVertex *out)
+{
+	switch (lod)
+	{
+	case 0: return emit_chunk_faces_sized(cells, 0, CHUNK_LOD_SIDELEN(0), mb, out);
+	case 1: return emit_chunk_faces_sized(cells, 1, CHUNK_LOD_SIDELEN(1), mb, out);
+	case 2: return emit_chunk_faces_sized(cells, 2, CHUNK_LOD_SIDELEN(2), mb, out);
+	case 3: return emit_chunk_faces_sized(cells, 3, CHUNK_LOD_SIDELEN(3), mb, out);
 	default:
 		ASSERT(0);
-		break;
+		return 0;
 	}
-	chunk->generation_stage = 0;
 }
 
-void chunks_init(Chunks* chunks, CPos min, size_t sidelen)
+// Cells of the chunk at the given level of detail, downsampled into
+// `downsampled` if they were generated at a finer level.
+static const Block *chunk_mesh_cells(const Chunk *chunk, u8 lod, Block *downsampled)
 {
-	ASSERT(sidelen != 0);
-	ASSERT(SIZE_MAX / sidelen / sidelen / sidelen >= 1);
-	size_t chunk_count = sidelen * sidelen * sidelen;
-	chunks->area = (ChunkArea){
-		.min = min,
-		.offset = {0},
-		.sidelen = sidelen,
-	};
-	chunks->items = malloc(chunk_count * sizeof(Chunk));
-	if (chunks->items == NULL) abort();
+	ASSERT(lod >= chunk->lod && lod < CHUNK_LOD_COUNT);
+	if (lod == chunk->lod) return chunk->blocks;
+	downsample_cells(chunk->blocks, chunk->lod, downsampled, lod);
+	return downsampled;
+}
 
-	for (size_t i = 0; i < chunk_count; i++)
-	{
-		chunk_init(&chunks->items[i]);
-	}
+void chunk_build_mesh(const Chunk *chunk, u8 lod, MeshBuilder *scratch)
+{
+	Block downsampled[CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN];
+	const Block *cells = chunk_mesh_cells(chunk, lod, downsampled);
+	mb_clear(scratch);
+	emit_chunk_faces(cells, lod, scratch, NULL);
 }
 
-void chunks_deinit(Chunks* chunks)
+Mesh chunk_generate_mesh(
+	const Chunk *chunk,
+	u8 lod,
+	MeshBuilder *scratch)
 {
-	size_t sidelen = chunks->area.sidelen;
-	ASSERT(SIZE_MAX / sidelen / sidelen / sidelen >= 1);
-	size_t chunk_count = sidelen * sidelen * sidelen;
-	for (size_t i = 0; i < chunk_count; i++) {
-		chunk_deinit(&chunks->items[i]);
-	}
-	free(chunks->items);
-	chunks->items = NULL;
-	chunks->area.sidelen = 0;
+#ifdef CMINE_ENABLE_MESH_TWO_PASS
+	(void)scratch;
+	Block downsampled[CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN];
+	const Block *cells = chunk_mesh_cells(chunk, lod, downsampled);
+	GLsizei count = emit_chunk_faces(cells, lod, NULL, NULL);
+	MeshWriter writer;
+	MeshVertex *vertices = mesh_writer_begin(&writer, count);
+	emit_chunk_faces(cells, lod, NULL, vertices);
+	return mesh_writer_end(&writer);
+#else
+	chunk_build_mesh(chunk, lod, scratch);
+	return mb_create(scratch);
+#endif
+}
+
+// Key of the chunk's mesh at the given level of detail in a `MeshCache`
+// or `MeshPool`. Meshes are in chunk coordinates and faces on the border are never culled,
+// so the mesh only depends on the chunk's own cells.
+static u64 chunk_mesh_key(const Chunk *chunk, u8 lod)
+{
+	size_t sidelen = CHUNK_LOD_SIDELEN(chunk->lod);
+	size_t size = sidelen * sidelen * sidelen * sizeof(Block);
+	return mesh_cache_hash(chunk->blocks, size, (u64)chunk->lod << 8 | lod);
+}
+
+// Like `chunk_generate_mesh`, but reuses meshes stored in `cache` under `key`
+// if it is not NULL.
+static Mesh chunk_generate_mesh_cached(
+	const Chunk *chunk,
+	u8 lod,
+	u64 key,
+	MeshBuilder *scratch,
+	MeshCache *cache)
+{
+	if (cache == NULL) return chunk_generate_mesh(chunk, lod, scratch);
+	Mesh mesh;
+	if (mesh_cache_find(cache, key, &mesh)) return mesh;
+	// The vertices are needed in memory to be stored, so meshes are not
+	// written straight into mapped buffers here.
+	chunk_build_mesh(chunk, lod, scratch);
+	mesh_cache_insert(cache, key, scratch->items, scratch->count);
+	return mb_create(scratch);
 }
 
 static int is_world_within_area(CPos pos, ChunkArea area)
@@ -229,20 +524,9 @@ static int is_world_within_area(CPos pos, ChunkArea area)
 		pos.x >= area.min.x &&
 		pos.y >= area.min.y &&
 		pos.z >= area.min.z &&
-		pos.x < area.min.x + area.sidelen &&
-		pos.y < area.min.y + area.sidelen &&
-		pos.z < area.min.z + area.sidelen;
-}
-
-static int is_local_within_area(CPos lpos, ChunkArea area)
-{
-	return
-		lpos.x >= 0 &&
-		lpos.y >= 0 &&
-		lpos.z >= 0 &&
-		lpos.x < area.sidelen &&
-		lpos.y < area.sidelen &&
-		lpos.z < area.sidelen;
+		pos.x < area.min.x + (int)area.sidelen &&
+		pos.y < area.min.y + (int)area.sidelen &&
+		pos.z < area.min.z + (int)area.sidelen;
 }
 
 static CPos cp2lcp(CPos world, ChunkArea area)
@@ -257,7 +541,13 @@ static CPos cp2lcp(CPos world, ChunkArea area)
 
 static CPos lcp2cp(CPos lpos, ChunkArea area)
 {
-	ASSERT(is_local_within_area(lpos, area));
+	ASSERT(
+		lpos.x >= 0 &&
+		lpos.y >= 0 &&
+		lpos.z >= 0 &&
+		lpos.x < (int)area.sidelen &&
+		lpos.y < (int)area.sidelen &&
+		lpos.z < (int)area.sidelen);
 	return (CPos) {
 		area.min.x + imodulo(lpos.x - area.offset.x, (int)area.sidelen),
 		area.min.y + imodulo(lpos.y - area.offset.y, (int)area.sidelen),
@@ -265,92 +555,676 @@ static CPos lcp2cp(CPos lpos, ChunkArea area)
 	};
 }
 
-void chunks_generate_blocks(
-	Chunks *chunks,
-	const Perlin *perlin, 
-	Fbm heightmap_fbm)
+static size_t chunks_count(const Chunks *chunks)
+{
+	size_t sidelen = chunks->area.sidelen;
+	return sidelen * sidelen * sidelen;
+}
+
+static CPos chunks_local_pos(const Chunks *chunks, size_t idx)
 {
 	size_t sidelen = chunks->area.sidelen;
-	for (size_t x = 0; x < sidelen; x++)
+	return (CPos) {
+		(int)(idx % sidelen),
+		(int)(idx / sidelen % sidelen),
+		(int)(idx / sidelen / sidelen),
+	};
+}
+
+// Recomputes the bounds and neighbor links, which change with the area.
+static void chunks_link(Chunks *chunks)
+{
+	ChunkArea area = chunks->area;
+	for (size_t i = 0; i < chunks_count(chunks); i++)
 	{
-		for (size_t y = 0; y < sidelen; y++)
+		CPos pos = lcp2cp(chunks_local_pos(chunks, i), area);
+		Vec3 min = bp2p(cp2bp(pos));
+		chunks->bounds[i] = (ChunkBounds){
+			.min = min,
+			.max = v3_add(min, (Vec3){CHUNK_SIDELEN, CHUNK_SIDELEN, CHUNK_SIDELEN}),
+		};
+		for (Dir dir = 0; dir < dir_count; dir++)
 		{
-			for (size_t z = 0; z < sidelen; z++)
+			BPos norm = dir_normal(dir);
+			CPos adj = {pos.x + norm.x, pos.y + norm.y, pos.z + norm.z};
+			if (!is_world_within_area(adj, area))
 			{
-				Chunk *chunk = &chunks->items[CHUNKS_CHUNK_IDX(x, y, z, sidelen)];
-				CPos lpos = {x, y, z};
-				BPos world_min = cp2bp(lcp2cp(lpos, chunks->area));
-				chunk_generate_blocks(chunk, perlin, heightmap_fbm, world_min);
+				chunks->neighbors[i][dir] = CHUNKS_NO_NEIGHBOR;
+				continue;
 			}
+			chunks->neighbors[i][dir] = (u32)CHUNKS_CHUNK_IDX_V(cp2lcp(adj, area), area.sidelen);
 		}
 	}
 }
 
-static Chunk* chunks_chunk(Chunks* chunks, CPos lpos)
+static Chunk *chunks_new_chunk(Chunks *chunks)
 {
-	if (!is_local_within_area(lpos, chunks->area)) return NULL;
-	return &chunks->items[CHUNKS_CHUNK_IDX_V(lpos, chunks->area.sidelen)];
+	Chunk *chunk;
+	allocate(chunks->chunk_alloc, (void**)&chunk, sizeof(Chunk));
+	chunk_init(chunk);
+	chunk->refs = 1;
+	return chunk;
 }
 
-static AdjacentChunks chunks_adjacent(Chunks* chunks, CPos lpos)
+// Drops a reference to block storage, freeing it with the last one.
+static void chunks_release_chunk(Chunks *chunks, Chunk *chunk)
 {
-	AdjacentChunks adj;
-	adj.items[dir_px] = chunks_chunk(chunks, (CPos){lpos.x + 1, lpos.y, lpos.z});
-	adj.items[dir_nx] = chunks_chunk(chunks, (CPos){lpos.x - 1, lpos.y, lpos.z});
-	adj.items[dir_py] = chunks_chunk(chunks, (CPos){lpos.x, lpos.y + 1, lpos.z});
-	adj.items[dir_ny] = chunks_chunk(chunks, (CPos){lpos.x, lpos.y - 1, lpos.z});
-	adj.items[dir_pz] = chunks_chunk(chunks, (CPos){lpos.x, lpos.y, lpos.z + 1});
-	adj.items[dir_nz] = chunks_chunk(chunks, (CPos){lpos.x, lpos.y, lpos.z - 1});
-	return adj;
+	ASSERT(chunk->refs > 0);
+	if (--chunk->refs == 0) deallocate(chunks->chunk_alloc, (void**)&chunk);
 }
 
-void chunks_generate_mesh(Chunks *chunks)
+// Gives a chunk storage of its own before its blocks are written,
+// so snapshots keep the blocks they were taken with.
+static Chunk *chunks_unique_chunk(Chunks *chunks, size_t idx)
 {
-	size_t sidelen = chunks->area.sidelen;
-	for (size_t x = 0; x < sidelen; x++)
+	Chunk *chunk = chunks->items[idx];
+	if (chunk->refs == 1) return chunk;
+	Chunk *copy = chunks_new_chunk(chunks);
+	memcpy(copy->blocks, chunk->blocks, sizeof(chunk->blocks));
+	copy->lod = chunk->lod;
+	chunks_release_chunk(chunks, chunk);
+	chunks->items[idx] = copy;
+	return copy;
+}
+
+static void chunks_mark_edited(Chunks *chunks, size_t idx)
+{
+	if (chunks->flags[idx] & chunk_flag_edited) return;
+	chunks->flags[idx] |= chunk_flag_edited;
+	chunks->edited[chunks->edited_count++] = (u32)idx;
+}
+
+static void chunks_clear_edited(Chunks *chunks, size_t idx)
+{
+	if (!(chunks->flags[idx] & chunk_flag_edited)) return;
+	chunks->flags[idx] &= ~chunk_flag_edited;
+	for (size_t i = 0; i < chunks->edited_count; i++)
 	{
-		for (size_t y = 0; y < sidelen; y++)
+		if (chunks->edited[i] != idx) continue;
+		chunks->edited[i] = chunks->edited[--chunks->edited_count];
+		break;
+	}
+}
+
+static bool chunks_has_blocks(const Chunks *chunks, size_t idx)
+{
+	return
+		chunks->stages[idx] == chunk_generation_stage_awaits_mesh ||
+		chunks->stages[idx] == chunk_generation_stage_ready;
+}
+
+static void chunks_release_mesh(Chunks *chunks, size_t idx)
+{
+	mesh_pool_release(&chunks->mesh_pool, chunks->meshes[idx]);
+	chunks->meshes[idx] = MESH_POOL_NONE;
+}
+
+static void chunks_unload_chunk(Chunks *chunks, size_t idx)
+{
+	switch (chunks->stages[idx])
+	{
+	case chunk_generation_stage_ready:
+		chunks_release_mesh(chunks, idx);
+	case chunk_generation_stage_awaits_mesh:
+	case chunk_generation_stage_awaits_edits:
+	case chunk_generation_stage_awaits_blocks:
+		break;
+	default:
+		ASSERT(0);
+		break;
+	}
+	chunks->stages[idx] = chunk_generation_stage_awaits_blocks;
+	chunks_clear_edited(chunks, idx);
+	chunks->flags[idx] = 0;
+}
+
+void chunks_init(
+	Chunks* chunks,
+	CPos min,
+	size_t sidelen,
+	Alloc* alloc,
+	Alloc* chunk_alloc)
+{
+	ASSERT(sidelen != 0);
+	ASSERT(SIZE_MAX / sidelen / sidelen / sidelen >= 1);
+	ASSERT(sidelen * sidelen * sidelen < CHUNKS_NO_NEIGHBOR);
+	size_t chunk_count = sidelen * sidelen * sidelen;
+	*chunks = (Chunks){
+		.area = {
+			.min = min,
+			.offset = {0},
+			.sidelen = sidelen,
+		},
+		.alloc = alloc,
+		.chunk_alloc = chunk_alloc,
+	};
+	allocate(alloc, (void**)&chunks->stages, chunk_count * sizeof(*chunks->stages));
+	allocate(alloc, (void**)&chunks->flags, chunk_count * sizeof(*chunks->flags));
+	allocate(alloc, (void**)&chunks->mesh_lods, chunk_count * sizeof(*chunks->mesh_lods));
+	allocate(alloc, (void**)&chunks->bounds, chunk_count * sizeof(*chunks->bounds));
+	allocate(alloc, (void**)&chunks->meshes, chunk_count * sizeof(*chunks->meshes));
+	allocate(alloc, (void**)&chunks->neighbors, chunk_count * sizeof(*chunks->neighbors));
+	allocate(alloc, (void**)&chunks->items, chunk_count * sizeof(*chunks->items));
+	allocate(alloc, (void**)&chunks->edited, chunk_count * sizeof(*chunks->edited));
+	allocate(alloc, (void**)&chunks->loads, CHUNKS_MAX_LOADS * sizeof(*chunks->loads));
+	allocate(alloc, (void**)&chunks->instance_offsets, chunk_count * sizeof(*chunks->instance_offsets));
+	mesh_pool_init(&chunks->mesh_pool, alloc);
+
+	for (size_t i = 0; i < chunk_count; i++)
+	{
+		chunks->stages[i] = chunk_generation_stage_awaits_blocks;
+		chunks->flags[i] = 0;
+		chunks->mesh_lods[i] = 0;
+		chunks->meshes[i] = MESH_POOL_NONE;
+		chunks->items[i] = chunks_new_chunk(chunks);
+	}
+	chunks_link(chunks);
+}
+
+void chunks_deinit(Chunks* chunks)
+{
+	ASSERT(chunks->load_count == 0);
+	for (size_t i = 0; i < chunks_count(chunks); i++) {
+		chunks_unload_chunk(chunks, i);
+		chunks_release_chunk(chunks, chunks->items[i]);
+		chunks->items[i] = NULL;
+	}
+	deallocate(chunks->alloc, (void**)&chunks->stages);
+	deallocate(chunks->alloc, (void**)&chunks->flags);
+	deallocate(chunks->alloc, (void**)&chunks->mesh_lods);
+	deallocate(chunks->alloc, (void**)&chunks->bounds);
+	deallocate(chunks->alloc, (void**)&chunks->meshes);
+	deallocate(chunks->alloc, (void**)&chunks->neighbors);
+	deallocate(chunks->alloc, (void**)&chunks->items);
+	deallocate(chunks->alloc, (void**)&chunks->edited);
+	deallocate(chunks->alloc, (void**)&chunks->loads);
+	deallocate(chunks->alloc, (void**)&chunks->instance_offsets);
+	mesh_pool_deinit(&chunks->mesh_pool);
+	mesh_instances_deinit(&chunks->instances);
+	chunks->area.sidelen = 0;
+}
+
+// Level of detail for a chunk `distance` chunks away from the focus,
+// which halves the resolution every time the distance doubles.
+static u8 chunk_lod_at_distance(int distance)
+{
+	u8 lod = 0;
+	while (lod + 1 < CHUNK_LOD_COUNT && distance > (2 << lod)) lod++;
+	return lod;
+}
+
+// Distance in chunks along the axis `pos` is farthest from `focus` on.
+static int chunk_distance(CPos pos, CPos focus)
+{
+	int distance = abs(pos.x - focus.x);
+	if (abs(pos.y - focus.y) > distance) distance = abs(pos.y - focus.y);
+	if (abs(pos.z - focus.z) > distance) distance = abs(pos.z - focus.z);
+	return distance;
+}
+
+// Fills `order` with the chunks awaiting blocks, nearest to `focus` first,
+// and returns their amount. Distances are counting sorted, since there
+// are only as many as the area is wide.
+static size_t chunks_order_awaiting_blocks(const Chunks *chunks, CPos focus, u32 *order, Alloc *scratch)
+{
+	size_t max_distance = chunks->area.sidelen;
+	u32 *starts;
+	allocate(scratch, (void**)&starts, (max_distance + 2) * sizeof(u32));
+	memset(starts, 0, (max_distance + 2) * sizeof(u32));
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (chunks->stages[i] != chunk_generation_stage_awaits_blocks) continue;
+		size_t distance = (size_t)chunk_distance(lcp2cp(chunks_local_pos(chunks, i), chunks->area), focus);
+		if (distance > max_distance) distance = max_distance;
+		starts[distance + 1]++;
+	}
+	for (size_t d = 1; d <= max_distance + 1; d++) starts[d] += starts[d - 1];
+	size_t count = starts[max_distance + 1];
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (chunks->stages[i] != chunk_generation_stage_awaits_blocks) continue;
+		size_t distance = (size_t)chunk_distance(lcp2cp(chunks_local_pos(chunks, i), chunks->area), focus);
+		if (distance > max_distance) distance = max_distance;
+		order[starts[distance]++] = (u32)i;
+	}
+	deallocate(scratch, (void**)&starts);
+	return count;
+}
+
+// Makes a generated chunk await a new mesh.
+static void chunks_invalidate_mesh(Chunks *chunks, size_t idx)
+{
+	if (chunks->stages[idx] != chunk_generation_stage_ready) return;
+	chunks_release_mesh(chunks, idx);
+	chunks->stages[idx] = chunk_generation_stage_awaits_mesh;
+}
+
+// Applies the edits of completed reads to chunks still awaiting them.
+static void chunks_complete_loads(Chunks *chunks, Journal *journal, Aio *aio, bool should_wait, Alloc *scratch)
+{
+	AioCompletion completions[CHUNKS_MAX_LOADS];
+	size_t count = should_wait ?
+		aio_wait(aio, completions, CHUNKS_MAX_LOADS) :
+		aio_poll(aio, completions, CHUNKS_MAX_LOADS);
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t load_idx = 0;
+		while (chunks->loads[load_idx].buffer != completions[i].buffer) load_idx++;
+		ChunkLoad load = chunks->loads[load_idx];
+		chunks->loads[load_idx] = chunks->loads[--chunks->load_count];
+
+		// The chunk may have left the area while its read was in flight.
+		bool is_awaited = is_world_within_area(load.pos, chunks->area);
+		size_t idx = 0;
+		if (is_awaited)
+		{
+			idx = CHUNKS_CHUNK_IDX_V(cp2lcp(load.pos, chunks->area), chunks->area.sidelen);
+			is_awaited = chunks->stages[idx] == chunk_generation_stage_awaits_edits;
+		}
+		if (is_awaited)
 		{
-			for (size_t z = 0; z < sidelen; z++)
+			JournalRead read = {
+				.size = load.size,
+				.checksum = load.checksum,
+			};
+			// A failed read leaves the generated blocks, like a corrupted payload.
+			if (completions[i].result == (i32)load.size)
 			{
-				CPos lpos = {x, y, z};
-				Chunk *chunk = &chunks->items[CHUNKS_CHUNK_IDX_V(lpos, sidelen)];
-				chunk_generate_mesh(chunk, chunks_adjacent(chunks, lpos));
+				journal_apply_chunk(
+					journal,
+					load.pos,
+					&read,
+					aio_buffer(aio, load.buffer),
+					chunks->items[idx],
+					scratch);
 			}
+			chunks->stages[idx] = chunk_generation_stage_awaits_mesh;
+		}
+		aio_release_buffer(aio, load.buffer);
+		journal_read_end(journal);
+	}
+}
+
+void chunks_generate_blocks(
+	Chunks *chunks,
+	Terrain *terrain,
+	Residency *residency,
+	Aio *aio,
+	CPos focus,
+	Alloc *scratch)
+{
+	Journal *journal = residency->journal;
+	chunks_complete_loads(chunks, journal, aio, false, scratch);
+
+	u32 *order;
+	allocate(scratch, (void**)&order, chunks_count(chunks) * sizeof(u32));
+	size_t count = chunks_order_awaiting_blocks(chunks, focus, order, scratch);
+	if (count > CHUNKS_MAX_GENERATIONS) count = CHUNKS_MAX_GENERATIONS;
+
+	// Reads of edits are submitted together first, so they are in flight
+	// while the rest of the chunks are generated.
+	// Chunks past `checked_count` may have edits, so they are left for a
+	// later call once too many reads are in flight.
+	size_t first_load = chunks->load_count;
+	size_t checked_count = count;
+	for (size_t k = 0; k < count; k++)
+	{
+		size_t i = order[k];
+		CPos pos = lcp2cp(chunks_local_pos(chunks, i), chunks->area);
+		Chunk *chunk = chunks_unique_chunk(chunks, i);
+		bool is_edited;
+		if (residency_take(residency, pos, chunk, &is_edited, scratch))
+		{
+			if (is_edited) chunks_mark_edited(chunks, i);
+			chunks->stages[i] = chunk_generation_stage_awaits_mesh;
+			continue;
+		}
+		if (chunks->load_count == CHUNKS_MAX_LOADS)
+		{
+			checked_count = k;
+			break;
 		}
+		JournalRead read;
+		if (!journal_read_begin(journal, pos, &read)) continue;
+		u32 buffer;
+		bool has_buffer = aio_acquire_buffer(aio, &buffer);
+		ASSERT(has_buffer);
+		(void)has_buffer;
+		aio_read(aio, read.fd, read.offset, read.size, buffer);
+		chunks->loads[chunks->load_count++] = (ChunkLoad){
+			.pos = pos,
+			.buffer = buffer,
+			.size = read.size,
+			.checksum = read.checksum,
+		};
+		chunks->stages[i] = chunk_generation_stage_awaits_edits;
+	}
+	aio_submit(aio);
+
+	// Edits are recorded against the chunk generated at the full level of detail.
+	for (size_t i = first_load; i < chunks->load_count; i++)
+	{
+		CPos pos = chunks->loads[i].pos;
+		size_t idx = CHUNKS_CHUNK_IDX_V(cp2lcp(pos, chunks->area), chunks->area.sidelen);
+		chunk_generate_blocks(chunks->items[idx], terrain, cp2bp(pos), 0);
+	}
+	for (size_t k = 0; k < checked_count; k++)
+	{
+		size_t i = order[k];
+		if (chunks->stages[i] != chunk_generation_stage_awaits_blocks) continue;
+		CPos pos = lcp2cp(chunks_local_pos(chunks, i), chunks->area);
+		u8 lod = chunk_lod_at_distance(chunk_distance(pos, focus));
+		chunk_generate_blocks(chunks_unique_chunk(chunks, i), terrain, cp2bp(pos), lod);
+		chunks->stages[i] = chunk_generation_stage_awaits_mesh;
+	}
+	deallocate(scratch, (void**)&order);
+	chunks_complete_loads(chunks, journal, aio, false, scratch);
+}
+
+void chunks_finish_loads(Chunks *chunks, Journal *journal, Aio *aio, Alloc *scratch)
+{
+	while (chunks->load_count > 0) chunks_complete_loads(chunks, journal, aio, true, scratch);
+}
+
+static void chunks_mesh_chunk(Chunks *chunks, size_t idx, u8 lod, MeshBuilder *scratch, MeshCache *cache)
+{
+	ASSERT(chunks->stages[idx] == chunk_generation_stage_awaits_mesh);
+	const Chunk *chunk = chunks->items[idx];
+	// Chunks with the same cells share a mesh, which is drawn once per chunk.
+	u64 key = chunk_mesh_key(chunk, lod);
+	u32 handle = mesh_pool_acquire(&chunks->mesh_pool, key);
+	if (handle == MESH_POOL_NONE)
+	{
+		Mesh mesh = chunk_generate_mesh_cached(chunk, lod, key, scratch, cache);
+		handle = mesh_pool_insert(&chunks->mesh_pool, key, mesh);
+	}
+	chunks->meshes[idx] = handle;
+	chunks->mesh_lods[idx] = lod;
+	chunks->flags[idx] &= ~chunk_flag_empty;
+	if (mesh_pool_mesh(&chunks->mesh_pool, handle)->count == 0) chunks->flags[idx] |= chunk_flag_empty;
+	chunks->stages[idx] = chunk_generation_stage_ready;
+}
+
+void chunks_generate_mesh(Chunks *chunks, MeshBuilder *scratch, MeshCache *cache)
+{
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (chunks->stages[i] != chunk_generation_stage_awaits_mesh) continue;
+		chunks_mesh_chunk(chunks, i, chunks->items[i]->lod, scratch, cache);
+	}
+}
+
+// Coarsest level of detail whose error stays within `CHUNK_LOD_MAX_SCREEN_ERROR`
+// pixels, given that a mesh of level `lod` may be off by `(1 << lod) - 1` blocks.
+static u8 chunk_lod_for_screen(float distance, float pixels_per_block_at_unit)
+{
+	if (distance < 1.0f) distance = 1.0f;
+	float pixels_per_block = pixels_per_block_at_unit / distance;
+	u8 lod = 0;
+	while (lod + 1 < CHUNK_LOD_COUNT &&
+		(float)((2 << lod) - 1) * pixels_per_block <= CHUNK_LOD_MAX_SCREEN_ERROR)
+	{
+		lod++;
+	}
+	return lod;
+}
+
+typedef struct ChunkLodUpdate ChunkLodUpdate;
+struct ChunkLodUpdate
+{
+	u32 idx;
+	u8 lod;
+	float distance;
+};
+
+void chunks_update_lod(
+	Chunks *chunks,
+	Terrain *terrain,
+	Vec3 eye,
+	Perspective p,
+	i32 viewport_height,
+	MeshBuilder *scratch,
+	MeshCache *cache)
+{
+	float pixels_per_block_at_unit = (float)viewport_height / (2.0f * tanf(p.fov_z_rad / 2.0f));
+	// The nearest chunks to update, sorted by distance.
+	ChunkLodUpdate updates[CHUNKS_MAX_LOD_UPDATES];
+	size_t update_count = 0;
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (chunks->stages[i] != chunk_generation_stage_ready) continue;
+
+		// Distance to the closest point of the chunk.
+		ChunkBounds bounds = chunks->bounds[i];
+		Vec3 d = {0};
+		for (int k = 0; k < 3; k++)
+		{
+			float lo = bounds.min.values[k] - eye.values[k];
+			float hi = eye.values[k] - bounds.max.values[k];
+			d.values[k] = (lo > 0) ? lo : (hi > 0) ? hi : 0;
+		}
+		float distance = v3_len(d);
+		u8 lod = chunk_lod_for_screen(distance, pixels_per_block_at_unit);
+		if (lod == chunks->mesh_lods[i]) continue;
+
+		if (update_count == CHUNKS_MAX_LOD_UPDATES && distance >= updates[update_count - 1].distance) continue;
+		size_t j = update_count < CHUNKS_MAX_LOD_UPDATES ? update_count++ : update_count - 1;
+		for (; j > 0 && updates[j - 1].distance > distance; j--) updates[j] = updates[j - 1];
+		updates[j] = (ChunkLodUpdate){
+			.idx = (u32)i,
+			.lod = lod,
+			.distance = distance,
+		};
+	}
+
+	for (size_t i = 0; i < update_count; i++)
+	{
+		u32 idx = updates[i].idx;
+		u8 lod = updates[i].lod;
+		if (lod < chunks->items[idx]->lod)
+		{
+			Chunk *chunk = chunks_unique_chunk(chunks, idx);
+			BPos world_min = cp2bp(lcp2cp(chunks_local_pos(chunks, idx), chunks->area));
+			chunk_generate_blocks(chunk, terrain, world_min, lod);
+		}
+		chunks_release_mesh(chunks, idx);
+		chunks->stages[idx] = chunk_generation_stage_awaits_mesh;
+		chunks_mesh_chunk(chunks, idx, lod, scratch, cache);
 	}
 }
 
 void chunks_unload(Chunks *chunks)
 {
-	size_t sidelen = chunks->area.sidelen;
-	for (size_t x = 0; x < sidelen; x++)
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		chunks_unload_chunk(chunks, i);
+	}
+}
+
+static void chunks_save_chunk(Chunks *chunks, size_t idx, Journal *journal, Terrain *terrain)
+{
+	if (!(chunks->flags[idx] & chunk_flag_edited)) return;
+	CPos pos = lcp2cp(chunks_local_pos(chunks, idx), chunks->area);
+	// On failure the chunk stays edited, so saving is retried later.
+	if (!journal_save_chunk(journal, terrain, pos, chunks->items[idx])) return;
+	chunks_clear_edited(chunks, idx);
+}
+
+void chunks_save(Chunks *chunks, Journal *journal, Terrain *terrain)
+{
+	// Saved chunks are swapped with the last ones, which were visited already.
+	for (size_t i = chunks->edited_count; i-- > 0;)
+	{
+		chunks_save_chunk(chunks, chunks->edited[i], journal, terrain);
+	}
+}
+
+void chunk_snapshot_init(ChunkSnapshot *snapshot, Alloc *alloc)
+{
+	*snapshot = (ChunkSnapshot){
+		.alloc = alloc,
+	};
+}
+
+void chunk_snapshot_deinit(ChunkSnapshot *snapshot)
+{
+	ASSERT(snapshot->count == 0);
+	if (snapshot->capacity > 0)
+	{
+		deallocate(snapshot->alloc, (void**)&snapshot->positions);
+		deallocate(snapshot->alloc, (void**)&snapshot->items);
+		deallocate(snapshot->alloc, (void**)&snapshot->is_saved);
+	}
+	*snapshot = (ChunkSnapshot){0};
+}
+
+void chunks_snapshot(Chunks *chunks, ChunkSnapshot *snapshot)
+{
+	ASSERT(snapshot->count == 0);
+	size_t count = chunks->edited_count;
+	if (snapshot->capacity < count)
+	{
+		snapshot->capacity = count;
+		reallocate(snapshot->alloc, (void**)&snapshot->positions, count * sizeof(*snapshot->positions));
+		reallocate(snapshot->alloc, (void**)&snapshot->items, count * sizeof(*snapshot->items));
+		reallocate(snapshot->alloc, (void**)&snapshot->is_saved, count * sizeof(*snapshot->is_saved));
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		u32 idx = chunks->edited[i];
+		Chunk *chunk = chunks->items[idx];
+		chunk->refs++;
+		snapshot->positions[i] = lcp2cp(chunks_local_pos(chunks, idx), chunks->area);
+		snapshot->items[i] = chunk;
+		snapshot->is_saved[i] = false;
+		chunks->flags[idx] &= ~chunk_flag_edited;
+	}
+	snapshot->count = count;
+	chunks->edited_count = 0;
+}
+
+void chunks_release_snapshot(Chunks *chunks, ChunkSnapshot *snapshot)
+{
+	for (size_t i = 0; i < snapshot->count; i++)
 	{
-		for (size_t y = 0; y < sidelen; y++)
+		CPos pos = snapshot->positions[i];
+		if (!snapshot->is_saved[i] && is_world_within_area(pos, chunks->area))
 		{
-			for (size_t z = 0; z < sidelen; z++)
-			{
-				Chunk *chunk = &chunks->items[CHUNKS_CHUNK_IDX(x, y, z, sidelen)];
-				chunk_unload(chunk);
-			}
+			size_t idx = CHUNKS_CHUNK_IDX_V(cp2lcp(pos, chunks->area), chunks->area.sidelen);
+			if (chunks_has_blocks(chunks, idx)) chunks_mark_edited(chunks, idx);
+		}
+		chunks_release_chunk(chunks, (Chunk*)snapshot->items[i]);
+	}
+	snapshot->count = 0;
+}
+
+bool chunks_set_block(Chunks *chunks, Terrain *terrain, BPos pos, Block block)
+{
+	CPos chunk_pos = {
+		floor_div(pos.x, CHUNK_SIDELEN),
+		floor_div(pos.y, CHUNK_SIDELEN),
+		floor_div(pos.z, CHUNK_SIDELEN),
+	};
+	if (!is_world_within_area(chunk_pos, chunks->area)) return false;
+	size_t idx = CHUNKS_CHUNK_IDX_V(cp2lcp(chunk_pos, chunks->area), chunks->area.sidelen);
+	if (!chunks_has_blocks(chunks, idx)) return false;
+
+	Chunk *chunk = chunks_unique_chunk(chunks, idx);
+	if (chunk->lod != 0) chunk_generate_blocks(chunk, terrain, cp2bp(chunk_pos), 0);
+	BPos local = {
+		pos.x - chunk_pos.x * CHUNK_SIDELEN,
+		pos.y - chunk_pos.y * CHUNK_SIDELEN,
+		pos.z - chunk_pos.z * CHUNK_SIDELEN,
+	};
+	chunk->blocks[CHUNK_BLOCK_IDX_V(local)] = block;
+	chunks_mark_edited(chunks, idx);
+	// Meshes never cull against their neighbors, so only this one changes.
+	chunks_invalidate_mesh(chunks, idx);
+	return true;
+}
+
+void chunks_move(Chunks *chunks, CPos min, Residency *residency, Alloc *scratch)
+{
+	ChunkArea old = chunks->area;
+	ChunkArea area = {
+		.min = min,
+		.offset = {
+			imodulo(old.offset.x + min.x - old.min.x, (int)old.sidelen),
+			imodulo(old.offset.y + min.y - old.min.y, (int)old.sidelen),
+			imodulo(old.offset.z + min.z - old.min.z, (int)old.sidelen),
+		},
+		.sidelen = old.sidelen,
+	};
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (is_world_within_area(lcp2cp(chunks_local_pos(chunks, i), old), area)) continue;
+		// The chunk left the area, its slot is taken by one that entered it.
+		// One awaiting edits is dropped, they are still in the journal.
+		if (chunks_has_blocks(chunks, i))
+		{
+			CPos pos = lcp2cp(chunks_local_pos(chunks, i), old);
+			// Storage shared with a snapshot may yet fail to be saved, and the
+			// snapshot no longer flags chunks outside of the area as edited.
+			bool is_edited =
+				(chunks->flags[i] & chunk_flag_edited) != 0 ||
+				chunks->items[i]->refs > 1;
+			residency_store(residency, pos, chunks->items[i], is_edited, scratch);
 		}
+		chunks_unload_chunk(chunks, i);
+		chunks_release_chunk(chunks, chunks->items[i]);
+		chunks->items[i] = chunks_new_chunk(chunks);
 	}
+	chunks->area = area;
+	chunks_link(chunks);
+}
+
+static bool chunks_is_drawn(const Chunks *chunks, size_t idx)
+{
+	return
+		chunks->stages[idx] == chunk_generation_stage_ready &&
+		!(chunks->flags[idx] & chunk_flag_empty);
 }
 
+// Chunks sharing a mesh are drawn together as instances of it. Their
+// offsets are grouped by mesh with a counting sort over the pool entries,
+// whose instance ranges are left unassigned again once drawn.
 void chunks_draw(Chunks* chunks, Camera cam, Perspective p) {
-	size_t sidelen = chunks->area.sidelen;
-	for (size_t x = 0; x < sidelen; x++)
+	MeshPool *pool = &chunks->mesh_pool;
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (chunks_is_drawn(chunks, i)) pool->entries[chunks->meshes[i]].instance_count++;
+	}
+	u32 instance_count = 0;
+	for (size_t i = 0; i < chunks_count(chunks); i++)
 	{
-		for (size_t y = 0; y < sidelen; y++)
+		if (!chunks_is_drawn(chunks, i)) continue;
+		MeshPoolEntry *entry = &pool->entries[chunks->meshes[i]];
+		if (entry->first_instance == MESH_POOL_NONE)
 		{
-			for (size_t z = 0; z < sidelen; z++)
-			{
-				CPos lpos = {x, y, z};
-				Chunk* chunk = &chunks->items[CHUNKS_CHUNK_IDX_V(lpos, sidelen)];
-				Camera c = cam;
-				c.pos = v3_add(cam.pos, bp2p(cp2bp(lcp2cp(lpos, chunks->area))));
-				mesh_draw(&chunk->mesh, render_tmp_texture(), c, p);
-			}
+			entry->first_instance = instance_count;
+			instance_count += entry->instance_count;
+			entry->instance_count = 0;
 		}
+		u32 instance = entry->first_instance + entry->instance_count++;
+		chunks->instance_offsets[instance] = v3_to_opengl(chunks->bounds[i].min);
+	}
+	if (instance_count == 0) return;
+	mesh_instances_upload(&chunks->instances, chunks->instance_offsets, (GLsizei)instance_count);
+
+	Mat4x4 transform = camera_transform(cam, p);
+	for (size_t i = 0; i < chunks_count(chunks); i++)
+	{
+		if (!chunks_is_drawn(chunks, i)) continue;
+		MeshPoolEntry *entry = &pool->entries[chunks->meshes[i]];
+		if (entry->first_instance == MESH_POOL_NONE) continue;
+		mesh_draw_instances(
+			&entry->mesh,
+			render_block_textures(),
+			transform,
+			&chunks->instances,
+			(GLsizei)entry->first_instance,
+			(GLsizei)entry->instance_count);
+		entry->first_instance = MESH_POOL_NONE;
+		entry->instance_count = 0;
 	}
 }
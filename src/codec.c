@@ -0,0 +1,304 @@
+#include "codec.h"
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CODEC_USE_SSE2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define RLE_MAX_RUN 256
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xffff
+#define LZ_HASH_BITS 12
+
+typedef enum CodecMode CodecMode;
+enum CodecMode
+{
+	codec_mode_rle,
+	codec_mode_lz,
+};
+
+#ifdef CODEC_USE_SSE2
+static int ctz32(u32 value)
+{
+	ASSERT(value != 0);
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, value);
+	return (int)idx;
+#else
+	return __builtin_ctz(value);
+#endif
+}
+#endif
+
+size_t codec_run_length(const u8 *data, size_t max)
+{
+	if (max == 0) return 0;
+	u8 value = data[0];
+	size_t length = 1;
+#ifdef CODEC_USE_SSE2
+	// Compares 16 bytes at a time, the first mismatch ends the run.
+	__m128i broadcast = _mm_set1_epi8((char)value);
+	while (length + 16 <= max)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(data + length));
+		u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, broadcast));
+		if (mask != 0xffff) return length + (size_t)ctz32(~mask);
+		length += 16;
+	}
+#endif
+	while (length < max && data[length] == value) length++;
+	return length;
+}
+
+size_t codec_rle_encode(const u8 *in, size_t size, u8 *out)
+{
+	size_t out_size = 0;
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t max = size - i < RLE_MAX_RUN ? size - i : RLE_MAX_RUN;
+		size_t run = codec_run_length(in + i, max);
+		out[out_size++] = (u8)(run - 1);
+		out[out_size++] = in[i];
+		i += run;
+	}
+	return out_size;
+}
+
+bool codec_rle_decode(const u8 *in, size_t in_size, u8 *out, size_t size)
+{
+	if (in_size % 2 != 0) return false;
+	size_t out_size = 0;
+	for (size_t i = 0; i < in_size; i += 2)
+	{
+		size_t run = (size_t)in[i] + 1;
+		if (size - out_size < run) return false;
+		memset(out + out_size, in[i + 1], run);
+		out_size += run;
+	}
+	return out_size == size;
+}
+
+static u32 lz_hash(const u8 *data)
+{
+	u32 value;
+	memcpy(&value, data, sizeof(value));
+	return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Lengths that do not fit into their nibble continue in bytes of 255.
+static u8 *lz_write_length(u8 *out, size_t length)
+{
+	while (length >= 255)
+	{
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = (u8)length;
+	return out;
+}
+
+static bool lz_read_length(const u8 **in, const u8 *end, size_t *length)
+{
+	u8 byte;
+	do
+	{
+		if (*in == end) return false;
+		byte = *(*in)++;
+		*length += byte;
+	}
+	while (byte == 255);
+	return true;
+}
+
+// Writes a token, the literals and, unless `match_length` is zero, the match.
+static u8 *lz_write_sequence(
+	u8 *out,
+	const u8 *literals,
+	size_t literal_count,
+	size_t offset,
+	size_t match_length)
+{
+	size_t match_code = match_length > 0 ? match_length - LZ_MIN_MATCH : 0;
+	u8 *token = out++;
+	*token = (u8)((literal_count < 15 ? literal_count : 15) << 4);
+	if (literal_count >= 15) out = lz_write_length(out, literal_count - 15);
+	memcpy(out, literals, literal_count);
+	out += literal_count;
+	if (match_length == 0) return out;
+
+	*token |= (u8)(match_code < 15 ? match_code : 15);
+	*out++ = (u8)(offset & 0xff);
+	*out++ = (u8)(offset >> 8);
+	if (match_code >= 15) out = lz_write_length(out, match_code - 15);
+	return out;
+}
+
+size_t codec_lz_encode(const u8 *in, size_t size, u8 *out)
+{
+	// Positions plus one of the last occurrence of every hashed prefix.
+	u32 table[1 << LZ_HASH_BITS] = {0};
+	u8 *o = out;
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + LZ_MIN_MATCH <= size)
+	{
+		u32 hash = lz_hash(in + i);
+		size_t candidate = table[hash];
+		table[hash] = (u32)(i + 1);
+		if (candidate == 0 ||
+			i + 1 - candidate > LZ_MAX_OFFSET ||
+			memcmp(in + candidate - 1, in + i, LZ_MIN_MATCH) != 0)
+		{
+			i++;
+			continue;
+		}
+		size_t match = candidate - 1;
+		size_t length = LZ_MIN_MATCH;
+		while (i + length < size && in[match + length] == in[i + length]) length++;
+		o = lz_write_sequence(o, in + anchor, i - anchor, i - match, length);
+		i += length;
+		anchor = i;
+	}
+	o = lz_write_sequence(o, in + anchor, size - anchor, 0, 0);
+	ASSERT((size_t)(o - out) <= CODEC_LZ_BOUND(size));
+	return (size_t)(o - out);
+}
+
+bool codec_lz_decode(const u8 *in, size_t in_size, u8 *out, size_t size)
+{
+	const u8 *end = in + in_size;
+	size_t out_size = 0;
+	while (in < end)
+	{
+		u8 token = *in++;
+		size_t literal_count = token >> 4;
+		if (literal_count == 15 && !lz_read_length(&in, end, &literal_count)) return false;
+		if ((size_t)(end - in) < literal_count || size - out_size < literal_count) return false;
+		memcpy(out + out_size, in, literal_count);
+		in += literal_count;
+		out_size += literal_count;
+		// Only the last sequence has no match.
+		if (in == end) break;
+
+		if (end - in < 2) return false;
+		size_t offset = (size_t)in[0] | (size_t)in[1] << 8;
+		in += 2;
+		size_t length = token & 15;
+		if (length == 15 && !lz_read_length(&in, end, &length)) return false;
+		length += LZ_MIN_MATCH;
+		if (offset == 0 || offset > out_size || size - out_size < length) return false;
+		// Matches may overlap their own output, so bytes are copied one by one.
+		for (size_t k = 0; k < length; k++) out[out_size + k] = out[out_size - offset + k];
+		out_size += length;
+	}
+	return out_size == size;
+}
+
+size_t codec_encode_blocks(const Block *blocks, size_t count, u8 *out, Alloc *scratch)
+{
+	ASSERT(count > 0);
+	u8 *indices;
+	allocate(scratch, (void**)&indices, count);
+
+	// Palette entries are ordered by their first occurrence.
+	u16 palette_idx[256] = {0};
+	u8 *palette = out + 1;
+	size_t palette_count = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		Block block = blocks[i];
+		if (palette_idx[block] == 0)
+		{
+			palette[palette_count++] = block;
+			palette_idx[block] = (u16)palette_count;
+		}
+		indices[i] = (u8)(palette_idx[block] - 1);
+	}
+	out[0] = (u8)(palette_count - 1);
+	size_t size = 1 + palette_count;
+	if (palette_count == 1)
+	{
+		deallocate(scratch, (void**)&indices);
+		return size;
+	}
+
+	u8 *rle;
+	allocate(scratch, (void**)&rle, CODEC_RLE_BOUND(count));
+	size_t rle_size = codec_rle_encode(indices, count, rle);
+	size_t lz_size = codec_lz_encode(rle, rle_size, out + size + 5);
+	if (lz_size + 4 < rle_size)
+	{
+		out[size] = codec_mode_lz;
+		for (int k = 0; k < 4; k++) out[size + 1 + k] = (u8)(rle_size >> (8 * k));
+		size += 5 + lz_size;
+	}
+	else
+	{
+		out[size] = codec_mode_rle;
+		memcpy(out + size + 1, rle, rle_size);
+		size += 1 + rle_size;
+	}
+	deallocate(scratch, (void**)&rle);
+	deallocate(scratch, (void**)&indices);
+	ASSERT(size <= CODEC_BOUND(count));
+	return size;
+}
+
+bool codec_decode_blocks(const u8 *in, size_t size, Block *blocks, size_t count, Alloc *scratch)
+{
+	ASSERT(count > 0);
+	if (size < 2) return false;
+	size_t palette_count = (size_t)in[0] + 1;
+	const u8 *palette = in + 1;
+	if (size < 1 + palette_count) return false;
+	if (palette_count == 1)
+	{
+		memset(blocks, palette[0], count);
+		return size == 2;
+	}
+	in += 1 + palette_count;
+	size -= 1 + palette_count;
+	if (size < 1) return false;
+
+	// Indices are decoded in place of the blocks they are mapped to.
+	bool ok = false;
+	switch (in[0])
+	{
+	case codec_mode_rle:
+		ok = codec_rle_decode(in + 1, size - 1, blocks, count);
+		break;
+	case codec_mode_lz:
+	{
+		if (size < 5) return false;
+		size_t rle_size = 0;
+		for (int k = 0; k < 4; k++) rle_size |= (size_t)in[1 + k] << (8 * k);
+		if (rle_size > CODEC_RLE_BOUND(count)) return false;
+		u8 *rle;
+		allocate(scratch, (void**)&rle, rle_size > 0 ? rle_size : 1);
+		ok =
+			codec_lz_decode(in + 5, size - 5, rle, rle_size) &&
+			codec_rle_decode(rle, rle_size, blocks, count);
+		deallocate(scratch, (void**)&rle);
+		break;
+	}
+	default:
+		return false;
+	}
+	if (!ok) return false;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (blocks[i] >= palette_count) return false;
+		blocks[i] = palette[blocks[i]];
+	}
+	return true;
+}
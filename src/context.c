@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <time.h>
 
 typedef struct Context Context;
 struct Context {
@@ -181,3 +182,11 @@ f64 conetxt_mouse_y(void) {
 f64 context_time(void) {
 	return (f64)glfwGetTime();
 }
+f64 context_clock(void) {
+	struct timespec ts;
+#ifdef TIME_MONOTONIC
+	if (timespec_get(&ts, TIME_MONOTONIC)) return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+#endif
+	if (!timespec_get(&ts, TIME_UTC)) return 0.0;
+	return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,270 @@
+#include "horizon.h"
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+_Static_assert(
+	HORIZON_TILE_SIDELEN % CHUNK_SIDELEN == 0,
+	"Horizon tiles must consist of whole chunk columns");
+_Static_assert(
+	HORIZON_TILE_SIDELEN % HORIZON_MIN_STEP == 0,
+	"Horizon tiles must consist of whole quads");
+
+#define HORIZON_MAX_QUADS (HORIZON_TILE_SIDELEN / HORIZON_MIN_STEP)
+
+static i32 floor_div(i32 value, i32 divisor)
+{
+	ASSERT(divisor > 0);
+	i32 result = value / divisor;
+	return (value % divisor < 0) ? result - 1 : result;
+}
+
+static int tile_step(int ring)
+{
+	int step = HORIZON_MIN_STEP;
+	for (int r = ring; r > 1 && step < HORIZON_TILE_SIDELEN; r >>= 1) step *= 2;
+	return step;
+}
+
+// Coarsest cached column heightmap that still has a sample every `step` blocks.
+static u8 column_lod(int step)
+{
+	u8 lod = 0;
+	while ((2 << lod) <= step && CHUNK_LOD_SIDELEN(lod + 1) > 0) lod++;
+	return lod;
+}
+
+// Height of the top of the surface at a block on the grid of `1 << lod` blocks.
+static float surface_height(Terrain *terrain, i32 x, i32 y, u8 lod)
+{
+	i32 cx = floor_div(x, CHUNK_SIDELEN);
+	i32 cy = floor_div(y, CHUNK_SIDELEN);
+	const float *heights = terrain_column_heights(terrain, cx, cy, lod);
+	int lx = (x - cx * CHUNK_SIDELEN) >> lod;
+	int ly = (y - cy * CHUNK_SIDELEN) >> lod;
+	return (float)((int)heights[ly * CHUNK_LOD_SIDELEN(lod) + lx] + 1);
+}
+
+// Returns whether the loaded chunks already show the surface of a quad,
+// that is whether they cover its columns and the heights of its corners.
+// Quads above or below the loaded chunks are kept, and overlap with
+// chunk geometry is left to the depth test.
+static bool is_within_hole(
+	ChunkArea hole,
+	i32 min_x,
+	i32 min_y,
+	i32 max_x,
+	i32 max_y,
+	float min_height,
+	float max_height)
+{
+	i32 sidelen = (i32)hole.sidelen * CHUNK_SIDELEN;
+	i32 hole_x = hole.min.x * CHUNK_SIDELEN;
+	i32 hole_y = hole.min.y * CHUNK_SIDELEN;
+	i32 hole_z = hole.min.z * CHUNK_SIDELEN;
+	// Heights are the tops of the surface blocks, which are loaded if
+	// they are within the hole.
+	return
+		min_x >= hole_x && max_x <= hole_x + sidelen &&
+		min_y >= hole_y && max_y <= hole_y + sidelen &&
+		min_height > (float)hole_z && max_height <= (float)(hole_z + sidelen);
+}
+
+static bool intersects_hole(ChunkArea hole, i32 min_x, i32 min_y, i32 max_x, i32 max_y)
+{
+	i32 sidelen = (i32)hole.sidelen * CHUNK_SIDELEN;
+	i32 hole_x = hole.min.x * CHUNK_SIDELEN;
+	i32 hole_y = hole.min.y * CHUNK_SIDELEN;
+	return
+		min_x < hole_x + sidelen && max_x > hole_x &&
+		min_y < hole_y + sidelen && max_y > hole_y;
+}
+
+static void tile_unload(HorizonTile *tile)
+{
+	if (tile->is_loaded) mesh_deinit(&tile->mesh);
+	tile->is_loaded = false;
+}
+
+static void tile_build(
+	HorizonTile *tile,
+	Terrain *terrain,
+	ChunkArea hole,
+	i32 x,
+	i32 y,
+	int step,
+	MeshBuilder *scratch)
+{
+	tile_unload(tile);
+	int quads = HORIZON_TILE_SIDELEN / step;
+	u8 lod = column_lod(step);
+	i32 min_x = x * HORIZON_TILE_SIDELEN;
+	i32 min_y = y * HORIZON_TILE_SIDELEN;
+
+	float heights[(HORIZON_MAX_QUADS + 1) * (HORIZON_MAX_QUADS + 1)];
+	for (int j = 0; j <= quads; j++)
+	{
+		for (int i = 0; i <= quads; i++)
+		{
+			heights[j * (quads + 1) + i] = surface_height(
+				terrain,
+				min_x + i * step,
+				min_y + j * step,
+				lod);
+		}
+	}
+
+	MeshBuilder *mb = scratch;
+	mb_clear(mb);
+	for (int j = 0; j < quads; j++)
+	{
+		for (int i = 0; i < quads; i++)
+		{
+			i32 x0 = i * step;
+			i32 y0 = j * step;
+			i32 x1 = x0 + step;
+			i32 y1 = y0 + step;
+			Vec3 a = {(f32)x0, (f32)y0, heights[j * (quads + 1) + i]};
+			Vec3 b = {(f32)x1, (f32)y0, heights[j * (quads + 1) + i + 1]};
+			Vec3 c = {(f32)x1, (f32)y1, heights[(j + 1) * (quads + 1) + i + 1]};
+			Vec3 d = {(f32)x0, (f32)y1, heights[(j + 1) * (quads + 1) + i]};
+			float min_height = fminf(fminf(a.z, b.z), fminf(c.z, d.z));
+			float max_height = fmaxf(fmaxf(a.z, b.z), fmaxf(c.z, d.z));
+			if (is_within_hole(
+				hole,
+				min_x + x0,
+				min_y + y0,
+				min_x + x1,
+				min_y + y1,
+				min_height,
+				max_height))
+			{
+				continue;
+			}
+
+			// Textures repeat once per block, and match the stone of the chunks.
+			f32 layer = (f32)atlas_stone;
+			MeshVertex va = {v3_to_opengl(a), {a.y, a.x}, layer};
+			MeshVertex vb = {v3_to_opengl(b), {b.y, b.x}, layer};
+			MeshVertex vc = {v3_to_opengl(c), {c.y, c.x}, layer};
+			MeshVertex vd = {v3_to_opengl(d), {d.y, d.x}, layer};
+			mb_append(mb, va);
+			mb_append(mb, vd);
+			mb_append(mb, vb);
+			mb_append(mb, vb);
+			mb_append(mb, vd);
+			mb_append(mb, vc);
+		}
+	}
+
+	*tile = (HorizonTile){
+		.x = x,
+		.y = y,
+		.step = step,
+		.is_loaded = true,
+		.mesh = mb_create(mb),
+	};
+}
+
+void horizon_init(Horizon *horizon)
+{
+	*horizon = (Horizon){0};
+}
+
+void horizon_deinit(Horizon *horizon)
+{
+	horizon_unload(horizon);
+}
+
+void horizon_unload(Horizon *horizon)
+{
+	for (size_t i = 0; i < HORIZON_SIDELEN * HORIZON_SIDELEN; i++)
+	{
+		tile_unload(&horizon->tiles[i]);
+	}
+}
+
+void horizon_update(
+	Horizon *horizon,
+	Terrain *terrain,
+	ChunkArea loaded,
+	Vec3 eye,
+	MeshBuilder *scratch)
+{
+	ChunkArea old = horizon->hole;
+	if (old.sidelen != loaded.sidelen ||
+		old.min.x != loaded.min.x ||
+		old.min.y != loaded.min.y ||
+		old.min.z != loaded.min.z)
+	{
+		for (size_t i = 0; i < HORIZON_SIDELEN * HORIZON_SIDELEN; i++)
+		{
+			HorizonTile *tile = &horizon->tiles[i];
+			i32 min_x = tile->x * HORIZON_TILE_SIDELEN;
+			i32 min_y = tile->y * HORIZON_TILE_SIDELEN;
+			i32 max_x = min_x + HORIZON_TILE_SIDELEN;
+			i32 max_y = min_y + HORIZON_TILE_SIDELEN;
+			if (intersects_hole(old, min_x, min_y, max_x, max_y) ||
+				intersects_hole(loaded, min_x, min_y, max_x, max_y))
+			{
+				tile_unload(tile);
+			}
+		}
+		horizon->hole = loaded;
+	}
+
+	i32 center_x = floor_div((i32)floorf(eye.x), HORIZON_TILE_SIDELEN);
+	i32 center_y = floor_div((i32)floorf(eye.y), HORIZON_TILE_SIDELEN);
+	i32 window_x = center_x - HORIZON_SIDELEN / 2;
+	i32 window_y = center_y - HORIZON_SIDELEN / 2;
+
+	// Closest stale tiles are built first.
+	for (int n = 0; n < HORIZON_TILE_BUILDS_PER_UPDATE; n++)
+	{
+		HorizonTile *stale = NULL;
+		i32 stale_x = 0;
+		i32 stale_y = 0;
+		int stale_ring = INT32_MAX;
+		int stale_step = 0;
+		for (i32 sy = 0; sy < HORIZON_SIDELEN; sy++)
+		{
+			for (i32 sx = 0; sx < HORIZON_SIDELEN; sx++)
+			{
+				i32 x = window_x + imodulo(sx - window_x, HORIZON_SIDELEN);
+				i32 y = window_y + imodulo(sy - window_y, HORIZON_SIDELEN);
+				int ring = abs(x - center_x);
+				if (abs(y - center_y) > ring) ring = abs(y - center_y);
+				int step = tile_step(ring);
+
+				HorizonTile *tile = &horizon->tiles[sy * HORIZON_SIDELEN + sx];
+				if (tile->is_loaded && tile->x == x && tile->y == y && tile->step == step) continue;
+				if (ring >= stale_ring) continue;
+				stale = tile;
+				stale_x = x;
+				stale_y = y;
+				stale_ring = ring;
+				stale_step = step;
+			}
+		}
+		if (stale == NULL) break;
+		tile_build(stale, terrain, horizon->hole, stale_x, stale_y, stale_step, scratch);
+	}
+}
+
+void horizon_draw(const Horizon *horizon, Camera cam, Perspective p)
+{
+	for (size_t i = 0; i < HORIZON_SIDELEN * HORIZON_SIDELEN; i++)
+	{
+		const HorizonTile *tile = &horizon->tiles[i];
+		if (!tile->is_loaded || tile->mesh.count == 0) continue;
+		Camera c = cam;
+		Vec3 min = {
+			(f32)(tile->x * HORIZON_TILE_SIDELEN),
+			(f32)(tile->y * HORIZON_TILE_SIDELEN),
+			0,
+		};
+		c.pos = v3_add(cam.pos, min);
+		mesh_draw(&tile->mesh, render_block_textures(), c, p);
+	}
+}
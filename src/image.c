@@ -1,6 +1,7 @@
 #include "image.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #define ASSERT(x) assert(x)
@@ -37,50 +38,59 @@ struct BmpInfo
 	} image_header;
 };
 
+// Reads the whole pixel array at once. Its rows are already in the layout
+// of `Image`, unless they are stored from top to bottom or mirrored.
 static ImageError bmp_load_pixels_uncompressed_u24_or_u32(
 	FILE *file,
 	uint32_t pixel_data_offset,
 	Image *image,
-	size_t pixel_size,
 	int flip_x,
 	int flip_y)
 {
 	ASSERT(file);
 	ASSERT(image);
-	ASSERT(pixel_size == 3 || pixel_size == 4);
 	if (image->width == 0 || 
 		image->height == 0 ||
 		pixel_data_offset > (uint32_t)INT32_MAX) return image_error_invalid;
 	if (fseek(file, (long)pixel_data_offset, SEEK_SET)) return image_error_io;
-	
 
-	// Line size must be a multiple of 4.
-	long line_padding_size = (long)((4 - ((image->width * pixel_size) % 4)) % 4);
+	size_t row_size = image_row_size(image);
+	uint8_t *rows = image->pixels;
+	if (!fread(rows, row_size * image->height, 1, file)) return image_error_io;
 
-	size_t y = flip_y ? image->height - 1 : 0;
-	while (1)
-	{	
-		size_t x = flip_x ? image->width - 1 : 0;
-		while(1)
+	if (flip_y)
+	{
+		// Swaps the rows in place, a pixel at a time, so no row is buffered.
+		for (size_t y = 0; y < image->height / 2; y++)
 		{
-			union {
-				uint32_t u32;
-				Color32 color;
-			} tmp;
-			tmp.u32 = 0xFFFFFFFF;
-			if (!fread(&tmp.color, pixel_size, 1, file)) return image_error_io;
-			image->pixels[y * image->width + x] = (Color32) {
-				.red = tmp.color.blue,
-				.green = tmp.color.green,
-				.blue = tmp.color.red,
-				.alpha = tmp.color.alpha,
-			};
-			if (x == (flip_x ? 0 : image->width - 1)) break;
-			flip_x ? x-- : x++;
+			uint8_t *a = rows + y * row_size;
+			uint8_t *b = rows + (image->height - 1 - y) * row_size;
+			for (size_t i = 0; i < row_size; i++)
+			{
+				uint8_t tmp = a[i];
+				a[i] = b[i];
+				b[i] = tmp;
+			}
+		}
+	}
+	if (flip_x)
+	{
+		size_t pixel_size = image_pixel_size(image->format);
+		for (size_t y = 0; y < image->height; y++)
+		{
+			uint8_t *row = rows + y * row_size;
+			for (size_t x = 0; x < image->width / 2; x++)
+			{
+				uint8_t *a = row + x * pixel_size;
+				uint8_t *b = row + (image->width - 1 - x) * pixel_size;
+				for (size_t i = 0; i < pixel_size; i++)
+				{
+					uint8_t tmp = a[i];
+					a[i] = b[i];
+					b[i] = tmp;
+				}
+			}
 		}
-		if (fseek(file, line_padding_size, SEEK_CUR)) return image_error_io;
-		if (y == (flip_y ? 0 : image->height - 1)) break;
-		flip_y ? y-- : y++;
 	}
 
 	return image_error_ok;
@@ -115,7 +125,7 @@ static ImageError bmp_info_get(BmpInfo *info, FILE *file)
 #undef READ_VAR
 }
 
-static ImageError image_bmp_from_file(Image *image, FILE *file)
+static ImageError image_bmp_from_file(Image *image, FILE *file, Alloc *alloc)
 {
 	BmpInfo info;
 	ImageError err = bmp_info_get(&info, file);
@@ -135,25 +145,26 @@ static ImageError image_bmp_from_file(Image *image, FILE *file)
 
 
 			if (SIZE_MAX / width / height < (int32_t)sizeof(Color32)) return image_error_alloc;
-			Image image = {
+			// Rows of bitmaps are stored from the bottom up unless the height is negative.
+			Image tmp = {
 				.width = (size_t)width,
 				.height = (size_t)height,
-				.pixels = malloc((size_t)width * (size_t)height * sizeof(Color32)),
+				.format = ih.bit_count == 24 ? image_format_bgr : image_format_bgra,
 			};
-			if (!image.pixels) return image_error_alloc;
+			allocate(alloc, (void**)&tmp.pixels, image_row_size(&tmp) * tmp.height);
 			
 			err = bmp_load_pixels_uncompressed_u24_or_u32(
 				file,
 				info.file_header.pixel_data_offset,
-				&image,
-				(size_t)((ih.bit_count + 7) / 8),
+				&tmp,
 				flip_x,
 				flip_y);
 			if (err != image_error_ok) 
 			{
-				free(image.pixels);
+				deallocate(alloc, (void**)&tmp.pixels);
 				return err;
 			}
+			*image = tmp;
 		} break;
 		default: return image_error_unsupported;
 	}
@@ -161,19 +172,330 @@ static ImageError image_bmp_from_file(Image *image, FILE *file)
 	return image_error_ok;
 }
 
-ImageError image_load_bmp(Image *image, const char *filepath)
+ImageError image_load_bmp(Image *image, const char *filepath, Alloc *alloc)
 {
 	if (!image) return image_error_invalid;
 	FILE* file = fopen(filepath, "rb");
 	if (!file) return image_error_io;
 	Image tmp;
-	ImageError err = image_bmp_from_file(&tmp, file);
+	ImageError err = image_bmp_from_file(&tmp, file, alloc);
 	fclose(file);
 	if (err) return err;
 	*image = tmp;
 	return image_error_ok;
 }
 
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+#define QOI_MASK_2 0xc0
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_OP_SIZE 5
+#define QOI_MAX_RUN 62
+// Limit of the reference implementation, which keeps sizes within 32 bits.
+#define QOI_MAX_PIXELS 400000000u
+// Files are streamed through a buffer of this size.
+#define QOI_BUFFER_SIZE (64 * 1024)
+
+static const uint8_t qoi_magic[4] = {'q', 'o', 'i', 'f'};
+static const uint8_t qoi_padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+typedef struct QoiStream QoiStream;
+struct QoiStream
+{
+	FILE *file;
+	size_t pos;
+	size_t end;
+	uint8_t data[QOI_BUFFER_SIZE];
+};
+
+static size_t qoi_hash(Color32 c)
+{
+	return (c.red * 3 + c.green * 5 + c.blue * 7 + c.alpha * 11) % 64;
+}
+
+static int qoi_color_equals(Color32 a, Color32 b)
+{
+	return a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha;
+}
+
+static uint32_t qoi_read_u32(const uint8_t *bytes)
+{
+	return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+static void qoi_write_u32(uint8_t *bytes, uint32_t value)
+{
+	bytes[0] = (uint8_t)(value >> 24);
+	bytes[1] = (uint8_t)(value >> 16);
+	bytes[2] = (uint8_t)(value >> 8);
+	bytes[3] = (uint8_t)value;
+}
+
+// Makes at least `size` bytes available to read, unless the file ends first.
+static size_t qoi_stream_fill(QoiStream *stream, size_t size)
+{
+	size_t left = stream->end - stream->pos;
+	if (left >= size) return left;
+	memmove(stream->data, stream->data + stream->pos, left);
+	stream->pos = 0;
+	stream->end = left + fread(stream->data + left, 1, sizeof(stream->data) - left, stream->file);
+	return stream->end;
+}
+
+// Makes room for at least `size` bytes to write. Returns false if the
+// buffered ones could not be written.
+static int qoi_stream_flush(QoiStream *stream, size_t size)
+{
+	if (sizeof(stream->data) - stream->end >= size) return 1;
+	if (stream->end && !fwrite(stream->data, stream->end, 1, stream->file)) return 0;
+	stream->end = 0;
+	return 1;
+}
+
+static ImageError image_qoi_from_file(Image *image, QoiStream *stream, Alloc *alloc)
+{
+	if (qoi_stream_fill(stream, QOI_HEADER_SIZE) < QOI_HEADER_SIZE) return image_error_invalid;
+	const uint8_t *header = stream->data;
+	uint32_t width = qoi_read_u32(header + 4);
+	uint32_t height = qoi_read_u32(header + 8);
+	uint8_t channels = header[12];
+	uint8_t colorspace = header[13];
+	stream->pos = QOI_HEADER_SIZE;
+	if (memcmp(header, qoi_magic, sizeof(qoi_magic)) ||
+		width == 0 ||
+		height == 0 ||
+		(channels != 3 && channels != 4) ||
+		colorspace > 1) return image_error_invalid;
+	if (height >= QOI_MAX_PIXELS / width) return image_error_unsupported;
+
+	Image tmp = {
+		.width = width,
+		.height = height,
+		.format = image_format_rgba,
+	};
+	allocate(alloc, (void**)&tmp.pixels, (size_t)width * height * sizeof(Color32));
+
+	Color32 index[64] = {0};
+	Color32 px = {0, 0, 0, 255};
+	int run = 0;
+	// Rows of QOI images go from the top down.
+	for (size_t y = height; y-- > 0;)
+	{
+		Color32 *row = (Color32*)tmp.pixels + y * width;
+		for (size_t x = 0; x < width; x++)
+		{
+			if (run > 0)
+			{
+				run--;
+				row[x] = px;
+				continue;
+			}
+			// Every op is complete once that many bytes are buffered.
+			if (qoi_stream_fill(stream, QOI_MAX_OP_SIZE) == 0) goto err_truncated;
+			const uint8_t *op = stream->data + stream->pos;
+			size_t left = stream->end - stream->pos;
+			uint8_t b1 = op[0];
+			size_t size = 1;
+			if (b1 == QOI_OP_RGB)
+			{
+				size = 4;
+				if (left < size) goto err_truncated;
+				px.red = op[1];
+				px.green = op[2];
+				px.blue = op[3];
+			}
+			else if (b1 == QOI_OP_RGBA)
+			{
+				size = 5;
+				if (left < size) goto err_truncated;
+				px.red = op[1];
+				px.green = op[2];
+				px.blue = op[3];
+				px.alpha = op[4];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_INDEX)
+			{
+				px = index[b1];
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_DIFF)
+			{
+				px.red += ((b1 >> 4) & 0x03) - 2;
+				px.green += ((b1 >> 2) & 0x03) - 2;
+				px.blue += (b1 & 0x03) - 2;
+			}
+			else if ((b1 & QOI_MASK_2) == QOI_OP_LUMA)
+			{
+				size = 2;
+				if (left < size) goto err_truncated;
+				int dg = (b1 & 0x3f) - 32;
+				px.red += dg - 8 + ((op[1] >> 4) & 0x0f);
+				px.green += dg;
+				px.blue += dg - 8 + (op[1] & 0x0f);
+			}
+			else
+			{
+				run = b1 & 0x3f;
+			}
+			stream->pos += size;
+			index[qoi_hash(px)] = px;
+			row[x] = px;
+		}
+	}
+
+	*image = tmp;
+	return image_error_ok;
+err_truncated:
+	deallocate(alloc, (void**)&tmp.pixels);
+	return image_error_invalid;
+}
+
+ImageError image_load_qoi(Image *image, const char *filepath, Alloc *alloc)
+{
+	if (!image) return image_error_invalid;
+	FILE *file = fopen(filepath, "rb");
+	if (!file) return image_error_io;
+	QoiStream *stream;
+	allocate(alloc, (void**)&stream, sizeof(QoiStream));
+	stream->file = file;
+	stream->pos = 0;
+	stream->end = 0;
+	ImageError err = image_qoi_from_file(image, stream, alloc);
+	// A file cut short reads as invalid, unless reading it failed.
+	if (err == image_error_invalid && ferror(file)) err = image_error_io;
+	deallocate(alloc, (void**)&stream);
+	fclose(file);
+	return err;
+}
+
+static ImageError image_qoi_to_file(const Image *image, QoiStream *stream)
+{
+	int has_alpha = image->format != image_format_bgr;
+	uint8_t *header = stream->data;
+	memcpy(header, qoi_magic, sizeof(qoi_magic));
+	qoi_write_u32(header + 4, (uint32_t)image->width);
+	qoi_write_u32(header + 8, (uint32_t)image->height);
+	header[12] = has_alpha ? 4 : 3;
+	header[13] = 0;
+	stream->end = QOI_HEADER_SIZE;
+
+	size_t pixel_size = image_pixel_size(image->format);
+	size_t row_size = image_row_size(image);
+	int red = image->format == image_format_rgba ? 0 : 2;
+	int blue = 2 - red;
+	Color32 index[64] = {0};
+	Color32 prev = {0, 0, 0, 255};
+	int run = 0;
+	for (size_t y = image->height; y-- > 0;)
+	{
+		const uint8_t *row = (const uint8_t*)image->pixels + y * row_size;
+		for (size_t x = 0; x < image->width; x++)
+		{
+			const uint8_t *p = row + x * pixel_size;
+			Color32 px = {
+				.red = p[red],
+				.green = p[1],
+				.blue = p[blue],
+				.alpha = has_alpha ? p[3] : 255,
+			};
+			int is_last = y == 0 && x + 1 == image->width;
+			// Room for a run ending at the pixel and the op of the pixel.
+			if (!qoi_stream_flush(stream, 2 * QOI_MAX_OP_SIZE)) return image_error_io;
+			uint8_t *out = stream->data + stream->end;
+			if (qoi_color_equals(px, prev))
+			{
+				run++;
+				if (run == QOI_MAX_RUN || is_last)
+				{
+					*out++ = QOI_OP_RUN | (uint8_t)(run - 1);
+					run = 0;
+				}
+			}
+			else
+			{
+				if (run > 0)
+				{
+					*out++ = QOI_OP_RUN | (uint8_t)(run - 1);
+					run = 0;
+				}
+				size_t hash = qoi_hash(px);
+				if (qoi_color_equals(index[hash], px))
+				{
+					*out++ = QOI_OP_INDEX | (uint8_t)hash;
+				}
+				else if (px.alpha == prev.alpha)
+				{
+					index[hash] = px;
+					int8_t dr = (int8_t)(px.red - prev.red);
+					int8_t dg = (int8_t)(px.green - prev.green);
+					int8_t db = (int8_t)(px.blue - prev.blue);
+					int8_t dr_dg = (int8_t)(dr - dg);
+					int8_t db_dg = (int8_t)(db - dg);
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+					{
+						*out++ = QOI_OP_DIFF | (uint8_t)((dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+					}
+					else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7)
+					{
+						*out++ = QOI_OP_LUMA | (uint8_t)(dg + 32);
+						*out++ = (uint8_t)((dr_dg + 8) << 4 | (db_dg + 8));
+					}
+					else
+					{
+						*out++ = QOI_OP_RGB;
+						*out++ = px.red;
+						*out++ = px.green;
+						*out++ = px.blue;
+					}
+				}
+				else
+				{
+					index[hash] = px;
+					*out++ = QOI_OP_RGBA;
+					*out++ = px.red;
+					*out++ = px.green;
+					*out++ = px.blue;
+					*out++ = px.alpha;
+				}
+			}
+			stream->end = (size_t)(out - stream->data);
+			prev = px;
+		}
+	}
+
+	if (!qoi_stream_flush(stream, sizeof(qoi_padding))) return image_error_io;
+	memcpy(stream->data + stream->end, qoi_padding, sizeof(qoi_padding));
+	stream->end += sizeof(qoi_padding);
+	if (!fwrite(stream->data, stream->end, 1, stream->file)) return image_error_io;
+	return image_error_ok;
+}
+
+ImageError image_store_qoi(const Image *image, const char *filepath, Alloc *alloc)
+{
+	if (!image || image->width == 0 || image->height == 0) return image_error_invalid;
+	if (image->height >= QOI_MAX_PIXELS / image->width) return image_error_unsupported;
+	FILE *file = fopen(filepath, "wb");
+	if (!file) return image_error_io;
+	QoiStream *stream;
+	allocate(alloc, (void**)&stream, sizeof(QoiStream));
+	stream->file = file;
+	stream->pos = 0;
+	stream->end = 0;
+	ImageError err = image_qoi_to_file(image, stream);
+	deallocate(alloc, (void**)&stream);
+	if (fclose(file) && err == image_error_ok) err = image_error_io;
+	return err;
+}
+
+void image_deinit(Image *image, Alloc *alloc)
+{
+	deallocate(alloc, (void**)&image->pixels);
+	*image = (Image){0};
+}
+
 //struct BmpImage {
 //	size_t width;
 //	size_t height;
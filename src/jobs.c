@@ -0,0 +1,139 @@
+#include "jobs.h"
+#include <stdio.h>
+#include <threads.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+typedef struct Job Job;
+struct Job {
+	JobFn fn;
+	void* data;
+};
+
+struct JobsShared {
+	mtx_t mutex;
+	// Signaled when a job is queued or the workers should stop.
+	cnd_t has_work;
+	// Signaled when the last unfinished job finishes.
+	cnd_t is_idle;
+	// Ring buffer of queued jobs.
+	Job* queue;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	// Queued jobs plus the ones being run.
+	size_t unfinished;
+	int should_stop;
+	thrd_t* threads;
+};
+
+static void report_thread_error(const char* what) {
+	fprintf(stderr, "\nCaught runtime error:\n\tFailed to create %s for background jobs.\n", what);
+	abort();
+}
+
+static int worker_run(void* arg) {
+	JobsShared* shared = arg;
+	mtx_lock(&shared->mutex);
+	for (;;) {
+		while (shared->count == 0 && !shared->should_stop) cnd_wait(&shared->has_work, &shared->mutex);
+		if (shared->count == 0) break;
+		Job job = shared->queue[shared->head];
+		shared->head = (shared->head + 1) % shared->capacity;
+		shared->count--;
+		mtx_unlock(&shared->mutex);
+
+		job.fn(job.data);
+
+		mtx_lock(&shared->mutex);
+		if (--shared->unfinished == 0) cnd_broadcast(&shared->is_idle);
+	}
+	mtx_unlock(&shared->mutex);
+	return 0;
+}
+
+void jobs_init(Jobs* jobs, Alloc* alloc, size_t worker_count) {
+	*jobs = (Jobs){
+		.alloc = alloc,
+		.worker_count = worker_count,
+	};
+	if (worker_count == 0) return;
+
+	JobsShared* shared;
+	allocate(alloc, (void**)&shared, sizeof(JobsShared));
+	*shared = (JobsShared){0};
+	if (mtx_init(&shared->mutex, mtx_plain) != thrd_success) report_thread_error("a lock");
+	if (cnd_init(&shared->has_work) != thrd_success) report_thread_error("a condition");
+	if (cnd_init(&shared->is_idle) != thrd_success) report_thread_error("a condition");
+	shared->capacity = 64;
+	allocate(alloc, (void**)&shared->queue, shared->capacity * sizeof(Job));
+	allocate(alloc, (void**)&shared->threads, worker_count * sizeof(thrd_t));
+	for (size_t i = 0; i < worker_count; i++) {
+		if (thrd_create(&shared->threads[i], worker_run, shared) != thrd_success) {
+			report_thread_error("a thread");
+		}
+	}
+	jobs->shared = shared;
+}
+
+void jobs_deinit(Jobs* jobs) {
+	JobsShared* shared = jobs->shared;
+	if (shared == NULL) return;
+	mtx_lock(&shared->mutex);
+	shared->should_stop = 1;
+	cnd_broadcast(&shared->has_work);
+	mtx_unlock(&shared->mutex);
+	// Workers drain the queue before they stop.
+	for (size_t i = 0; i < jobs->worker_count; i++) thrd_join(shared->threads[i], NULL);
+
+	cnd_destroy(&shared->is_idle);
+	cnd_destroy(&shared->has_work);
+	mtx_destroy(&shared->mutex);
+	deallocate(jobs->alloc, (void**)&shared->threads);
+	deallocate(jobs->alloc, (void**)&shared->queue);
+	deallocate(jobs->alloc, (void**)&jobs->shared);
+	*jobs = (Jobs){0};
+}
+
+void jobs_submit(Jobs* jobs, JobFn fn, void* data) {
+	JobsShared* shared = jobs->shared;
+	if (shared == NULL) {
+		fn(data);
+		return;
+	}
+	mtx_lock(&shared->mutex);
+	if (shared->count == shared->capacity) {
+		// Unwraps the ring into a buffer of twice the size.
+		Job* queue;
+		allocate(jobs->alloc, (void**)&queue, 2 * shared->capacity * sizeof(Job));
+		for (size_t i = 0; i < shared->count; i++) {
+			queue[i] = shared->queue[(shared->head + i) % shared->capacity];
+		}
+		deallocate(jobs->alloc, (void**)&shared->queue);
+		shared->queue = queue;
+		shared->head = 0;
+		shared->capacity *= 2;
+	}
+	shared->queue[(shared->head + shared->count) % shared->capacity] = (Job){fn, data};
+	shared->count++;
+	shared->unfinished++;
+	cnd_signal(&shared->has_work);
+	mtx_unlock(&shared->mutex);
+}
+
+void jobs_wait(Jobs* jobs) {
+	JobsShared* shared = jobs->shared;
+	if (shared == NULL) return;
+	mtx_lock(&shared->mutex);
+	while (shared->unfinished > 0) cnd_wait(&shared->is_idle, &shared->mutex);
+	mtx_unlock(&shared->mutex);
+}
+
+bool jobs_is_done(Jobs* jobs) {
+	JobsShared* shared = jobs->shared;
+	if (shared == NULL) return true;
+	mtx_lock(&shared->mutex);
+	bool is_done = shared->unfinished == 0;
+	mtx_unlock(&shared->mutex);
+	return is_done;
+}
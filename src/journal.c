@@ -0,0 +1,577 @@
+#define _POSIX_C_SOURCE 200809L
+#include "journal.h"
+#include "codec.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <threads.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define JOURNAL_VERSION 2
+#define JOURNAL_BLOCK_COUNT (CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN)
+#define JOURNAL_NO_FD (-1)
+#define JOURNAL_MIN_ENTRY_CAPACITY 64
+
+typedef struct JournalHeader JournalHeader;
+struct JournalHeader
+{
+	u8 magic[4];
+	u32 version;
+	u32 chunk_sidelen;
+	// Records hold differences from the generated chunks, so they are
+	// meaningless for any other terrain.
+	u32 generator_version;
+	u32 terrain_hash;
+};
+
+struct JournalLock
+{
+	mtx_t mutex;
+};
+
+typedef struct JournalRecord JournalRecord;
+struct JournalRecord
+{
+	i32 x;
+	i32 y;
+	i32 z;
+	u32 size;
+	// Of the payload, so a record torn by a crash is recognized.
+	u32 checksum;
+};
+
+static const u8 journal_magic[4] = {'C', 'M', 'E', 'J'};
+
+static u32 fnv1a_extend(u32 hash, const void *data, size_t size)
+{
+	const u8 *bytes = data;
+	for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+static u32 fnv1a(const u8 *data, size_t size)
+{
+	return fnv1a_extend(2166136261u, data, size);
+}
+
+static u32 fbm_hash(u32 hash, const Fbm *fbm)
+{
+	hash = fnv1a_extend(hash, &fbm->octave_count, sizeof(fbm->octave_count));
+	hash = fnv1a_extend(hash, &fbm->frequency, sizeof(fbm->frequency));
+	hash = fnv1a_extend(hash, &fbm->intensity, sizeof(fbm->intensity));
+	hash = fnv1a_extend(hash, &fbm->lacunarity, sizeof(fbm->lacunarity));
+	hash = fnv1a_extend(hash, &fbm->persistance, sizeof(fbm->persistance));
+	return fnv1a_extend(hash, &fbm->noise, sizeof(fbm->noise));
+}
+
+// Of everything the generated blocks depend on but the generator's code.
+static u32 terrain_hash(const Terrain *terrain)
+{
+	const TerrainSettings *settings = &terrain->settings;
+	u32 hash = fnv1a(terrain->perlin->p, sizeof(terrain->perlin->p));
+	hash = fnv1a_extend(hash, &settings->kind, sizeof(settings->kind));
+	hash = fbm_hash(hash, &settings->heightmap);
+	hash = fbm_hash(hash, &settings->density);
+	hash = fnv1a_extend(hash, &settings->density_threshold, sizeof(settings->density_threshold));
+	return fnv1a_extend(hash, &settings->density_falloff, sizeof(settings->density_falloff));
+}
+
+static int make_dir(const char *path)
+{
+#if defined(_WIN32)
+	int result = _mkdir(path);
+#else
+	int result = mkdir(path, 0755);
+#endif
+	return result == 0 || errno == EEXIST;
+}
+
+static void report_io_error(const char *action, const char *path)
+{
+	fprintf(
+		stderr,
+		"\nCaught runtime error:\n"
+		"\tFailed to %s journal '%s'.\n",
+		action,
+		path);
+}
+
+static int open_read_fd(const char *path)
+{
+#if defined(_WIN32)
+	return _open(path, _O_RDONLY | _O_BINARY);
+#else
+	return open(path, O_RDONLY);
+#endif
+}
+
+static void close_fd(int fd)
+{
+#if defined(_WIN32)
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+// Flushes the file and waits until its contents reach the disk.
+static bool sync_file(FILE *file)
+{
+	if (fflush(file)) return false;
+#if defined(_WIN32)
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Replaces the file at `to` with the one at `from`, which is never left
+// without either of them.
+static bool replace_file(const char *from, const char *to)
+{
+#if defined(_WIN32)
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+static u32 pos_hash(CPos pos)
+{
+	return (u32)pos.x * 73856093u ^ (u32)pos.y * 19349663u ^ (u32)pos.z * 83492791u;
+}
+
+static JournalEntry *journal_find(const Journal *journal, CPos pos)
+{
+	size_t mask = journal->entry_capacity - 1;
+	size_t slot = pos_hash(pos) & mask;
+	for (;;)
+	{
+		JournalEntry *entry = &journal->entries[slot];
+		if (!entry->is_used) return entry;
+		if (entry->pos.x == pos.x && entry->pos.y == pos.y && entry->pos.z == pos.z) return entry;
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void journal_resize(Journal *journal, size_t capacity)
+{
+	JournalEntry *old = journal->entries;
+	size_t old_capacity = journal->entry_capacity;
+	allocate(journal->alloc, (void**)&journal->entries, capacity * sizeof(JournalEntry));
+	memset(journal->entries, 0, capacity * sizeof(JournalEntry));
+	journal->entry_capacity = capacity;
+	for (size_t i = 0; i < old_capacity; i++)
+	{
+		if (old[i].is_used) *journal_find(journal, old[i].pos) = old[i];
+	}
+	if (old != NULL) deallocate(journal->alloc, (void**)&old);
+}
+
+// Points the chunk's entry at a new record, superseding the previous one.
+static void journal_index(Journal *journal, CPos pos, u64 offset, u32 size, u32 checksum)
+{
+	if (2 * (journal->entry_count + 1) > journal->entry_capacity)
+	{
+		journal_resize(journal, 2 * journal->entry_capacity);
+	}
+	JournalEntry *entry = journal_find(journal, pos);
+	if (entry->is_used)
+	{
+		journal->live_size -= sizeof(JournalRecord) + entry->size;
+	}
+	else
+	{
+		journal->entry_count++;
+	}
+	*entry = (JournalEntry){
+		.pos = pos,
+		.is_used = true,
+		.size = size,
+		.offset = offset,
+		.checksum = checksum,
+	};
+	journal->live_size += sizeof(JournalRecord) + size;
+}
+
+static bool journal_create_file(const Journal *journal, const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+	JournalHeader header = {
+		.version = JOURNAL_VERSION,
+		.chunk_sidelen = CHUNK_SIDELEN,
+		.generator_version = TERRAIN_GENERATOR_VERSION,
+		.terrain_hash = journal->terrain_hash,
+	};
+	memcpy(header.magic, journal_magic, sizeof(journal_magic));
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	return fclose(file) == 0 && ok;
+}
+
+// Returns false and reports why if the journal cannot be read by this
+// build, or was recorded against another terrain.
+static bool journal_check_header(const Journal *journal)
+{
+	JournalHeader header;
+	bool is_supported =
+		fseek(journal->file, 0, SEEK_SET) == 0 &&
+		fread(&header, sizeof(header), 1, journal->file) == 1 &&
+		memcmp(header.magic, journal_magic, sizeof(journal_magic)) == 0 &&
+		header.version == JOURNAL_VERSION &&
+		header.chunk_sidelen == CHUNK_SIDELEN;
+	if (!is_supported)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tJournal '%s' has an unsupported format.\n",
+			journal->path);
+		return false;
+	}
+	if (header.generator_version != TERRAIN_GENERATOR_VERSION || header.terrain_hash != journal->terrain_hash)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tJournal '%s' was recorded against another terrain.\n"
+			"\tgenerator version = `%u`\n",
+			journal->path,
+			(unsigned)header.generator_version);
+		return false;
+	}
+	return true;
+}
+
+// Indexes the records up to the first one that is not intact.
+static void journal_scan(Journal *journal)
+{
+	journal->end = sizeof(JournalHeader);
+	if (fseek(journal->file, sizeof(JournalHeader), SEEK_SET)) return;
+	u8 *payload;
+	size_t payload_capacity = JOURNAL_MAX_PAYLOAD_SIZE;
+	allocate(journal->alloc, (void**)&payload, payload_capacity);
+	JournalRecord record;
+	while (fread(&record, sizeof(record), 1, journal->file) == 1)
+	{
+		if (record.size > payload_capacity) break;
+		if (record.size > 0 && fread(payload, record.size, 1, journal->file) != 1) break;
+		if (fnv1a(payload, record.size) != record.checksum) break;
+		CPos pos = {record.x, record.y, record.z};
+		journal_index(journal, pos, journal->end + sizeof(JournalRecord), record.size, record.checksum);
+		journal->end += sizeof(JournalRecord) + record.size;
+	}
+	deallocate(journal->alloc, (void**)&payload);
+}
+
+bool journal_init(Journal *journal, const char *dir, const Terrain *terrain, Alloc *alloc)
+{
+	*journal = (Journal){
+		.read_fd = JOURNAL_NO_FD,
+		.alloc = alloc,
+		.terrain_hash = terrain_hash(terrain),
+	};
+	allocate(alloc, (void**)&journal->lock, sizeof(JournalLock));
+	if (mtx_init(&journal->lock->mutex, mtx_plain) != thrd_success)
+	{
+		deallocate(alloc, (void**)&journal->lock);
+		return false;
+	}
+	journal_resize(journal, JOURNAL_MIN_ENTRY_CAPACITY);
+
+	// Directories whose paths do not fit are refused rather than truncated.
+	int length = snprintf(journal->path, sizeof(journal->path), "%s/edits.journal", dir);
+	if (length < 0 || length >= (int)sizeof(journal->path)) return false;
+
+	// Creates every directory along the path.
+	char path[JOURNAL_PATH_CAPACITY];
+	snprintf(path, sizeof(path), "%s", dir);
+	for (char *c = path + 1; *c; c++)
+	{
+		if (*c != '/') continue;
+		*c = 0;
+		if (!make_dir(path)) return false;
+		*c = '/';
+	}
+	if (!make_dir(path)) return false;
+
+	journal->file = fopen(journal->path, "r+b");
+	if (!journal->file)
+	{
+		if (!journal_create_file(journal, journal->path)) return false;
+		journal->file = fopen(journal->path, "r+b");
+		if (!journal->file) return false;
+	}
+	if (!journal_check_header(journal))
+	{
+		fclose(journal->file);
+		journal->file = NULL;
+		return false;
+	}
+	journal_scan(journal);
+	journal->read_fd = open_read_fd(journal->path);
+	return journal->read_fd != JOURNAL_NO_FD;
+}
+
+void journal_deinit(Journal *journal)
+{
+	if (journal->file) fclose(journal->file);
+	if (journal->entries) deallocate(journal->alloc, (void**)&journal->entries);
+	if (journal->lock)
+	{
+		ASSERT(journal->pending_reads == 0);
+		if (journal->read_fd != JOURNAL_NO_FD) close_fd(journal->read_fd);
+		mtx_destroy(&journal->lock->mutex);
+		deallocate(journal->alloc, (void**)&journal->lock);
+	}
+	*journal = (Journal){0};
+}
+
+// Copies blocks between the chunk's layout and the x-major order of
+// records, so the journal does not depend on `CHUNK_LAYOUT`.
+static void copy_blocks_x_major(Block *x_major, Chunk *chunk, bool to_chunk)
+{
+	size_t i = 0;
+	for (int z = 0; z < CHUNK_SIDELEN; z++)
+	{
+		for (int y = 0; y < CHUNK_SIDELEN; y++)
+		{
+			for (int x = 0; x < CHUNK_SIDELEN; x++, i++)
+			{
+				Block *block = &chunk->blocks[CHUNK_BLOCK_IDX(x, y, z)];
+				if (to_chunk) *block = x_major[i];
+				else x_major[i] = *block;
+			}
+		}
+	}
+}
+
+bool journal_read_begin(Journal *journal, CPos pos, JournalRead *read)
+{
+	if (journal->lock == NULL) return false;
+	mtx_lock(&journal->lock->mutex);
+	JournalEntry *entry = journal->entry_count ? journal_find(journal, pos) : NULL;
+	bool has_edits =
+		journal->read_fd != JOURNAL_NO_FD &&
+		entry != NULL &&
+		entry->is_used &&
+		entry->size != 0;
+	if (has_edits)
+	{
+		*read = (JournalRead){
+			.fd = journal->read_fd,
+			.offset = entry->offset,
+			.size = entry->size,
+			.checksum = entry->checksum,
+		};
+		journal->pending_reads++;
+	}
+	mtx_unlock(&journal->lock->mutex);
+	return has_edits;
+}
+
+void journal_read_end(Journal *journal)
+{
+	mtx_lock(&journal->lock->mutex);
+	ASSERT(journal->pending_reads > 0);
+	journal->pending_reads--;
+	mtx_unlock(&journal->lock->mutex);
+}
+
+bool journal_apply_chunk(
+	Journal *journal,
+	CPos pos,
+	const JournalRead *read,
+	const u8 *payload,
+	Chunk *chunk,
+	Alloc *scratch)
+{
+	(void)journal;
+	ASSERT(chunk->lod == 0);
+	Block *diff;
+	Block *blocks;
+	allocate(scratch, (void**)&diff, JOURNAL_BLOCK_COUNT);
+	allocate(scratch, (void**)&blocks, JOURNAL_BLOCK_COUNT);
+	bool ok =
+		fnv1a(payload, read->size) == read->checksum &&
+		codec_decode_blocks(payload, read->size, diff, JOURNAL_BLOCK_COUNT, scratch);
+
+	copy_blocks_x_major(blocks, chunk, false);
+	for (size_t i = 0; ok && i < JOURNAL_BLOCK_COUNT; i++)
+	{
+		blocks[i] ^= diff[i];
+		ok = blocks[i] < block_count;
+	}
+	if (ok) copy_blocks_x_major(blocks, chunk, true);
+	deallocate(scratch, (void**)&blocks);
+	deallocate(scratch, (void**)&diff);
+	if (!ok)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tEdits of the chunk at (%d, %d, %d) are corrupted and were discarded.\n",
+			pos.x,
+			pos.y,
+			pos.z);
+	}
+	return ok;
+}
+
+// Rewrites the journal with the latest record of every chunk.
+static bool journal_compact(Journal *journal)
+{
+	char tmp_path[JOURNAL_PATH_CAPACITY + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal->path);
+	if (!journal_create_file(journal, tmp_path)) return false;
+	FILE *file = fopen(tmp_path, "r+b");
+	if (!file) return false;
+
+	u8 *payload;
+	allocate(journal->alloc, (void**)&payload, JOURNAL_MAX_PAYLOAD_SIZE);
+	bool ok = fseek(file, 0, SEEK_END) == 0;
+	u64 end = sizeof(JournalHeader);
+	u64 live_size = 0;
+	for (size_t i = 0; ok && i < journal->entry_capacity; i++)
+	{
+		JournalEntry *entry = &journal->entries[i];
+		if (!entry->is_used || entry->size == 0) continue;
+		ok =
+			fseek(journal->file, (long)entry->offset, SEEK_SET) == 0 &&
+			fread(payload, entry->size, 1, journal->file) == 1;
+		if (!ok) break;
+		JournalRecord record = {
+			.x = entry->pos.x,
+			.y = entry->pos.y,
+			.z = entry->pos.z,
+			.size = entry->size,
+			.checksum = fnv1a(payload, entry->size),
+		};
+		ok =
+			fwrite(&record, sizeof(record), 1, file) == 1 &&
+			fwrite(payload, entry->size, 1, file) == 1;
+		entry->offset = end + sizeof(JournalRecord);
+		end += sizeof(JournalRecord) + entry->size;
+		live_size += sizeof(JournalRecord) + entry->size;
+	}
+	deallocate(journal->alloc, (void**)&payload);
+	// The records must be on the disk before they replace the journal,
+	// or a crash could leave it with only part of them.
+	ok = ok && sync_file(file);
+	ok = fclose(file) == 0 && ok;
+	if (ok)
+	{
+		// Windows does not replace files that are still open.
+		fclose(journal->file);
+		if (journal->read_fd != JOURNAL_NO_FD) close_fd(journal->read_fd);
+		ok = replace_file(tmp_path, journal->path);
+		// Either file is whole, so the journal is usable if it reopens.
+		journal->file = fopen(journal->path, "r+b");
+		journal->read_fd = open_read_fd(journal->path);
+		if (journal->file == NULL) return false;
+	}
+	if (!ok)
+	{
+		// Offsets of entries that were already moved are wrong now, so the
+		// journal is scanned again.
+		remove(tmp_path);
+		memset(journal->entries, 0, journal->entry_capacity * sizeof(JournalEntry));
+		journal->entry_count = 0;
+		journal->live_size = 0;
+		journal_scan(journal);
+		return false;
+	}
+	journal->end = end;
+	journal->live_size = live_size;
+	return journal->read_fd != JOURNAL_NO_FD;
+}
+
+bool journal_save_chunk(Journal *journal, Terrain *terrain, CPos pos, const Chunk *chunk)
+{
+	ASSERT(chunk->lod == 0);
+	if (journal->lock == NULL) return false;
+
+	Chunk *base;
+	Block *diff;
+	Block *blocks;
+	allocate(journal->alloc, (void**)&base, sizeof(Chunk));
+	allocate(journal->alloc, (void**)&diff, JOURNAL_BLOCK_COUNT);
+	allocate(journal->alloc, (void**)&blocks, JOURNAL_BLOCK_COUNT);
+	chunk_init(base);
+	chunk_generate_blocks(base, terrain, cp2bp(pos), 0);
+	copy_blocks_x_major(diff, base, false);
+	copy_blocks_x_major(blocks, (Chunk*)chunk, false);
+	bool has_edits = false;
+	for (size_t i = 0; i < JOURNAL_BLOCK_COUNT; i++)
+	{
+		diff[i] ^= blocks[i];
+		has_edits |= diff[i] != 0;
+	}
+	deallocate(journal->alloc, (void**)&blocks);
+	deallocate(journal->alloc, (void**)&base);
+
+	u8 *record_data;
+	allocate(journal->alloc, (void**)&record_data, sizeof(JournalRecord) + JOURNAL_MAX_PAYLOAD_SIZE);
+	u8 *payload = record_data + sizeof(JournalRecord);
+	// An empty payload marks edits that were all undone.
+	size_t size = has_edits ? codec_encode_blocks(diff, JOURNAL_BLOCK_COUNT, payload, journal->alloc) : 0;
+	deallocate(journal->alloc, (void**)&diff);
+
+	// Only the file and the index are guarded, so other threads keep
+	// generating and encoding meanwhile.
+	mtx_lock(&journal->lock->mutex);
+	JournalEntry *entry = journal_find(journal, pos);
+	if (journal->file == NULL || (!has_edits && (!entry->is_used || entry->size == 0)))
+	{
+		// Nothing to record, and nothing to supersede.
+		bool is_ok = journal->file != NULL;
+		mtx_unlock(&journal->lock->mutex);
+		deallocate(journal->alloc, (void**)&record_data);
+		return is_ok;
+	}
+	JournalRecord record = {
+		.x = pos.x,
+		.y = pos.y,
+		.z = pos.z,
+		.size = (u32)size,
+		.checksum = fnv1a(payload, size),
+	};
+	memcpy(record_data, &record, sizeof(record));
+
+	bool ok =
+		fseek(journal->file, (long)journal->end, SEEK_SET) == 0 &&
+		fwrite(record_data, sizeof(JournalRecord) + size, 1, journal->file) == 1 &&
+		fflush(journal->file) == 0;
+	deallocate(journal->alloc, (void**)&record_data);
+	if (!ok)
+	{
+		mtx_unlock(&journal->lock->mutex);
+		report_io_error("write", journal->path);
+		return false;
+	}
+	journal_index(journal, pos, journal->end + sizeof(JournalRecord), (u32)size, record.checksum);
+	journal->end += sizeof(JournalRecord) + size;
+
+	u64 dead_size = journal->end - sizeof(JournalHeader) - journal->live_size;
+	bool should_compact =
+		dead_size >= JOURNAL_COMPACT_MIN_DEAD_SIZE &&
+		dead_size > journal->live_size &&
+		journal->pending_reads == 0;
+	if (should_compact)
+	{
+		if (!journal_compact(journal)) report_io_error("compact", journal->path);
+	}
+	mtx_unlock(&journal->lock->mutex);
+	return true;
+}
@@ -2,7 +2,14 @@
 #include "context.h"
 #include "input.h"
 #include "chunk.h"
+#include "horizon.h"
+#include "residency.h"
+#include "saver.h"
+#include "aio.h"
+#include "mesh_cache.h"
+#include "slab.h"
 #include <stdlib.h>
+#include <stdio.h>
 
 /*static void main_menu_run(void) {
 	GLuint texture = render_tmp_texture();
@@ -48,46 +55,233 @@
 	}
 }*/
 
-void world_run(void) {
-	glEnable(GL_CULL_FACE);
-	glEnable(GL_DEPTH_TEST);
+// Bytes of temporary buffers a frame starts with, it grows to fit the largest frame.
+#define WORLD_FRAME_CAPACITY (1 << 20)
 
+// Everything a world needs but the OpenGL context, so it can be set up
+// and start generating before the window exists.
+typedef struct World World;
+struct World {
+	// Meshes are built in a single buffer which is kept between them.
+	MeshBuilder mesh_scratch;
+	// Temporary buffers of the main thread, reset every frame.
+	FrameAllocator frame;
+	// Terrain caches live until the world is regenerated.
+	ArenaAllocator arena;
+	PoolAllocator perlins;
+	// Chunks are created and destroyed as the area follows the camera.
+	Slab chunk_slab;
+	SlabCache chunk_cache;
+	size_t chunks_sidelen;
 	Chunks chunks;
-	chunks_init(&chunks, (CPos){0}, 3);
+	Horizon horizon;
+	u32 seed;
+	TerrainKind terrain_kind;
+	Perlin* perlin;
+	Terrain terrain;
+	// Edits are recorded per world, which is identified by its seed and kind.
+	// Without a journal they are kept until the world is unloaded.
+	Journal journal;
+	bool has_journal;
+	Saver saver;
+	f64 last_save_time;
+	MeshCache mesh_cache;
+	bool has_mesh_cache;
+	// Edits are read from the journal while other chunks are generated.
+	Aio aio;
+	Jobs jobs;
+	// Chunks that left the area stay compressed in memory until the budget runs out.
+	Residency residency;
+	// Negated position of the camera.
+	Vec3 pos;
+};
+
+static CPos world_focus(const World* w) {
+	return p2cp(v3_neg(w->pos));
+}
+
+static CPos world_chunks_min(const World* w) {
+	CPos focus = world_focus(w);
+	return (CPos){
+		focus.x - (int)w->chunks_sidelen / 2,
+		focus.y - (int)w->chunks_sidelen / 2,
+		focus.z - (int)w->chunks_sidelen / 2,
+	};
+}
+
+static void world_init(World* w) {
+	*w = (World){
+		// Chunks up to 9 away from the focus, so the farthest ones are
+		// generated at the coarsest level of detail.
+		.chunks_sidelen = 18,
+		.terrain_kind = terrain_kind_heightmap,
+		.pos = {1, 0, -1.5},
+	};
+	mb_init(&w->mesh_scratch, std_allocator_alloc());
+	frame_allocator_init(&w->frame, std_allocator_alloc(), WORLD_FRAME_CAPACITY);
+	arena_allocator_init(&w->arena, std_allocator_alloc(), 1 << 20);
+	pool_allocator_init(&w->perlins, std_allocator_alloc(), sizeof(Perlin), 1);
+	slab_init(&w->chunk_slab, std_allocator_alloc(), sizeof(Chunk));
+	slab_cache_init(&w->chunk_cache, &w->chunk_slab);
+	// The area starts around the spawn point, so it is not moved on the first frame.
+	chunks_init(&w->chunks, world_chunks_min(w), w->chunks_sidelen, std_allocator_alloc(), slab_cache_alloc(&w->chunk_cache));
+	horizon_init(&w->horizon);
+	aio_init(&w->aio, std_allocator_alloc(), CHUNKS_MAX_LOADS, JOURNAL_MAX_PAYLOAD_SIZE);
+	jobs_init(&w->jobs, std_allocator_alloc(), CMINE_WORKER_COUNT);
+	residency_init(
+		&w->residency,
+		std_allocator_alloc(),
+		&w->journal,
+		&w->saver,
+		&w->jobs,
+		RESIDENCY_DEFAULT_BUDGET);
+}
+
+// Opens the world of the current seed and kind, and moves on to the next seed.
+static void world_load(World* w) {
+	allocate(pool_allocator_alloc(&w->perlins), (void**)&w->perlin, sizeof(Perlin));
+	perlin_init(w->perlin, w->seed);
+	TerrainSettings settings = {
+		.kind = w->terrain_kind,
+		.heightmap = {
+			.octave_count = 1,
+			.frequency = 0.2f,
+			.intensity = 8,
+			.persistance = 1,
+			.lacunarity = 1,
+		},
+		.density = {
+			.octave_count = 2,
+			.frequency = 0.08f,
+			.intensity = 16,
+			.persistance = 0.5f,
+			.lacunarity = 2,
+			.noise = fbm_noise_simplex,
+		},
+		.density_threshold = 8,
+		.density_falloff = 0.5f,
+	};
+	terrain_init(&w->terrain, w->perlin, settings, arena_allocator_alloc(&w->arena));
+	char save_dir[JOURNAL_PATH_CAPACITY];
+	snprintf(save_dir, sizeof(save_dir), "saves/seed_%u_kind_%d", w->seed, (int)w->terrain_kind);
+	w->has_journal = journal_init(&w->journal, save_dir, &w->terrain, std_allocator_alloc());
+	if (!w->has_journal) {
+		fprintf(stderr, "\nCaught runtime error:\n\tFailed to open the journal in '%s'.\n", save_dir);
+	}
+#ifdef CMINE_ENABLE_MESH_CACHE
+	w->has_mesh_cache = mesh_cache_init(&w->mesh_cache, save_dir, std_allocator_alloc());
+	if (!w->has_mesh_cache) {
+		fprintf(stderr, "\nCaught runtime error:\n\tFailed to open the mesh cache in '%s'.\n", save_dir);
+	}
+#endif
+	saver_init(&w->saver, std_allocator_alloc(), &w->journal, &w->terrain, &w->residency);
+	w->last_save_time = time();
+	w->seed++;
+}
+
+// Saves and closes the current world, which frees its meshes.
+static void world_unload(World* w) {
+	chunks_finish_loads(&w->chunks, &w->journal, &w->aio, frame_allocator_alloc(&w->frame));
+	saver_finish(&w->saver, &w->chunks);
+	if (w->has_journal) chunks_save(&w->chunks, &w->journal, &w->terrain);
+	// Also drops the chunks of this world, whose edits are lost without a journal.
+	residency_flush(&w->residency);
+	saver_deinit(&w->saver);
+	journal_deinit(&w->journal);
+	w->has_journal = false;
+	if (w->has_mesh_cache) {
+		mesh_cache_deinit(&w->mesh_cache);
+		w->has_mesh_cache = false;
+	}
+	chunks_unload(&w->chunks);
+	horizon_unload(&w->horizon);
+	if (w->perlin) {
+		terrain_deinit(&w->terrain);
+		deallocate(pool_allocator_alloc(&w->perlins), (void**)&w->perlin);
+	}
+	arena_allocator_reset(&w->arena);
+}
 
-	bool should_generate_chunk = true;
-	u32 seed = 0;
+static void world_deinit(World* w) {
+	chunks_finish_loads(&w->chunks, &w->journal, &w->aio, frame_allocator_alloc(&w->frame));
+	saver_finish(&w->saver, &w->chunks);
+	if (w->has_journal) chunks_save(&w->chunks, &w->journal, &w->terrain);
+	residency_flush(&w->residency);
+	saver_deinit(&w->saver);
+	residency_deinit(&w->residency);
+	aio_deinit(&w->aio);
+	jobs_deinit(&w->jobs);
+	journal_deinit(&w->journal);
+	if (w->has_mesh_cache) mesh_cache_deinit(&w->mesh_cache);
+	horizon_deinit(&w->horizon);
+	chunks_deinit(&w->chunks);
+	slab_cache_deinit(&w->chunk_cache);
+	slab_deinit(&w->chunk_slab);
+	terrain_deinit(&w->terrain);
+	deallocate(pool_allocator_alloc(&w->perlins), (void**)&w->perlin);
+	pool_allocator_deinit(&w->perlins);
+	arena_allocator_deinit(&w->arena);
+	frame_allocator_deinit(&w->frame);
+	mb_deinit(&w->mesh_scratch);
+}
+
+// Generates the chunks nearest to the spawn point while the main thread
+// creates the window, which does not touch the world until this is done.
+// The rest of the area is generated by the frames that follow.
+// Nothing is stored in the residency yet, so this never waits on the
+// workers it runs on. The frame's scratch belongs to the main thread.
+static void world_spawn_job_run(void* data) {
+	World* w = data;
+	chunks_generate_blocks(
+		&w->chunks,
+		&w->terrain,
+		&w->residency,
+		&w->aio,
+		world_focus(w),
+		std_allocator_alloc());
+}
+
+void world_run(World* w, f64 start_time) {
+	glEnable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
 
 	GLuint texture = render_tmp_texture();
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
 
-	Vec3 pos = (Vec3){1, 0, -1.5};
-
 	f32 mouse_speed = 0.001f;
 	f32 move_speed = 3.0f;
 	Angle h_ang = angle_from_radians(0);
 	Angle v_ang = angle_from_radians(0);
 
+	bool should_generate_chunk = false;
+	bool has_drawn_frame = false;
+	// The spawn chunks have been generating since before the window
+	// existed. Frames are cleared without the world until they are done,
+	// so the window stays responsive.
+	bool is_spawning = true;
+
 	context_hide_cursor();
 	while (!context_has_close_flag())
 	{
+		if (is_spawning)
+		{
+			is_spawning = !jobs_is_done(&w->jobs);
+			if (is_spawning)
+			{
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				context_swap_buffers();
+				context_update();
+				input_update();
+				continue;
+			}
+		}
+		frame_allocator_reset(&w->frame);
+		Alloc* scratch = frame_allocator_alloc(&w->frame);
 		if (should_generate_chunk)
 		{
-			chunks_unload(&chunks);
-			Perlin* perlin = malloc(sizeof(Perlin));
-			perlin_init(perlin, seed);
-			Fbm fbm = {
-				.octave_count = 1,
-				.frequency = 0.2f,
-				.intensity = 8,
-				.persistance = 1,
-				.lacunarity = 1,
-			};
-			chunks_generate_blocks(&chunks, perlin, fbm);
-			chunks_generate_mesh(&chunks);
-			free(perlin);
+			world_unload(w);
+			world_load(w);
 			should_generate_chunk = false;
-			seed++;
 		}
 
 		Vec3 up = (Vec3){0, 0, 1};
@@ -95,13 +289,52 @@ void world_run(void) {
 		Vec3 left = v3_cross(dir, up);
 		
 		f32 move = move_speed * (f32)delta_time();
-		if (is_key_pressed(key_w)) pos = v3_add(pos, v3_scale(dir, move));
-		if (is_key_pressed(key_s)) pos = v3_sub(pos, v3_scale(dir, move));
-		if (is_key_pressed(key_a)) pos = v3_sub(pos, v3_scale(left, move));
-		if (is_key_pressed(key_d)) pos = v3_add(pos, v3_scale(left, move));
-		if (is_key_pressed(key_left_shift)) pos = v3_add(pos, v3_scale(up, move));
-		if (is_key_pressed(key_space)) pos = v3_sub(pos, v3_scale(up, move));
+		if (is_key_pressed(key_w)) w->pos = v3_add(w->pos, v3_scale(dir, move));
+		if (is_key_pressed(key_s)) w->pos = v3_sub(w->pos, v3_scale(dir, move));
+		if (is_key_pressed(key_a)) w->pos = v3_sub(w->pos, v3_scale(left, move));
+		if (is_key_pressed(key_d)) w->pos = v3_add(w->pos, v3_scale(left, move));
+		if (is_key_pressed(key_left_shift)) w->pos = v3_add(w->pos, v3_scale(up, move));
+		if (is_key_pressed(key_space)) w->pos = v3_sub(w->pos, v3_scale(up, move));
 		if (is_key_down(key_g)) should_generate_chunk = true;
+		if (is_key_down(key_t))
+		{
+			w->terrain_kind = (w->terrain_kind + 1) % terrain_kind_count;
+			should_generate_chunk = true;
+		}
+
+		CPos focus = world_focus(w);
+		CPos chunks_min = world_chunks_min(w);
+		if (chunks_min.x != w->chunks.area.min.x ||
+			chunks_min.y != w->chunks.area.min.y ||
+			chunks_min.z != w->chunks.area.min.z)
+		{
+			chunks_move(&w->chunks, chunks_min, &w->residency, scratch);
+		}
+		chunks_generate_blocks(&w->chunks, &w->terrain, &w->residency, &w->aio, focus, scratch);
+		residency_prefetch(&w->residency, w->chunks.area);
+		if (is_key_down(key_x))
+		{
+			// Carves a sphere of air around the camera.
+			Vec3 eye = v3_neg(w->pos);
+			BPos center = {(i32)floorf(eye.x), (i32)floorf(eye.y), (i32)floorf(eye.z)};
+			int radius = 2;
+			for (int z = -radius; z <= radius; z++)
+				for (int y = -radius; y <= radius; y++)
+					for (int x = -radius; x <= radius; x++)
+					{
+						if (x*x + y*y + z*z > radius*radius) continue;
+						BPos block_pos = {center.x + x, center.y + y, center.z + z};
+						chunks_set_block(&w->chunks, &w->terrain, block_pos, block_air);
+					}
+		}
+		saver_update(&w->saver, &w->chunks);
+		if (time() - w->last_save_time >= SAVER_INTERVAL)
+		{
+			saver_start(&w->saver, &w->chunks);
+			w->last_save_time = time();
+		}
+		MeshCache* cache = w->has_mesh_cache ? &w->mesh_cache : NULL;
+		chunks_generate_mesh(&w->chunks, &w->mesh_scratch, cache);
 
 		if (!context_is_window_focused() || is_key_down(key_esc)) context_show_cursor();
 		if (context_is_cursor_hovered() && is_mouse_down(mouse_key_left)) context_hide_cursor();
@@ -124,35 +357,88 @@ void world_run(void) {
 		f32 sin = angle_sin(v_ang);
 		f32 cos = angle_cos(v_ang);
 		Camera cam = {
-			.pos = pos, 
+			.pos = w->pos, 
 			.dir = dir3_from_vec((Vec3){dir.x*cos, dir.y*cos, -sin}),
 			.up = dir3_from_vec(up),
 		};
 		Perspective p = {
 			.fov_z_rad = 75.0f * DEG_TO_RAD,
 			.aspect = aspect,
-			.near = 0.1f,
-			.far = 100.0f,
+			// Depth precision falls with the ratio of far to near, and the
+			// horizon is far, so near is no closer than it has to be.
+			.near = 0.5f,
+			.far = HORIZON_SIDELEN * HORIZON_TILE_SIDELEN,
 		};
-		chunks_draw(&chunks, cam, p);
+		chunks_update_lod(&w->chunks, &w->terrain, v3_neg(w->pos), p, height, &w->mesh_scratch, cache);
+		chunks_draw(&w->chunks, cam, p);
+		// Density terrain has no heightmap to approximate it with.
+		if (w->terrain.settings.kind == terrain_kind_heightmap)
+		{
+			horizon_update(&w->horizon, &w->terrain, w->chunks.area, v3_neg(w->pos), &w->mesh_scratch);
+			horizon_draw(&w->horizon, cam, p);
+		}
 		context_swap_buffers();
+		if (!has_drawn_frame)
+		{
+			fprintf(
+				stderr,
+				"\nRecieved info:\n"
+				"\tDrew the first frame.\n"
+				"\tMilliseconds since startup = `%.2f`\n",
+				(context_clock() - start_time) * 1000.0);
+			has_drawn_frame = true;
+		}
 		context_update();
 		input_update();
 	}
+	// The window may have been closed before the spawn chunks were done.
+	if (is_spawning) jobs_wait(&w->jobs);
 
-	chunks_deinit(&chunks);
 	glDisable(GL_CULL_FACE);
 	glDisable(GL_DEPTH_TEST);
 }
 
+static void render_assets_job_run(void* data) {
+	render_assets_load(data);
+}
+
 int main(void) {
+	// Taken before anything else, so the time to the first frame covers
+	// all of startup, including creating the window.
+	f64 start_time = context_clock();
+	// Work that needs no OpenGL context runs on workers while the window
+	// is created: decoding the assets, and generating the spawn area.
+	Jobs startup_jobs;
+	jobs_init(&startup_jobs, std_allocator_alloc(), 1);
+	RenderAssets assets;
+	jobs_submit(&startup_jobs, render_assets_job_run, &assets);
+	World world;
+	world_init(&world);
+	world_load(&world);
+	jobs_submit(&world.jobs, world_spawn_job_run, &world);
+
 	if (!context_try_init()) {
+		jobs_deinit(&startup_jobs);
+		render_assets_deinit(&assets);
+		// Nothing has been meshed yet, so this needs no OpenGL context.
+		jobs_wait(&world.jobs);
+		world_deinit(&world);
 		return 1;
 	}
 	input_init();
-	render_init();
+	// Waits for the assets, which are usually decoded by now.
+	jobs_deinit(&startup_jobs);
+	int is_render_ready = render_init(&assets, frame_allocator_alloc(&world.frame));
+	render_assets_deinit(&assets);
+	if (!is_render_ready) {
+		jobs_wait(&world.jobs);
+		world_deinit(&world);
+		context_deinit();
+		return 1;
+	}
 
-	world_run();
+	world_run(&world, start_time);
+	world_deinit(&world);
 	
 	context_deinit();
 	return 0;
@@ -0,0 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mesh_cache.h"
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define MESH_CACHE_USE_MMAP
+#endif
+
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_MIN_ENTRY_CAPACITY 256
+
+typedef struct MeshCacheHeader MeshCacheHeader;
+struct MeshCacheHeader
+{
+	u8 magic[4];
+	u32 version;
+	// Meshes of another vertex format are of no use.
+	u32 vertex_size;
+};
+
+typedef struct MeshCacheRecord MeshCacheRecord;
+struct MeshCacheRecord
+{
+	u64 key;
+	u32 count;
+	// Of the vertices, so a record torn by a crash is recognized.
+	u32 checksum;
+};
+
+static const u8 mesh_cache_magic[4] = {'C', 'M', 'M', 'C'};
+
+static u64 rotl64(u64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+u64 mesh_cache_hash(const void *data, size_t size, u64 seed)
+{
+	const u8 *bytes = data;
+	u64 h = seed ^ ((u64)size * 0x9e3779b97f4a7c15ull);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		u64 word;
+		memcpy(&word, bytes + i, sizeof(word));
+		h = rotl64(h ^ (word * 0x87c37b91114253d5ull), 31) * 0x4cf5ad432745937full;
+	}
+	for (; i < size; i++) h = (h ^ bytes[i]) * 0x100000001b3ull;
+	// Finalizer of splitmix64, so every input bit affects every output bit.
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+	return h ^ (h >> 31);
+}
+
+static u32 vertices_checksum(const void *items, u32 count)
+{
+	return (u32)mesh_cache_hash(items, count * sizeof(MeshVertex), 0);
+}
+
+static MeshCacheEntry *mesh_cache_find_entry(const MeshCache *cache, u64 key)
+{
+	size_t mask = cache->entry_capacity - 1;
+	size_t slot = (size_t)key & mask;
+	for (;;)
+	{
+		MeshCacheEntry *entry = &cache->entries[slot];
+		if (!entry->is_used || entry->key == key) return entry;
+		slot = (slot + 1) & mask;
+	}
+}
+
+static void mesh_cache_resize(MeshCache *cache, size_t capacity)
+{
+	MeshCacheEntry *old = cache->entries;
+	size_t old_capacity = cache->entry_capacity;
+	allocate(cache->alloc, (void**)&cache->entries, capacity * sizeof(MeshCacheEntry));
+	memset(cache->entries, 0, capacity * sizeof(MeshCacheEntry));
+	cache->entry_capacity = capacity;
+	for (size_t i = 0; i < old_capacity; i++)
+	{
+		if (old[i].is_used) *mesh_cache_find_entry(cache, old[i].key) = old[i];
+	}
+	if (old != NULL) deallocate(cache->alloc, (void**)&old);
+}
+
+static void mesh_cache_index(MeshCache *cache, MeshCacheEntry entry)
+{
+	if (2 * (cache->entry_count + 1) > cache->entry_capacity)
+	{
+		mesh_cache_resize(cache, 2 * cache->entry_capacity);
+	}
+	MeshCacheEntry *slot = mesh_cache_find_entry(cache, entry.key);
+	if (!slot->is_used) cache->entry_count++;
+	entry.is_used = true;
+	*slot = entry;
+}
+
+static bool mesh_cache_create_file(const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file) return false;
+	MeshCacheHeader header = {
+		.version = MESH_CACHE_VERSION,
+		.vertex_size = sizeof(MeshVertex),
+	};
+	memcpy(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic));
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	return fclose(file) == 0 && ok;
+}
+
+static void mesh_cache_unmap(MeshCache *cache)
+{
+	if (cache->data == NULL) return;
+#ifdef MESH_CACHE_USE_MMAP
+	munmap((void*)cache->data, cache->data_size);
+#else
+	deallocate(cache->alloc, (void**)&cache->data);
+#endif
+	cache->data = NULL;
+	cache->data_size = 0;
+}
+
+static bool mesh_cache_map(MeshCache *cache)
+{
+	if (fseek(cache->file, 0, SEEK_END)) return false;
+	long size = ftell(cache->file);
+	if (size < (long)sizeof(MeshCacheHeader)) return false;
+#ifdef MESH_CACHE_USE_MMAP
+	void *data = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, fileno(cache->file), 0);
+	if (data == MAP_FAILED) return false;
+	// Meshes are read once each, in no particular order.
+	posix_madvise(data, (size_t)size, POSIX_MADV_RANDOM);
+#else
+	u8 *data;
+	allocate(cache->alloc, (void**)&data, (size_t)size);
+	if (fseek(cache->file, 0, SEEK_SET) ||
+		fread(data, (size_t)size, 1, cache->file) != 1)
+	{
+		deallocate(cache->alloc, (void**)&data);
+		return false;
+	}
+#endif
+	cache->data = data;
+	cache->data_size = (size_t)size;
+	return true;
+}
+
+// Indexes the records up to the first one that is torn. Vertices are only
+// checked once they are used, so pages of unused meshes are never touched.
+static bool mesh_cache_scan(MeshCache *cache)
+{
+	MeshCacheHeader header;
+	memcpy(&header, cache->data, sizeof(header));
+	bool is_supported =
+		memcmp(header.magic, mesh_cache_magic, sizeof(mesh_cache_magic)) == 0 &&
+		header.version == MESH_CACHE_VERSION &&
+		header.vertex_size == sizeof(MeshVertex) &&
+		cache->data_size < MESH_CACHE_MAX_SIZE;
+	if (!is_supported) return false;
+
+	cache->end = sizeof(MeshCacheHeader);
+	while (cache->end + sizeof(MeshCacheRecord) <= cache->data_size)
+	{
+		MeshCacheRecord record;
+		memcpy(&record, cache->data + cache->end, sizeof(record));
+		u64 offset = cache->end + sizeof(MeshCacheRecord);
+		if ((cache->data_size - offset) / sizeof(MeshVertex) < record.count) break;
+		mesh_cache_index(cache, (MeshCacheEntry){
+			.key = record.key,
+			.is_mapped = true,
+			.count = record.count,
+			.checksum = record.checksum,
+			.offset = offset,
+		});
+		cache->end = offset + (u64)record.count * sizeof(MeshVertex);
+	}
+	return true;
+}
+
+static bool mesh_cache_open(MeshCache *cache)
+{
+	cache->file = fopen(cache->path, "r+b");
+	if (!cache->file)
+	{
+		if (!mesh_cache_create_file(cache->path)) return false;
+		cache->file = fopen(cache->path, "r+b");
+		if (!cache->file) return false;
+	}
+	if (mesh_cache_map(cache) && mesh_cache_scan(cache)) return true;
+	mesh_cache_unmap(cache);
+	fclose(cache->file);
+	cache->file = NULL;
+	return false;
+}
+
+bool mesh_cache_init(MeshCache *cache, const char *dir, Alloc *alloc)
+{
+	*cache = (MeshCache){
+		.alloc = alloc,
+	};
+	// Directories whose paths do not fit are refused rather than truncated.
+	int length = snprintf(cache->path, sizeof(cache->path), "%s/meshes.cache", dir);
+	if (length < 0 || length >= (int)sizeof(cache->path)) return false;
+	mesh_cache_resize(cache, MESH_CACHE_MIN_ENTRY_CAPACITY);
+	bool ok = mesh_cache_open(cache);
+	if (!ok)
+	{
+		// A cache that is full, outdated or unreadable is started over.
+		memset(cache->entries, 0, cache->entry_capacity * sizeof(MeshCacheEntry));
+		cache->entry_count = 0;
+		ok = mesh_cache_create_file(cache->path) && mesh_cache_open(cache);
+	}
+	// Records torn by a crash are overwritten.
+	ok = ok && fseek(cache->file, (long)cache->end, SEEK_SET) == 0;
+	if (!ok) mesh_cache_deinit(cache);
+	return ok;
+}
+
+void mesh_cache_deinit(MeshCache *cache)
+{
+	mesh_cache_unmap(cache);
+	if (cache->file) fclose(cache->file);
+	deallocate(cache->alloc, (void**)&cache->entries);
+	*cache = (MeshCache){0};
+}
+
+bool mesh_cache_find(MeshCache *cache, u64 key, Mesh *mesh)
+{
+	MeshCacheEntry *entry = mesh_cache_find_entry(cache, key);
+	if (!entry->is_used || !entry->is_mapped) return false;
+	const u8 *items = cache->data + entry->offset;
+	if (!entry->is_verified)
+	{
+		if (vertices_checksum(items, entry->count) != entry->checksum)
+		{
+			// Built again instead, and not stored, since the key is taken.
+			entry->is_mapped = false;
+			return false;
+		}
+		entry->is_verified = true;
+	}
+	*mesh = mesh_create((const MeshVertex*)items, (GLsizei)entry->count);
+	return true;
+}
+
+void mesh_cache_insert(MeshCache *cache, u64 key, const MeshVertex *items, GLsizei count)
+{
+	if (cache->file == NULL) return;
+	if (mesh_cache_find_entry(cache, key)->is_used) return;
+	u64 size = sizeof(MeshCacheRecord) + (u64)count * sizeof(MeshVertex);
+	if (cache->end + size > MESH_CACHE_MAX_SIZE) return;
+	MeshCacheRecord record = {
+		.key = key,
+		.count = (u32)count,
+		.checksum = vertices_checksum(items, (u32)count),
+	};
+	bool ok =
+		fwrite(&record, sizeof(record), 1, cache->file) == 1 &&
+		(count == 0 || fwrite(items, count * sizeof(MeshVertex), 1, cache->file) == 1);
+	if (!ok)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tFailed to write mesh cache '%s', meshes are no longer cached.\n",
+			cache->path);
+		fclose(cache->file);
+		cache->file = NULL;
+		return;
+	}
+	mesh_cache_index(cache, (MeshCacheEntry){
+		.key = key,
+		.count = (u32)count,
+		.checksum = record.checksum,
+	});
+	cache->end += size;
+}
@@ -0,0 +1,124 @@
+#include "mesh_pool.h"
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#define MESH_POOL_MIN_TABLE_CAPACITY 64
+
+// Returns the table slot of the entry with `key`, or of the empty slot it would take.
+static size_t table_find(const MeshPool *pool, u64 key)
+{
+	size_t mask = pool->table_capacity - 1;
+	size_t slot = (size_t)key & mask;
+	while (pool->table[slot] != 0)
+	{
+		if (pool->entries[pool->table[slot] - 1].key == key) break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static void table_resize(MeshPool *pool, size_t capacity)
+{
+	u32 *old = pool->table;
+	size_t old_capacity = pool->table_capacity;
+	allocate(pool->alloc, (void**)&pool->table, capacity * sizeof(u32));
+	memset(pool->table, 0, capacity * sizeof(u32));
+	pool->table_capacity = capacity;
+	for (size_t i = 0; i < old_capacity; i++)
+	{
+		if (old[i] == 0) continue;
+		pool->table[table_find(pool, pool->entries[old[i] - 1].key)] = old[i];
+	}
+	if (old != NULL) deallocate(pool->alloc, (void**)&old);
+}
+
+// Shifts the following entries back into the slot, so lookups never
+// stop early at it.
+static void table_remove(MeshPool *pool, size_t slot)
+{
+	size_t mask = pool->table_capacity - 1;
+	size_t hole = slot;
+	for (size_t i = (slot + 1) & mask; pool->table[i] != 0; i = (i + 1) & mask)
+	{
+		size_t home = (size_t)pool->entries[pool->table[i] - 1].key & mask;
+		if (((i - home) & mask) < ((i - hole) & mask)) continue;
+		pool->table[hole] = pool->table[i];
+		hole = i;
+	}
+	pool->table[hole] = 0;
+}
+
+void mesh_pool_init(MeshPool *pool, Alloc *alloc)
+{
+	*pool = (MeshPool){
+		.alloc = alloc,
+		.free_entry = MESH_POOL_NONE,
+	};
+	table_resize(pool, MESH_POOL_MIN_TABLE_CAPACITY);
+}
+
+void mesh_pool_deinit(MeshPool *pool)
+{
+	ASSERT(pool->entry_count == 0);
+	if (pool->entries) deallocate(pool->alloc, (void**)&pool->entries);
+	deallocate(pool->alloc, (void**)&pool->table);
+	*pool = (MeshPool){0};
+}
+
+u32 mesh_pool_acquire(MeshPool *pool, u64 key)
+{
+	size_t slot = table_find(pool, key);
+	if (pool->table[slot] == 0) return MESH_POOL_NONE;
+	u32 handle = pool->table[slot] - 1;
+	pool->entries[handle].refs++;
+	return handle;
+}
+
+u32 mesh_pool_insert(MeshPool *pool, u64 key, Mesh mesh)
+{
+	if (2 * (pool->entry_count + 1) > pool->table_capacity)
+	{
+		table_resize(pool, 2 * pool->table_capacity);
+	}
+	size_t slot = table_find(pool, key);
+	ASSERT(pool->table[slot] == 0);
+
+	u32 handle = pool->free_entry;
+	if (handle != MESH_POOL_NONE)
+	{
+		pool->free_entry = pool->entries[handle].next_free;
+	}
+	else
+	{
+		// Entries are only freed onto the list, so without free ones all are taken.
+		if (pool->entry_count == pool->entry_capacity)
+		{
+			pool->entry_capacity = pool->entry_capacity ? 2 * pool->entry_capacity : 64;
+			reallocate(pool->alloc, (void**)&pool->entries, pool->entry_capacity * sizeof(MeshPoolEntry));
+		}
+		handle = (u32)pool->entry_count;
+	}
+	pool->entries[handle] = (MeshPoolEntry){
+		.key = key,
+		.mesh = mesh,
+		.refs = 1,
+		.next_free = MESH_POOL_NONE,
+		.first_instance = MESH_POOL_NONE,
+	};
+	pool->table[slot] = handle + 1;
+	pool->entry_count++;
+	return handle;
+}
+
+void mesh_pool_release(MeshPool *pool, u32 handle)
+{
+	MeshPoolEntry *entry = &pool->entries[handle];
+	ASSERT(entry->refs > 0);
+	if (--entry->refs > 0) return;
+	mesh_deinit(&entry->mesh);
+	table_remove(pool, table_find(pool, entry->key));
+	entry->next_free = pool->free_entry;
+	pool->free_entry = handle;
+	pool->entry_count--;
+}
@@ -5,6 +5,11 @@
 #include <assert.h>
 #define ASSERT(x) assert(x)
 
+static inline int fast_floor(float x)
+{
+	int i = (int)x;
+	return (x < (float)i) ? i - 1 : i;
+}
 static inline float fade(float t)
 {
 	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
@@ -62,12 +67,15 @@ void perlin_init(Perlin* perlin, uint32_t seed)
 float perlin3(const Perlin *perlin, float x, float y, float z)
 {
 	ASSERT(perlin != NULL);
-	size_t xi = ((size_t)x) & (PERLIN_ARRAY_SIZE - 1);
-	size_t yi = ((size_t)y) & (PERLIN_ARRAY_SIZE - 1);
-	size_t zi = ((size_t)z) & (PERLIN_ARRAY_SIZE - 1);
-	x = x - ((size_t)x);
-	y = y - ((size_t)y);
-	z = z - ((size_t)z);
+	int xf = fast_floor(x);
+	int yf = fast_floor(y);
+	int zf = fast_floor(z);
+	size_t xi = (size_t)xf & (PERLIN_ARRAY_SIZE - 1);
+	size_t yi = (size_t)yf & (PERLIN_ARRAY_SIZE - 1);
+	size_t zi = (size_t)zf & (PERLIN_ARRAY_SIZE - 1);
+	x = x - (float)xf;
+	y = y - (float)yf;
+	z = z - (float)zf;
 	float u = fade(x);
 	float v = fade(y);
 	float w = fade(z);
@@ -98,10 +106,12 @@ float perlin3(const Perlin *perlin, float x, float y, float z)
 float perlin2(const Perlin *perlin, float x, float y)
 {
 	ASSERT(perlin != NULL);
-	size_t xi = ((size_t)x) & (PERLIN_ARRAY_SIZE - 1);
-	size_t yi = ((size_t)y) & (PERLIN_ARRAY_SIZE - 1);
-	x = x - (size_t)x;
-	y = y - (size_t)y;
+	int xf = fast_floor(x);
+	int yf = fast_floor(y);
+	size_t xi = (size_t)xf & (PERLIN_ARRAY_SIZE - 1);
+	size_t yi = (size_t)yf & (PERLIN_ARRAY_SIZE - 1);
+	x = x - (float)xf;
+	y = y - (float)yf;
 	float u = fade(x);
 	float v = fade(y);
 	size_t a = perlin->p[xi] + yi;
@@ -121,8 +131,9 @@ float perlin2(const Perlin *perlin, float x, float y)
 float perlin1(const Perlin *perlin, float x)
 {
 	ASSERT(perlin != NULL);
-	size_t xi = ((size_t)x) & (PERLIN_ARRAY_SIZE - 1);
-	x = x - ((size_t)x);
+	int xf = fast_floor(x);
+	size_t xi = (size_t)xf & (PERLIN_ARRAY_SIZE - 1);
+	x = x - (float)xf;
 	float u = fade(x);
 	
 	return (lerp(u, 
@@ -131,6 +142,116 @@ float perlin1(const Perlin *perlin, float x)
 	) + 1.0f) / 2.0f;
 }
 
+static const float simplex_grad2_table[8][2] = {
+	{ 1.0f,  2.0f}, {-1.0f,  2.0f}, { 1.0f, -2.0f}, {-1.0f, -2.0f},
+	{ 2.0f,  1.0f}, {-2.0f,  1.0f}, { 2.0f, -1.0f}, {-2.0f, -1.0f},
+};
+static inline float simplex_grad2(uint8_t hash, float x, float y)
+{
+	const float *g = simplex_grad2_table[hash & 7];
+	return g[0] * x + g[1] * y;
+}
+static inline float simplex_corner2(uint8_t hash, float x, float y)
+{
+	float t = 0.5f - x * x - y * y;
+	t = (t < 0.0f) ? 0.0f : t * t;
+	return t * t * simplex_grad2(hash, x, y);
+}
+// Same gradients as `grad3`, but without branching on the hash.
+static const float simplex_grad3_table[16][3] = {
+	{ 1,  1,  0}, {-1,  1,  0}, { 1, -1,  0}, {-1, -1,  0},
+	{ 1,  0,  1}, {-1,  0,  1}, { 1,  0, -1}, {-1,  0, -1},
+	{ 0,  1,  1}, { 0, -1,  1}, { 0,  1, -1}, { 0, -1, -1},
+	{ 1,  1,  0}, { 0, -1,  1}, {-1,  1,  0}, { 0, -1, -1},
+};
+static inline float simplex_corner3(uint8_t hash, float x, float y, float z)
+{
+	float t = 0.6f - x * x - y * y - z * z;
+	t = (t < 0.0f) ? 0.0f : t * t;
+	const float *g = simplex_grad3_table[hash & 15];
+	return t * t * (g[0] * x + g[1] * y + g[2] * z);
+}
+
+#define SIMPLEX_F2 0.366025403f  // (sqrt(3) - 1) / 2
+#define SIMPLEX_G2 0.211324865f  // (3 - sqrt(3)) / 6
+#define SIMPLEX_F3 (1.0f / 3.0f)
+#define SIMPLEX_G3 (1.0f / 6.0f)
+
+float simplex3(const Perlin *perlin, float x, float y, float z)
+{
+	ASSERT(perlin != NULL);
+	// Skew the input space to find the containing simplex cell.
+	float s = (x + y + z) * SIMPLEX_F3;
+	int i = fast_floor(x + s);
+	int j = fast_floor(y + s);
+	int k = fast_floor(z + s);
+	float t = (float)(i + j + k) * SIMPLEX_G3;
+	float x0 = x - ((float)i - t);
+	float y0 = y - ((float)j - t);
+	float z0 = z - ((float)k - t);
+
+	// Find which of the six tetrahedra of the cube contains the point,
+	// the offsets of its corners follow the ranking of the coordinates.
+	int xy = x0 >= y0;
+	int yz = y0 >= z0;
+	int xz = x0 >= z0;
+	int i1 = xy & xz;
+	int j1 = (!xy) & yz;
+	int k1 = (!yz) & (!xz);
+	int i2 = xy | xz;
+	int j2 = (!xy) | yz;
+	int k2 = !(xz & yz);
+
+	float x1 = x0 - (float)i1 + SIMPLEX_G3;
+	float y1 = y0 - (float)j1 + SIMPLEX_G3;
+	float z1 = z0 - (float)k1 + SIMPLEX_G3;
+	float x2 = x0 - (float)i2 + 2.0f * SIMPLEX_G3;
+	float y2 = y0 - (float)j2 + 2.0f * SIMPLEX_G3;
+	float z2 = z0 - (float)k2 + 2.0f * SIMPLEX_G3;
+	float x3 = x0 - 1.0f + 3.0f * SIMPLEX_G3;
+	float y3 = y0 - 1.0f + 3.0f * SIMPLEX_G3;
+	float z3 = z0 - 1.0f + 3.0f * SIMPLEX_G3;
+
+	size_t ii = (size_t)i & (PERLIN_ARRAY_SIZE - 1);
+	size_t jj = (size_t)j & (PERLIN_ARRAY_SIZE - 1);
+	size_t kk = (size_t)k & (PERLIN_ARRAY_SIZE - 1);
+	const uint8_t *p = perlin->p;
+	float n =
+		simplex_corner3(p[ii + p[jj + p[kk]]], x0, y0, z0) +
+		simplex_corner3(p[ii + i1 + p[jj + j1 + p[kk + k1]]], x1, y1, z1) +
+		simplex_corner3(p[ii + i2 + p[jj + j2 + p[kk + k2]]], x2, y2, z2) +
+		simplex_corner3(p[ii + 1 + p[jj + 1 + p[kk + 1]]], x3, y3, z3);
+	return (32.0f * n + 1.0f) / 2.0f;
+}
+float simplex2(const Perlin *perlin, float x, float y)
+{
+	ASSERT(perlin != NULL);
+	float s = (x + y) * SIMPLEX_F2;
+	int i = fast_floor(x + s);
+	int j = fast_floor(y + s);
+	float t = (float)(i + j) * SIMPLEX_G2;
+	float x0 = x - ((float)i - t);
+	float y0 = y - ((float)j - t);
+
+	// Lower or upper triangle of the skewed square.
+	int i1 = x0 > y0;
+	int j1 = !i1;
+
+	float x1 = x0 - (float)i1 + SIMPLEX_G2;
+	float y1 = y0 - (float)j1 + SIMPLEX_G2;
+	float x2 = x0 - 1.0f + 2.0f * SIMPLEX_G2;
+	float y2 = y0 - 1.0f + 2.0f * SIMPLEX_G2;
+
+	size_t ii = (size_t)i & (PERLIN_ARRAY_SIZE - 1);
+	size_t jj = (size_t)j & (PERLIN_ARRAY_SIZE - 1);
+	const uint8_t *p = perlin->p;
+	float n =
+		simplex_corner2(p[ii + p[jj]], x0, y0) +
+		simplex_corner2(p[ii + i1 + p[jj + j1]], x1, y1) +
+		simplex_corner2(p[ii + 1 + p[jj + 1]], x2, y2);
+	return (40.0f * n + 1.0f) / 2.0f;
+}
+
 float fbm3(
 	const Perlin *perlin,
 	Fbm fbm,
@@ -140,8 +261,10 @@ float fbm3(
 	float result = 0.0f;
 	float frequency = fbm.frequency;
 	float intensity = fbm.intensity;
+	float (*noise)(const Perlin *, float, float, float) = perlin3;
+	if (fbm.noise == fbm_noise_simplex) noise = simplex3;
 	for (int octave = 0; octave < fbm.octave_count; octave++) {
-		result += perlin3(
+		result += noise(
 			perlin, 
 			x * frequency,
 			y * frequency,
@@ -161,8 +284,10 @@ float fbm2(
 	float result = 0.0f;
 	float frequency = fbm.frequency;
 	float intensity = fbm.intensity;
+	float (*noise)(const Perlin *, float, float) = perlin2;
+	if (fbm.noise == fbm_noise_simplex) noise = simplex2;
 	for (int octave = 0; octave < fbm.octave_count; octave++) {
-		result += perlin2(
+		result += noise(
 			perlin,
 			x * frequency,
 			y * frequency
@@ -0,0 +1,174 @@
+#include "program_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#define PROGRAM_CACHE_VERSION 1
+#define PROGRAM_CACHE_PATH_CAPACITY 256
+
+typedef struct ProgramCacheHeader ProgramCacheHeader;
+struct ProgramCacheHeader
+{
+	u8 magic[4];
+	u32 version;
+	u64 key;
+	u32 format;
+	u32 size;
+};
+
+static const u8 program_cache_magic[4] = {'C', 'M', 'P', 'B'};
+
+static u64 fnv1a64(u64 hash, const void *data, size_t size)
+{
+	const u8 *bytes = data;
+	for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+	return hash;
+}
+
+// Hashes a string along with its terminator, so strings next to each
+// other cannot be told apart by where one of them ends.
+static u64 fnv1a64_string(u64 hash, const char *string)
+{
+	if (!string) string = "";
+	return fnv1a64(hash, string, strlen(string) + 1);
+}
+
+static int make_dir(const char *path)
+{
+#if defined(_WIN32)
+	int result = _mkdir(path);
+#else
+	int result = mkdir(path, 0755);
+#endif
+	return result == 0 || errno == EEXIST;
+}
+
+static int program_cache_path(char *path, const char *name)
+{
+	int length = snprintf(path, PROGRAM_CACHE_PATH_CAPACITY, "%s/%s.bin", PROGRAM_CACHE_DIR, name);
+	return length > 0 && length < PROGRAM_CACHE_PATH_CAPACITY;
+}
+
+bool program_cache_is_supported(void)
+{
+	if (!GLAD_GL_VERSION_4_1) return false;
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	return format_count > 0;
+}
+
+u64 program_cache_key(const char *const *sources, size_t count)
+{
+	u64 hash = 0xcbf29ce484222325ull;
+	hash = fnv1a64_string(hash, (const char*)glGetString(GL_VENDOR));
+	hash = fnv1a64_string(hash, (const char*)glGetString(GL_RENDERER));
+	hash = fnv1a64_string(hash, (const char*)glGetString(GL_VERSION));
+	for (size_t i = 0; i < count; i++) hash = fnv1a64_string(hash, sources[i]);
+	return hash;
+}
+
+GLuint program_cache_load(const char *name, u64 key)
+{
+	char path[PROGRAM_CACHE_PATH_CAPACITY];
+	if (!program_cache_path(path, name)) return 0;
+	FILE *file = fopen(path, "rb");
+	if (!file) return 0;
+
+	GLuint prog = 0;
+	void *binary = NULL;
+	ProgramCacheHeader header;
+	if (!fread(&header, sizeof(header), 1, file)) goto done;
+	if (memcmp(header.magic, program_cache_magic, sizeof(program_cache_magic)) ||
+		header.version != PROGRAM_CACHE_VERSION ||
+		header.key != key ||
+		header.size == 0) goto done;
+	binary = malloc(header.size);
+	if (!binary || !fread(binary, header.size, 1, file)) goto done;
+
+	prog = glCreateProgram();
+	if (!prog) goto done;
+	glProgramBinary(prog, (GLenum)header.format, binary, (GLsizei)header.size);
+	// Drivers may still reject binaries of their own, which are then
+	// linked from source again and replaced.
+	GLint success;
+	glGetProgramiv(prog, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glDeleteProgram(prog);
+		prog = 0;
+	}
+done:
+	free(binary);
+	fclose(file);
+	return prog;
+}
+
+void program_cache_store(const char *name, u64 key, GLuint program)
+{
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if (size <= 0) return;
+	void *binary = malloc((size_t)size);
+	if (!binary) return;
+	GLenum format;
+	glGetProgramBinary(program, size, &size, &format, binary);
+
+	char path[PROGRAM_CACHE_PATH_CAPACITY];
+	bool ok = program_cache_path(path, name);
+	// Creates every directory along the path.
+	char dir[PROGRAM_CACHE_PATH_CAPACITY];
+	snprintf(dir, sizeof(dir), "%s", PROGRAM_CACHE_DIR);
+	for (char *c = dir + 1; ok && *c; c++)
+	{
+		if (*c != '/') continue;
+		*c = 0;
+		ok = make_dir(dir);
+		*c = '/';
+	}
+	ok = ok && make_dir(dir);
+
+	// Written aside and renamed over the old one, so a crash never
+	// leaves a torn binary for the driver to load.
+	char tmp_path[PROGRAM_CACHE_PATH_CAPACITY + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *file = ok ? fopen(tmp_path, "wb") : NULL;
+	if (file)
+	{
+		ProgramCacheHeader header = {
+			.version = PROGRAM_CACHE_VERSION,
+			.key = key,
+			.format = format,
+			.size = (u32)size,
+		};
+		memcpy(header.magic, program_cache_magic, sizeof(program_cache_magic));
+		ok =
+			fwrite(&header, sizeof(header), 1, file) == 1 &&
+			fwrite(binary, (size_t)size, 1, file) == 1;
+		ok = fclose(file) == 0 && ok;
+		// Windows does not rename over existing files.
+		remove(path);
+		ok = ok && rename(tmp_path, path) == 0;
+		if (!ok) remove(tmp_path);
+	}
+	else
+	{
+		ok = false;
+	}
+	if (!ok)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tFailed to store a linked program.\n"
+			"\tpath = `%s`\n",
+			path);
+	}
+	free(binary);
+}
@@ -1,7 +1,12 @@
 #include "render.h"
+#include "block.h"
+#include "assets.h"
+#include "program_cache.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "config.h"
 
 #ifdef CMINE_ENABLE_GL_DEBUG
@@ -87,32 +92,68 @@ static void setup_gl_error_callback(void)
 #endif  // CMINE_ENABLE_GL_DEBUG
 }
 
-static char *read_entire_file(const char* filename) 
-{
-	FILE *f = fopen(filename, "rb");
-	if (!f) goto err0;
-	if (fseek(f, 0, SEEK_END)) goto err1;
-
-	size_t size = ftell(f);
-	if (fseek(f, 0, SEEK_SET)) goto err1;
+// Entry point of GL_KHR_parallel_shader_compile and of its ARB
+// counterpart, which glad is not generated with.
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
 
-	char *buf = malloc(size + 1);
-	if (!buf) goto err1;
-	if (!fread(buf, size, 1, f)) goto err2;
+static const GLenum shader_types[2] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
 
-	buf[size] = 0;
-	fclose(f);
-	return buf;
+static const struct
+{
+	const char *name;
+	const char *filenames[2];
+} shader_program_sources[render_program_count] = {
+	[render_program_chunk] = {"chunk", {"chunk_vsh.glsl", "chunk_fsh.glsl"}},
+	[render_program_quad] = {"quad", {"quad_vsh.glsl", "quad_fsh.glsl"}},
+};
+
+// Program whose shaders may still be compiling and linking in the driver.
+typedef struct ShaderProgramLoad ShaderProgramLoad;
+struct ShaderProgramLoad
+{
+	const char *name;
+	const char *filenames[2];
+	GLuint shaders[2];
+	GLuint prog;
+	u64 key;
+	bool use_cache;
+	bool is_cached;
+};
+
+static bool has_gl_extension(const char *name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char *extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (extension && !strcmp(extension, name)) return true;
+	}
+	return false;
+}
 
-err2:
-	free(buf);
-err1:
-	fclose(f);
-err0:
-	return NULL;
+// Lets the driver compile and link on threads of its own, so starting
+// a program returns at once and only querying its status waits for it.
+// Returns whether the driver does so.
+static bool setup_parallel_shader_compile(void)
+{
+	const char *function_name;
+	if (has_gl_extension("GL_KHR_parallel_shader_compile"))
+		function_name = "glMaxShaderCompilerThreadsKHR";
+	else if (has_gl_extension("GL_ARB_parallel_shader_compile"))
+		function_name = "glMaxShaderCompilerThreadsARB";
+	else
+		return false;
+	GLLoaderFunPtr loader = context_gl_loader();
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_shader_compiler_threads =
+		loader ? (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader(function_name) : NULL;
+	if (!max_shader_compiler_threads) return false;
+	// As many threads as the driver likes.
+	max_shader_compiler_threads(0xFFFFFFFFu);
+	return true;
 }
 
-static GLuint load_shader(const char* filename, GLuint shader_type)
+static GLuint compile_shader(const char *source, GLenum shader_type)
 {
 	GLuint shader = glCreateShader(shader_type);
 	if (!shader) 
@@ -124,33 +165,26 @@ static GLuint load_shader(const char* filename, GLuint shader_type)
 			"\tshader_type = `0x%x`\n",
 			shader_type
 		);
-		goto err0;
+		return 0;
 	}
-
-	char *source = read_entire_file(filename);
-	if (!source)
-	{
-		fprintf(
-			stderr,
-			"\nCaught runtime error:\n"
-			"\tUnable to locate shader.\n"
-			"\tpath = `%s`\n",
-			filename
-		);
-		goto err1;
-	}
-
-	const char *const tmp = source;  // ???
-	glShaderSource(shader, 1, &tmp, NULL);
+	glShaderSource(shader, 1, &source, NULL);
 	glCompileShader(shader);
+	return shader;
+}
+
+// Waits for a shader to compile, and reports it if it failed to.
+static bool check_shader(GLuint shader, const char *filename, GLenum shader_type, Alloc *scratch)
+{
+	if (!shader) return false;
 	GLint success;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-	free(source);
 	if (!success) 
 	{
 		GLint size = 0;
 		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &size);
-		char *log = malloc(size);
+		char *log;
+		allocate(scratch, (void**)&log, (size_t)size + 1);
+		log[0] = 0;
 		glGetShaderInfoLog(shader, size, NULL, log);
 		fprintf(
 			stderr,
@@ -162,19 +196,17 @@ static GLuint load_shader(const char* filename, GLuint shader_type)
 			shader_type,
 			filename,
 			log);
-		free(log);
-		goto err1;
+		deallocate(scratch, (void**)&log);
+		return false;
 	}
-
-	return shader;
-err1:
-	glDeleteShader(shader);
-err0:
-	return 0;
+	return true;
 }
 
-static GLuint link_shader_program(GLuint vertex, GLuint fragment)
+// Starts linking a program from shaders that may still be compiling.
+// A retrievable program can be stored in the program cache afterwards.
+static GLuint link_shader_program(const GLuint shaders[2], bool retrievable)
 {
+	if (!shaders[0] || !shaders[1]) return 0;
 	GLuint prog = glCreateProgram();
 	if (!prog) 
 	{
@@ -182,67 +214,103 @@ static GLuint link_shader_program(GLuint vertex, GLuint fragment)
 			stderr,
 			"\nCaught runtime error:\n"
 			"\tOpenGL failed to create a shader program.\n");
-		goto err0;
+		return 0;
 	}
 
-	glAttachShader(prog, vertex);
-	glAttachShader(prog, fragment);
+	glAttachShader(prog, shaders[0]);
+	glAttachShader(prog, shaders[1]);
+	if (retrievable) glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	glLinkProgram(prog);
+	return prog;
+}
+
+// Waits for a program to link, and reports it if it failed to.
+static bool check_shader_program(GLuint prog, Alloc *scratch)
+{
 	GLint success;
 	glGetProgramiv(prog, GL_LINK_STATUS, &success);
 	if (!success) 
 	{
 		GLint size = 0;
 		glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &size);
-		char *log = malloc(size);
-		const char *print_log;
-		if (log) 
-		{
-			glGetProgramInfoLog(prog, size, NULL, log);
-			print_log = log;
-		}
-		else
-		{
-			print_log = "[unable to allocate info log]";
-		}
+		char *log;
+		allocate(scratch, (void**)&log, (size_t)size + 1);
+		log[0] = 0;
+		glGetProgramInfoLog(prog, size, NULL, log);
 		fprintf(
 			stderr,
 			"\nCaught runtime error:\n"
 			"\tOpenGL failed to link a shader program.\n"
 			"\tInfo log = `%s`\n",
-			print_log);
-		free(log);
-		goto err1;
+			log);
+		deallocate(scratch, (void**)&log);
+		return false;
 	}
-
-	return prog;
-err1: 
-	glDeleteProgram(prog);
-err0:
-	return 0;
+	return true;
 }
 
-static GLuint load_shader_program(
-	const char* vertext_filename, 
-	const char* fragment_filename) 
+static char *load_shader_source(const char *filename)
 {
-	GLuint vsh = load_shader(vertext_filename, GL_VERTEX_SHADER);
-	if (!vsh) goto err0;
-	GLuint fsh = load_shader(fragment_filename, GL_FRAGMENT_SHADER);
-	if (!fsh) goto err1;
-	GLuint prog = link_shader_program(vsh, fsh);
-	if (!prog) goto err2;
+	char *source = assets_read_text(filename);
+	if (!source)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tUnable to locate shader.\n"
+			"\tname = `%s`\n",
+			filename
+		);
+	}
+	return source;
+}
 
-	glDeleteShader(fsh);
-	glDeleteShader(vsh);
+// Takes the program from the program cache when the driver still has it,
+// and starts compiling and linking it from source otherwise. No status is
+// queried, so the driver may work on every program at once.
+static void start_shader_program(ShaderProgramLoad *load, RenderProgram program, char *const sources[2])
+{
+	*load = (ShaderProgramLoad){
+		.name = shader_program_sources[program].name,
+		.filenames = {
+			shader_program_sources[program].filenames[0],
+			shader_program_sources[program].filenames[1],
+		},
+	};
+#ifdef CMINE_ENABLE_PROGRAM_CACHE
+	load->use_cache = program_cache_is_supported();
+	if (load->use_cache)
+	{
+		load->key = program_cache_key((const char *const*)sources, 2);
+		load->prog = program_cache_load(load->name, load->key);
+		load->is_cached = load->prog != 0;
+		if (load->is_cached) return;
+	}
+#endif  // CMINE_ENABLE_PROGRAM_CACHE
+	for (int i = 0; i < 2; i++) load->shaders[i] = compile_shader(sources[i], shader_types[i]);
+	load->prog = link_shader_program(load->shaders, load->use_cache);
+}
 
-	return prog;
-err2:
-	glDeleteShader(fsh);
-err1:
-	glDeleteShader(vsh);
-err0:
-	return 0;
+// Waits for a started program. Returns 0 if it failed to compile or link.
+static GLuint finish_shader_program(ShaderProgramLoad *load, Alloc *scratch)
+{
+	if (load->is_cached) return load->prog;
+	bool ok = load->prog != 0;
+	for (int i = 0; i < 2; i++)
+	{
+		ok = check_shader(load->shaders[i], load->filenames[i], shader_types[i], scratch) && ok;
+		glDeleteShader(load->shaders[i]);
+	}
+	ok = ok && check_shader_program(load->prog, scratch);
+	if (!ok)
+	{
+		glDeleteProgram(load->prog);
+		return 0;
+	}
+#ifdef CMINE_ENABLE_PROGRAM_CACHE
+	if (load->use_cache) program_cache_store(load->name, load->key, load->prog);
+#endif  // CMINE_ENABLE_PROGRAM_CACHE
+	return load->prog;
 }
 
 GLuint load_pixel_texture(const Image *image)
@@ -256,6 +324,15 @@ GLuint load_pixel_texture(const Image *image)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 
+	// Pixels are passed in the order they are stored, so the driver
+	// swizzles them, if it has to, while uploading.
+	GLenum format;
+	switch (image->format)
+	{
+	case image_format_bgr:  format = GL_BGR;  break;
+	case image_format_bgra: format = GL_BGRA; break;
+	default:                format = GL_RGBA; break;
+	}
 	glTexImage2D(
 		GL_TEXTURE_2D,
 		0,
@@ -263,7 +340,7 @@ GLuint load_pixel_texture(const Image *image)
 		image->width,
 		image->height,
 		0, 
-		GL_RGBA,
+		format,
 		GL_UNSIGNED_BYTE,
 		image->pixels
 	);
@@ -280,9 +357,102 @@ static struct
 		GLuint prog;
 	} quad;
 	GLuint tmp_texture;
+	GLuint block_textures;
 	GLuint chunk_shader_prog;
+	// Programs started by `render_init`, until their first use.
+	ShaderProgramLoad program_loads[render_program_count];
+	bool is_loading_programs;
+	// Holds the info logs of programs that fail to compile.
+	Alloc *scratch;
+	bool has_parallel_shader_compile;
+	f64 programs_start;
 } render;
 
+// Deletes the programs started by `render_init` without waiting for them,
+// along with their shaders. Loads that were never started are zeroed.
+static void discard_shader_programs(void)
+{
+	if (!render.is_loading_programs) return;
+	render.is_loading_programs = false;
+	for (RenderProgram i = 0; i < render_program_count; i++)
+	{
+		ShaderProgramLoad *load = &render.program_loads[i];
+		for (int j = 0; j < 2; j++)
+		{
+			if (load->shaders[j]) glDeleteShader(load->shaders[j]);
+		}
+		if (load->prog) glDeleteProgram(load->prog);
+		*load = (ShaderProgramLoad){0};
+	}
+}
+
+// Waits for the programs started by `render_init`.
+static void finish_shader_programs(void)
+{
+	if (!render.is_loading_programs) return;
+	render.is_loading_programs = false;
+	GLuint *progs[render_program_count] = {
+		[render_program_chunk] = &render.chunk_shader_prog,
+		[render_program_quad] = &render.quad.prog,
+	};
+	int cached_count = 0;
+	for (RenderProgram i = 0; i < render_program_count; i++)
+	{
+		*progs[i] = finish_shader_program(&render.program_loads[i], render.scratch);
+		cached_count += render.program_loads[i].is_cached;
+	}
+	fprintf(
+		stderr,
+		"\nRecieved info:\n"
+		"\tLinked the shader programs.\n"
+		"\tMilliseconds since started = `%.2f`\n"
+		"\tFrom the program cache = `%d of %d`\n"
+		"\tParallel shader compile = `%s`\n",
+		(context_time() - render.programs_start) * 1000.0,
+		cached_count,
+		(int)render_program_count,
+		render.has_parallel_shader_compile ? "yes" : "no");
+}
+
+void render_assets_load(RenderAssets *assets)
+{
+	*assets = (RenderAssets){0};
+	for (RenderProgram i = 0; i < render_program_count; i++)
+	{
+		for (int k = 0; k < 2; k++)
+		{
+			assets->shader_sources[i][k] = load_shader_source(shader_program_sources[i].filenames[k]);
+		}
+	}
+
+	const char *atlas_name = "mc_atlas.bmp";
+	ImageError err = assets_load_image(&assets->atlas, atlas_name, std_allocator_alloc());
+	if (err != image_error_ok)
+	{
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tUnable to load the block atlas.\n"
+			"\tname = `%s`\n"
+			"\terror = `%d`\n",
+			atlas_name,
+			(int)err);
+		return;
+	}
+	assets->has_atlas = true;
+}
+
+void render_assets_deinit(RenderAssets *assets)
+{
+	for (RenderProgram i = 0; i < render_program_count; i++)
+	{
+		free(assets->shader_sources[i][0]);
+		free(assets->shader_sources[i][1]);
+	}
+	if (assets->has_atlas) image_deinit(&assets->atlas, std_allocator_alloc());
+	*assets = (RenderAssets){0};
+}
+
 void load_tmp_quad(GLuint vao) {
 	const u32 indices[] = {
 		0, 1, 3,
@@ -327,12 +497,104 @@ GLuint load_tmp_texture(void) {
 	const Image image = {
 		.width = 2,
 		.height = 2,
+		.format = image_format_rgba,
 		.pixels = tmp_colors,
 	};
 	return load_pixel_texture(&image);
 }
 
-int render_init(void) {
+// Slices the atlas into a texture array, one layer per `AtlasTexture`.
+// Every layer gets mipmaps of its own, so neighboring tiles never bleed
+// into each other, and textures can repeat across faces of many blocks.
+static GLuint load_block_textures(const Image *atlas)
+{
+	size_t sidelen = atlas->width / ATLAS_TILES_PER_SIDE;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	glTexImage3D(
+		GL_TEXTURE_2D_ARRAY,
+		0,
+		GL_RGB8,
+		sidelen,
+		sidelen,
+		atlas_count,
+		0,
+		GL_RGBA,
+		GL_UNSIGNED_BYTE,
+		NULL
+	);
+
+	GLenum format;
+	switch (atlas->format)
+	{
+	case image_format_bgr:  format = GL_BGR;  break;
+	case image_format_bgra: format = GL_BGRA; break;
+	default:                format = GL_RGBA; break;
+	}
+	// Tiles are read straight out of the atlas, whose rows go from the bottom up.
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)atlas->width);
+	for (AtlasTexture i = 0; i < atlas_count; i++)
+	{
+		AtlasTile tile;
+		if (atlas_texture_tile(i, &tile))
+		{
+			glPixelStorei(GL_UNPACK_SKIP_PIXELS, (GLint)(tile.x * sidelen));
+			glPixelStorei(GL_UNPACK_SKIP_ROWS, (GLint)(atlas->height - (tile.y + 1) * sidelen));
+			glTexSubImage3D(
+				GL_TEXTURE_2D_ARRAY,
+				0,
+				0, 0, i,
+				sidelen, sidelen, 1,
+				format,
+				GL_UNSIGNED_BYTE,
+				atlas->pixels
+			);
+			continue;
+		}
+		// Textures without a tile get the checkers of the temporary texture.
+		const Color32 colors[4] = {
+			COLOR32_BLUE, COLOR32_GREEN,
+			COLOR32_PINK, COLOR32_BLACK,
+		};
+		Color32 *checkers = malloc(sidelen * sidelen * sizeof(Color32));
+		if (!checkers) abort();
+		for (size_t y = 0; y < sidelen; y++)
+			for (size_t x = 0; x < sidelen; x++)
+			{
+				checkers[y * sidelen + x] = colors[(y * 2 / sidelen) * 2 + x * 2 / sidelen];
+			}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		glTexSubImage3D(
+			GL_TEXTURE_2D_ARRAY,
+			0,
+			0, 0, i,
+			sidelen, sidelen, 1,
+			GL_RGBA,
+			GL_UNSIGNED_BYTE,
+			checkers
+		);
+		free(checkers);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)atlas->width);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	return texture;
+}
+
+int render_init(const RenderAssets *assets, Alloc *scratch) {
 	// Initialize glad
 	if (!gladLoadGLLoader(context_gl_loader())) {
 		fprintf(stderr, "Failed to load OpenGL context.\n");
@@ -340,43 +602,45 @@ int render_init(void) {
 	}
 	setup_gl_error_callback();
 
+	// Initialize programs
+	// They are started first, so the driver compiles them while the
+	// textures are uploaded and the first chunks are meshed.
+	render.has_parallel_shader_compile = setup_parallel_shader_compile();
+	render.programs_start = context_time();
+	render.is_loading_programs = true;
+	render.scratch = scratch;
+	for (RenderProgram i = 0; i < render_program_count; i++)
+	{
+		render.program_loads[i] = (ShaderProgramLoad){0};
+	}
+	for (RenderProgram i = 0; i < render_program_count; i++)
+	{
+		if (!assets->shader_sources[i][0] || !assets->shader_sources[i][1]) goto err_programs;
+		start_shader_program(&render.program_loads[i], i, assets->shader_sources[i]);
+	}
+
 	// Initialize tmp_texture
 	render.tmp_texture = load_tmp_texture();
 
-	// Initialize chunk_shader_prog
-	{
-		const char* vertex_src = "./resources/chunk_vsh.glsl";
-		const char* fragment_src = "./resources/chunk_fsh.glsl";
-		render.chunk_shader_prog = load_shader_program(vertex_src, fragment_src);
-		if (!render.chunk_shader_prog) goto err_chunk_shader_prog;
-	}
+	// Initialize block_textures
+	if (!assets->has_atlas) goto err_block_textures;
+	render.block_textures = load_block_textures(&assets->atlas);
 
 	// Initialize quad
-	{
-		const char *vertex_src = "./resources/quad_vsh.glsl";
-		const char *fragment_src = "./resources/quad_fsh.glsl";
-		render.quad.prog = load_shader_program(vertex_src, fragment_src);
-		if (!render.quad.prog) goto err_quad_prog;
-
-		glGenVertexArrays(1, &render.quad.vao);
-		load_tmp_quad(render.quad.vao);
-	}
+	glGenVertexArrays(1, &render.quad.vao);
+	load_tmp_quad(render.quad.vao);
 	return 1;
-err_all:
-	glDeleteVertexArrays(1, &render.quad.vao);
-err_quad_vao:
-	glDeleteProgram(render.quad.prog);
-err_quad_prog:
-	glDeleteProgram(render.chunk_shader_prog);
-err_chunk_shader_prog:
+err_block_textures:
 	glDeleteTextures(1, &render.tmp_texture);
-err_tmp_texture:
+err_programs:
+	discard_shader_programs();
 err_glad:
 	return 0;
 }
 
 void render_draw_quad(GLuint texture, Mat4x4 transform)
 {
+	finish_shader_programs();
 	glUseProgram(render.quad.prog);
 
 	const char *transform_name = "transform";
@@ -403,56 +667,125 @@ GLuint render_tmp_texture(void)
 	return render.tmp_texture;
 }
 
+GLuint render_block_textures(void)
+{
+	return render.block_textures;
+}
+
 GLuint render_chunk_shader_program(void)
 {
+	finish_shader_programs();
 	return render.chunk_shader_prog;
 }
 
-void mb_init(MeshBuilder* mb)
+void mb_init(MeshBuilder* mb, Alloc* alloc)
 {
 	*mb = (MeshBuilder){
 		.count = 0,
 		.capacity = 0,
 		.items = NULL,
+		.alloc = alloc,
 	};
 }
 void mb_deinit(MeshBuilder* mb)
 {
-	free(mb->items);
+	if (mb->items != NULL) deallocate(mb->alloc, (void**)&mb->items);
 }
-Mesh mb_create(const MeshBuilder* mb)
+void mb_clear(MeshBuilder* mb)
+{
+	mb->count = 0;
+}
+// Creates a vertex array reading `MeshVertex`es from the bound array buffer.
+static GLuint mesh_vao_create(GLuint vbo)
 {
 	GLuint vao;
 	glGenVertexArrays(1, &vao);
-	GLuint vbo;
-	glGenBuffers(1, &vbo);
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, mb->count * sizeof(MeshVertex), mb->items, GL_STATIC_DRAW);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)0);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)sizeof(Vec3));
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, pos));
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, uv));
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, layer));
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(3);
 	glBindVertexArray(0);
+	return vao;
+}
+Mesh mesh_create(const MeshVertex* items, GLsizei count)
+{
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(MeshVertex), items, GL_STATIC_DRAW);
+	GLuint vao = mesh_vao_create(vbo);
 	glDeleteBuffers(1, &vbo);
 	Mesh mesh = {
 		.vao = vao,
-		.count = mb->count,
+		.count = count,
 	};
 	return mesh;
 }
+Mesh mb_create(const MeshBuilder* mb)
+{
+	return mesh_create(mb->items, mb->count);
+}
+MeshVertex* mb_push(MeshBuilder* mb, GLsizei count)
+{
+	if (mb->count > mb->capacity - count)
+	{
+		GLsizei capacity = (mb->capacity == 0) ? 1 : mb->capacity;
+		while (capacity < mb->count + count) capacity *= 2;
+		reallocate(mb->alloc, (void**)&mb->items, sizeof(MeshVertex) * capacity);
+		mb->capacity = capacity;
+	}
+	MeshVertex* result = &mb->items[mb->count];
+	mb->count += count;
+	return result;
+}
 void mb_append(MeshBuilder* mb, MeshVertex vertex)
 {
-	if (mb->count > mb->capacity - 1)
+	*mb_push(mb, 1) = vertex;
+}
+MeshVertex* mesh_writer_begin(MeshWriter* writer, GLsizei count)
+{
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(MeshVertex), NULL, GL_STATIC_DRAW);
+	MeshVertex* items = NULL;
+	if (count > 0)
 	{
-		mb->capacity = (mb->capacity == 0) ? 1 : mb->capacity * 2;
-		void* tmp = realloc(mb->items, sizeof(MeshVertex) * mb->capacity);
-		if (!tmp) abort();
-		mb->items = tmp;
+		items = glMapBufferRange(
+			GL_ARRAY_BUFFER,
+			0,
+			count * sizeof(MeshVertex),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		if (items == NULL) {
+			fprintf(stderr, "\nCaught runtime error:\n\tFailed to map a mesh buffer.\n");
+			abort();
+		}
 	}
-	mb->items[mb->count++] = vertex;
+	*writer = (MeshWriter){
+		.mesh = {
+			.count = count,
+		},
+		.vbo = vbo,
+		.items = items,
+	};
+	return items;
 }
-void mesh_draw(const Mesh* mesh, GLuint texture, Camera cam, Perspective p)
+Mesh mesh_writer_end(MeshWriter* writer)
+{
+	glBindBuffer(GL_ARRAY_BUFFER, writer->vbo);
+	// The buffer loses its contents if the display mode changes while it is mapped.
+	if (writer->items != NULL && glUnmapBuffer(GL_ARRAY_BUFFER) == GL_FALSE) writer->mesh.count = 0;
+	writer->mesh.vao = mesh_vao_create(writer->vbo);
+	glDeleteBuffers(1, &writer->vbo);
+	Mesh mesh = writer->mesh;
+	*writer = (MeshWriter){0};
+	return mesh;
+}
+Mat4x4 camera_transform(Camera cam, Perspective p)
 {
 	/*Mat ts = MAT_IDENTITY;
 	ts = mat_translate(ts, cam.pos);
@@ -465,9 +798,14 @@ void mesh_draw(const Mesh* mesh, GLuint texture, Camera cam, Perspective p)
 	);
 	Mat4x4 ts = mat4x3_to_transform(tmp);
 	ts = mat4x4_mul(ts, mat4x4_persp(p.aspect, p.fov_z_rad, p.near, p.far));  // DO WE POST-MULTIPLY???????
-	mesh_draw_matrix(mesh, texture, ts);
+	return ts;
 }
-void mesh_draw_matrix(const Mesh* mesh, GLuint texture, Mat4x4 transform)
+void mesh_draw(const Mesh* mesh, GLuint texture, Camera cam, Perspective p)
+{
+	mesh_draw_matrix(mesh, texture, camera_transform(cam, p));
+}
+// Binds the chunk shader program with the given transform.
+static bool use_chunk_shader_program(Mat4x4 transform)
 {
 	GLuint prog = render_chunk_shader_program();
 	glUseProgram(prog);
@@ -481,15 +819,53 @@ void mesh_draw_matrix(const Mesh* mesh, GLuint texture, Mat4x4 transform)
 			"\nCaught runtime error:\n"
 			"\nRenderer is unbale to find unform `%s` in chunk shader program",
 			transform_name);
-		return;
+		return false;
 	}
 	glUniformMatrix4fv(location, 1, GL_FALSE, transform.arr);
-
-	glBindTexture(GL_TEXTURE_2D, texture);
+	return true;
+}
+void mesh_draw_matrix(const Mesh* mesh, GLuint texture, Mat4x4 transform)
+{
+	if (!use_chunk_shader_program(transform)) return;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
 	glBindVertexArray(mesh->vao);
 	glDrawArrays(GL_TRIANGLES, 0, mesh->count);
 	glBindVertexArray(0);
 }
+void mesh_instances_deinit(MeshInstances* instances)
+{
+	if (instances->vbo != 0) glDeleteBuffers(1, &instances->vbo);
+	*instances = (MeshInstances){0};
+}
+void mesh_instances_upload(MeshInstances* instances, const Vec3OpenGL* offsets, GLsizei count)
+{
+	if (instances->vbo == 0) glGenBuffers(1, &instances->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, instances->vbo);
+	// Respecifying the whole buffer lets the driver orphan the one still in use.
+	glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vec3OpenGL), offsets, GL_STREAM_DRAW);
+}
+void mesh_draw_instances(
+	const Mesh* mesh,
+	GLuint texture,
+	Mat4x4 transform,
+	const MeshInstances* instances,
+	GLsizei first,
+	GLsizei count)
+{
+	if (!use_chunk_shader_program(transform)) return;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glBindVertexArray(mesh->vao);
+	// Pointing the attribute at the first instance does what a base
+	// instance would, which needs OpenGL 4.2.
+	glBindBuffer(GL_ARRAY_BUFFER, instances->vbo);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3OpenGL), (void*)(first * sizeof(Vec3OpenGL)));
+	glVertexAttribDivisor(2, 1);
+	glEnableVertexAttribArray(2);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, mesh->count, count);
+	// Meshes drawn once read the attribute's default offset of zero.
+	glDisableVertexAttribArray(2);
+	glBindVertexArray(0);
+}
 void mesh_deinit(Mesh* mesh)
 {
 	glDeleteVertexArrays(1, &mesh->vao);
@@ -0,0 +1,380 @@
+#include "residency.h"
+#include "saver.h"
+#include "codec.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#define RESIDENCY_MIN_TABLE_CAPACITY 64
+
+static size_t lod_cell_count(u8 lod)
+{
+	size_t sidelen = CHUNK_LOD_SIDELEN(lod);
+	return sidelen * sidelen * sidelen;
+}
+
+static size_t entry_bytes(const ResidencyEntry *entry)
+{
+	return sizeof(ResidencyEntry) + entry->size + (entry->prefetched ? sizeof(Chunk) : 0);
+}
+
+static u32 pos_hash(CPos pos)
+{
+	return (u32)pos.x * 73856093u ^ (u32)pos.y * 19349663u ^ (u32)pos.z * 83492791u;
+}
+
+static bool pos_equals(CPos a, CPos b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Waits for the workers before entries are changed or moved.
+static void residency_sync(Residency *residency)
+{
+	if (!residency->has_pending_jobs) return;
+	jobs_wait(residency->jobs);
+	residency->has_pending_jobs = false;
+}
+
+// Returns the table slot of the entry at `pos`, or of the empty slot it would take.
+static size_t table_find(const Residency *residency, CPos pos)
+{
+	size_t mask = residency->table_capacity - 1;
+	size_t slot = pos_hash(pos) & mask;
+	while (residency->table[slot] != 0)
+	{
+		if (pos_equals(residency->entries[residency->table[slot] - 1].pos, pos)) break;
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static void table_resize(Residency *residency, size_t capacity)
+{
+	u32 *old = residency->table;
+	size_t old_capacity = residency->table_capacity;
+	allocate(residency->alloc, (void**)&residency->table, capacity * sizeof(u32));
+	memset(residency->table, 0, capacity * sizeof(u32));
+	residency->table_capacity = capacity;
+	for (size_t i = 0; i < old_capacity; i++)
+	{
+		if (old[i] == 0) continue;
+		residency->table[table_find(residency, residency->entries[old[i] - 1].pos)] = old[i];
+	}
+	if (old != NULL) deallocate(residency->alloc, (void**)&old);
+}
+
+// Shifts the following entries back into the slot, so lookups never
+// stop early at it.
+static void table_remove(Residency *residency, size_t slot)
+{
+	size_t mask = residency->table_capacity - 1;
+	size_t hole = slot;
+	for (size_t i = (slot + 1) & mask; residency->table[i] != 0; i = (i + 1) & mask)
+	{
+		size_t home = pos_hash(residency->entries[residency->table[i] - 1].pos) & mask;
+		if (((i - home) & mask) < ((i - hole) & mask)) continue;
+		residency->table[hole] = residency->table[i];
+		hole = i;
+	}
+	residency->table[hole] = 0;
+}
+
+static void lru_unlink(Residency *residency, u32 idx)
+{
+	ResidencyEntry *entry = &residency->entries[idx];
+	if (entry->lru_prev != RESIDENCY_NONE) residency->entries[entry->lru_prev].lru_next = entry->lru_next;
+	else residency->lru_head = entry->lru_next;
+	if (entry->lru_next != RESIDENCY_NONE) residency->entries[entry->lru_next].lru_prev = entry->lru_prev;
+	else residency->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(Residency *residency, u32 idx)
+{
+	ResidencyEntry *entry = &residency->entries[idx];
+	entry->lru_prev = RESIDENCY_NONE;
+	entry->lru_next = residency->lru_head;
+	if (residency->lru_head != RESIDENCY_NONE) residency->entries[residency->lru_head].lru_prev = idx;
+	else residency->lru_tail = idx;
+	residency->lru_head = idx;
+}
+
+// Returns false if the cells are corrupted.
+static bool decode_entry(const ResidencyEntry *entry, Chunk *chunk, Alloc *alloc)
+{
+	chunk->lod = entry->lod;
+	return codec_decode_blocks(entry->data, entry->size, chunk->blocks, lod_cell_count(entry->lod), alloc);
+}
+
+static void prefetch_job_run(void *data)
+{
+	// The entry is stable, since the main thread waits for the jobs
+	// before it changes any entry.
+	ResidencyEntry *entry = data;
+	// The scratch of the calling thread is not thread safe.
+	entry->is_corrupted = !decode_entry(entry, entry->prefetched, std_allocator_alloc());
+}
+
+// Removes an entry at the given table slot without saving it.
+static void residency_remove(Residency *residency, size_t slot)
+{
+	u32 idx = residency->table[slot] - 1;
+	ResidencyEntry *entry = &residency->entries[idx];
+	residency->used -= entry_bytes(entry);
+	deallocate(residency->alloc, (void**)&entry->data);
+	if (entry->prefetched) deallocate(residency->alloc, (void**)&entry->prefetched);
+	table_remove(residency, slot);
+	if (!entry->is_saving) lru_unlink(residency, idx);
+	entry->lru_next = residency->free_entry;
+	residency->free_entry = idx;
+	residency->entry_count--;
+}
+
+// Removes the entry, unless it was edited. Then the saver is handed its
+// cells, and it stays until it is saved, so the chunk is not read back
+// from the journal without its latest edits meanwhile.
+static void residency_evict(Residency *residency, u32 idx)
+{
+	ResidencyEntry *entry = &residency->entries[idx];
+	if (!entry->is_edited)
+	{
+		residency_remove(residency, table_find(residency, entry->pos));
+		return;
+	}
+	// Edits are recorded against the full level of detail.
+	ASSERT(entry->lod == 0);
+	saver_save_evicted(residency->saver, entry->pos, entry->data, entry->size);
+	entry->is_edited = false;
+	entry->is_saving = true;
+	lru_unlink(residency, idx);
+}
+
+void residency_init(
+	Residency *residency,
+	Alloc *alloc,
+	Journal *journal,
+	Saver *saver,
+	Jobs *jobs,
+	size_t budget)
+{
+	*residency = (Residency){
+		.alloc = alloc,
+		.journal = journal,
+		.saver = saver,
+		.jobs = jobs,
+		.budget = budget,
+		.free_entry = RESIDENCY_NONE,
+		.lru_head = RESIDENCY_NONE,
+		.lru_tail = RESIDENCY_NONE,
+	};
+	table_resize(residency, RESIDENCY_MIN_TABLE_CAPACITY);
+}
+
+void residency_deinit(Residency *residency)
+{
+	residency_sync(residency);
+	while (residency->lru_head != RESIDENCY_NONE)
+	{
+		residency_remove(residency, table_find(residency, residency->entries[residency->lru_head].pos));
+	}
+	ASSERT(residency->entry_count == 0);
+	if (residency->entries) deallocate(residency->alloc, (void**)&residency->entries);
+	deallocate(residency->alloc, (void**)&residency->table);
+	*residency = (Residency){0};
+}
+
+void residency_flush(Residency *residency)
+{
+	residency_sync(residency);
+	while (residency->lru_tail != RESIDENCY_NONE) residency_evict(residency, residency->lru_tail);
+	saver_finish_evictions(residency->saver);
+	// Entries whose save failed are back, the failure has been reported
+	// and their edits are lost.
+	while (residency->lru_head != RESIDENCY_NONE)
+	{
+		residency_remove(residency, table_find(residency, residency->entries[residency->lru_head].pos));
+	}
+}
+
+void residency_store(Residency *residency, CPos pos, const Chunk *chunk, bool is_edited, Alloc *scratch)
+{
+	residency_sync(residency);
+	size_t slot = table_find(residency, pos);
+	if (residency->table[slot] != 0)
+	{
+		residency_remove(residency, slot);
+		slot = table_find(residency, pos);
+	}
+	if (2 * (residency->entry_count + 1) > residency->table_capacity)
+	{
+		table_resize(residency, 2 * residency->table_capacity);
+		slot = table_find(residency, pos);
+	}
+
+	u32 idx = residency->free_entry;
+	if (idx != RESIDENCY_NONE)
+	{
+		residency->free_entry = residency->entries[idx].lru_next;
+	}
+	else
+	{
+		if (residency->entry_count == residency->entry_capacity)
+		{
+			residency->entry_capacity = residency->entry_capacity ? 2 * residency->entry_capacity : 64;
+			reallocate(
+				residency->alloc,
+				(void**)&residency->entries,
+				residency->entry_capacity * sizeof(ResidencyEntry));
+		}
+		idx = (u32)residency->entry_count;
+	}
+
+	// Encoded into scratch first, so the entry only takes what it needs.
+	size_t count = lod_cell_count(chunk->lod);
+	u8 *encoded;
+	allocate(scratch, (void**)&encoded, CODEC_BOUND(count));
+	size_t size = codec_encode_blocks(chunk->blocks, count, encoded, scratch);
+	u8 *data;
+	allocate(residency->alloc, (void**)&data, size);
+	memcpy(data, encoded, size);
+	deallocate(scratch, (void**)&encoded);
+
+	ResidencyEntry *entry = &residency->entries[idx];
+	*entry = (ResidencyEntry){
+		.pos = pos,
+		.lod = chunk->lod,
+		.is_edited = is_edited,
+		.data = data,
+		.size = (u32)size,
+	};
+	residency->table[slot] = idx + 1;
+	residency->entry_count++;
+	residency->used += entry_bytes(entry);
+	lru_push_front(residency, idx);
+
+	while (residency->used > residency->budget && residency->lru_tail != idx)
+	{
+		residency_evict(residency, residency->lru_tail);
+	}
+}
+
+bool residency_take(Residency *residency, CPos pos, Chunk *chunk, bool *is_edited, Alloc *scratch)
+{
+	if (residency->entry_count == 0) return false;
+	residency_sync(residency);
+	size_t slot = table_find(residency, pos);
+	if (residency->table[slot] == 0) return false;
+	ResidencyEntry *entry = &residency->entries[residency->table[slot] - 1];
+	bool is_decoded = entry->prefetched && !entry->is_corrupted;
+	if (is_decoded)
+	{
+		memcpy(chunk->blocks, entry->prefetched->blocks, lod_cell_count(entry->lod) * sizeof(Block));
+		chunk->lod = entry->lod;
+	}
+	else
+	{
+		is_decoded = decode_entry(entry, chunk, scratch);
+	}
+	// Edits the saver has not recorded yet are still only here.
+	*is_edited = entry->is_edited || entry->is_saving;
+	if (!is_decoded)
+	{
+		// The chunk is generated again, with the edits the journal has.
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tStored chunk at (%d, %d, %d) is corrupted and was discarded.\n",
+			pos.x,
+			pos.y,
+			pos.z);
+	}
+	residency_remove(residency, slot);
+	return is_decoded;
+}
+
+// Calls `fn` for every stored chunk within the margin around the area.
+static void residency_for_margin(
+	Residency *residency,
+	ChunkArea area,
+	void (*fn)(Residency *residency, u32 idx))
+{
+	int margin = RESIDENCY_PREFETCH_MARGIN;
+	int sidelen = (int)area.sidelen;
+	for (int z = -margin; z < sidelen + margin; z++)
+	{
+		for (int y = -margin; y < sidelen + margin; y++)
+		{
+			for (int x = -margin; x < sidelen + margin; x++)
+			{
+				bool is_inside =
+					x >= 0 && x < sidelen &&
+					y >= 0 && y < sidelen &&
+					z >= 0 && z < sidelen;
+				if (is_inside) continue;
+				CPos pos = {area.min.x + x, area.min.y + y, area.min.z + z};
+				size_t slot = table_find(residency, pos);
+				if (residency->table[slot] != 0) fn(residency, residency->table[slot] - 1);
+			}
+		}
+	}
+}
+
+static void residency_queue_prefetch(Residency *residency, u32 idx)
+{
+	ResidencyEntry *entry = &residency->entries[idx];
+	// Entries being saved are not in the list of recently used ones.
+	if (entry->prefetched || entry->is_saving) return;
+	allocate(residency->alloc, (void**)&entry->prefetched, sizeof(Chunk));
+	entry->is_queued = true;
+	residency->used += sizeof(Chunk);
+	lru_unlink(residency, idx);
+	lru_push_front(residency, idx);
+	// Entries queued in this pass are the most recent ones, so they are
+	// only evicted once nothing else is left.
+	while (residency->used > residency->budget &&
+		!residency->entries[residency->lru_tail].is_queued)
+	{
+		residency_evict(residency, residency->lru_tail);
+	}
+}
+
+static void residency_submit_prefetch(Residency *residency, u32 idx)
+{
+	ResidencyEntry *entry = &residency->entries[idx];
+	if (!entry->is_queued) return;
+	entry->is_queued = false;
+	jobs_submit(residency->jobs, prefetch_job_run, entry);
+	residency->has_pending_jobs = true;
+}
+
+void residency_prefetch(Residency *residency, ChunkArea area)
+{
+	if (residency->entry_count == 0) return;
+	// Jobs of the previous frame have usually finished by now.
+	residency_sync(residency);
+	// Jobs are only submitted once evictions are done, since those may
+	// free any entry that is not queued yet.
+	residency_for_margin(residency, area, residency_queue_prefetch);
+	residency_for_margin(residency, area, residency_submit_prefetch);
+}
+
+void residency_end_save(Residency *residency, CPos pos, bool is_saved)
+{
+	residency_sync(residency);
+	size_t slot = table_find(residency, pos);
+	// The chunk may have been taken back meanwhile, or stored and evicted again.
+	if (residency->table[slot] == 0) return;
+	u32 idx = residency->table[slot] - 1;
+	ResidencyEntry *entry = &residency->entries[idx];
+	if (!entry->is_saving) return;
+	if (is_saved)
+	{
+		residency_remove(residency, slot);
+		return;
+	}
+	// The failure has been reported by the journal.
+	entry->is_saving = false;
+	entry->is_edited = true;
+	lru_push_front(residency, idx);
+}
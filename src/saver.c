@@ -0,0 +1,143 @@
+#include "saver.h"
+#include "residency.h"
+#include "codec.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+static void save_job_run(void *data)
+{
+	Saver *saver = data;
+	ChunkSnapshot *snapshot = &saver->snapshot;
+	for (size_t i = 0; i < snapshot->count; i++)
+	{
+		snapshot->is_saved[i] = journal_save_chunk(
+			saver->journal,
+			&saver->terrain,
+			snapshot->positions[i],
+			snapshot->items[i]);
+	}
+}
+
+static void evict_job_run(void *data)
+{
+	SaverEviction *eviction = data;
+	Saver *saver = eviction->saver;
+	Chunk *chunk;
+	allocate(saver->alloc, (void**)&chunk, sizeof(Chunk));
+	chunk_init(chunk);
+	size_t count = CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN;
+	if (codec_decode_blocks(eviction->data, eviction->size, chunk->blocks, count, saver->alloc))
+	{
+		eviction->is_saved = journal_save_chunk(saver->journal, &saver->terrain, eviction->pos, chunk);
+	}
+	else
+	{
+		// Nothing is recorded, so the journal keeps the edits it had.
+		fprintf(
+			stderr,
+			"\nCaught runtime error:\n"
+			"\tEdits of the evicted chunk at (%d, %d, %d) are corrupted and were discarded.\n",
+			eviction->pos.x,
+			eviction->pos.y,
+			eviction->pos.z);
+		eviction->is_saved = true;
+	}
+	deallocate(saver->alloc, (void**)&chunk);
+}
+
+// Every submitted job must have finished.
+static void saver_report_evictions(Saver *saver)
+{
+	// Latest first, so an earlier outcome never overrides a later one.
+	while (saver->evictions != NULL)
+	{
+		SaverEviction *eviction = saver->evictions;
+		saver->evictions = eviction->next;
+		residency_end_save(saver->residency, eviction->pos, eviction->is_saved);
+		deallocate(saver->alloc, (void**)&eviction->data);
+		deallocate(saver->alloc, (void**)&eviction);
+	}
+}
+
+void saver_init(Saver *saver, Alloc *alloc, Journal *journal, const Terrain *terrain, Residency *residency)
+{
+	*saver = (Saver){
+		.alloc = alloc,
+		.journal = journal,
+		.residency = residency,
+	};
+	jobs_init(&saver->jobs, alloc, 1);
+	terrain_init(&saver->terrain, terrain->perlin, terrain->settings, alloc);
+	chunk_snapshot_init(&saver->snapshot, alloc);
+}
+
+void saver_deinit(Saver *saver)
+{
+	ASSERT(!saver->is_saving);
+	ASSERT(saver->evictions == NULL);
+	jobs_deinit(&saver->jobs);
+	chunk_snapshot_deinit(&saver->snapshot);
+	terrain_deinit(&saver->terrain);
+	*saver = (Saver){0};
+}
+
+void saver_start(Saver *saver, Chunks *chunks)
+{
+	if (saver->is_saving) return;
+	chunks_snapshot(chunks, &saver->snapshot);
+	if (saver->snapshot.count == 0)
+	{
+		chunks_release_snapshot(chunks, &saver->snapshot);
+		return;
+	}
+	saver->is_saving = true;
+	jobs_submit(&saver->jobs, save_job_run, saver);
+}
+
+void saver_save_evicted(Saver *saver, CPos pos, const u8 *data, u32 size)
+{
+	SaverEviction *eviction;
+	allocate(saver->alloc, (void**)&eviction, sizeof(SaverEviction));
+	*eviction = (SaverEviction){
+		.next = saver->evictions,
+		.saver = saver,
+		.pos = pos,
+		.size = size,
+	};
+	allocate(saver->alloc, (void**)&eviction->data, size);
+	memcpy(eviction->data, data, size);
+	saver->evictions = eviction;
+	jobs_submit(&saver->jobs, evict_job_run, eviction);
+}
+
+void saver_update(Saver *saver, Chunks *chunks)
+{
+	if ((!saver->is_saving && saver->evictions == NULL) || !jobs_is_done(&saver->jobs)) return;
+	if (saver->is_saving)
+	{
+		chunks_release_snapshot(chunks, &saver->snapshot);
+		saver->is_saving = false;
+	}
+	saver_report_evictions(saver);
+}
+
+void saver_finish(Saver *saver, Chunks *chunks)
+{
+	if (!saver->is_saving && saver->evictions == NULL) return;
+	jobs_wait(&saver->jobs);
+	if (saver->is_saving)
+	{
+		chunks_release_snapshot(chunks, &saver->snapshot);
+		saver->is_saving = false;
+	}
+	saver_report_evictions(saver);
+}
+
+void saver_finish_evictions(Saver *saver)
+{
+	if (saver->evictions == NULL) return;
+	jobs_wait(&saver->jobs);
+	saver_report_evictions(saver);
+}
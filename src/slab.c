@@ -0,0 +1,183 @@
+#define _DEFAULT_SOURCE
+#include "slab.h"
+#include "config.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <threads.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+#if defined(CMINE_ENABLE_HUGE_PAGES) && defined(__linux__)
+#include <sys/mman.h>
+#define SLAB_USE_MMAP
+#endif
+
+struct SlabLock {
+	mtx_t mutex;
+};
+
+struct SlabRegion {
+	SlabRegion* next;
+	int is_mapped;
+};
+
+static size_t align_up(size_t size, size_t alignment) {
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+#ifdef SLAB_USE_MMAP
+// Maps a region aligned to its size, so the kernel can back it with a huge page.
+static void* map_region(void) {
+	size_t size = 2 * SLAB_REGION_SIZE;
+	unsigned char* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED) return NULL;
+	unsigned char* region = (unsigned char*)align_up((uintptr_t)mapping, SLAB_REGION_SIZE);
+	size_t head = (size_t)(region - mapping);
+	size_t tail = size - head - SLAB_REGION_SIZE;
+	if (head > 0) munmap(mapping, head);
+	if (tail > 0) munmap(region + SLAB_REGION_SIZE, tail);
+	// Only a hint, regions still work with regular pages.
+	madvise(region, SLAB_REGION_SIZE, MADV_HUGEPAGE);
+	return region;
+}
+#endif
+
+// Must be called with the lock held.
+static void slab_grow(Slab* slab) {
+	SlabRegion* region = NULL;
+#ifdef SLAB_USE_MMAP
+	region = map_region();
+	if (region != NULL) region->is_mapped = 1;
+#endif
+	if (region == NULL) {
+		allocate(slab->parent, (void**)&region, SLAB_REGION_SIZE);
+		region->is_mapped = 0;
+	}
+	region->next = slab->regions;
+	slab->regions = region;
+
+	uintptr_t begin = align_up((uintptr_t)(region + 1), SLAB_SLOT_ALIGNMENT);
+	uintptr_t end = (uintptr_t)region + SLAB_REGION_SIZE;
+	size_t count = (size_t)(end - begin) / slab->stride;
+	ASSERT(count > 0);
+	for (size_t i = count; i-- > 0;) {
+		void* slot = (void*)(begin + i * slab->stride);
+		*(void**)slot = slab->free_list;
+		slab->free_list = slot;
+	}
+}
+
+void slab_init(Slab* slab, Alloc* parent, size_t slot_size) {
+	ASSERT(parent != NULL);
+	ASSERT(slot_size > 0);
+	size_t stride = align_up(slot_size, SLAB_SLOT_ALIGNMENT);
+	ASSERT(stride + sizeof(SlabRegion) + SLAB_SLOT_ALIGNMENT <= SLAB_REGION_SIZE);
+	*slab = (Slab){
+		.parent = parent,
+		.slot_size = slot_size,
+		.stride = stride,
+	};
+	allocate(parent, (void**)&slab->lock, sizeof(SlabLock));
+	if (mtx_init(&slab->lock->mutex, mtx_plain) != thrd_success) {
+		fprintf(stderr, "\nCaught runtime error:\n\tFailed to create a slab lock.\n");
+		abort();
+	}
+}
+
+void slab_deinit(Slab* slab) {
+	SlabRegion* region = slab->regions;
+	while (region != NULL) {
+		SlabRegion* next = region->next;
+#ifdef SLAB_USE_MMAP
+		if (region->is_mapped) {
+			munmap(region, SLAB_REGION_SIZE);
+			region = next;
+			continue;
+		}
+#endif
+		deallocate(slab->parent, (void**)&region);
+		region = next;
+	}
+	mtx_destroy(&slab->lock->mutex);
+	deallocate(slab->parent, (void**)&slab->lock);
+	*slab = (Slab){0};
+}
+
+static void slab_cache_refill(SlabCache* cache) {
+	Slab* slab = cache->slab;
+	mtx_lock(&slab->lock->mutex);
+	while (cache->count < SLAB_CACHE_BATCH) {
+		if (slab->free_list == NULL) slab_grow(slab);
+		void* slot = slab->free_list;
+		slab->free_list = *(void**)slot;
+		*(void**)slot = cache->free_list;
+		cache->free_list = slot;
+		cache->count++;
+	}
+	mtx_unlock(&slab->lock->mutex);
+}
+
+// Returns `count` cached slots to the slab.
+static void slab_cache_drain(SlabCache* cache, size_t count) {
+	Slab* slab = cache->slab;
+	mtx_lock(&slab->lock->mutex);
+	for (size_t i = 0; i < count && cache->free_list != NULL; i++) {
+		void* slot = cache->free_list;
+		cache->free_list = *(void**)slot;
+		*(void**)slot = slab->free_list;
+		slab->free_list = slot;
+		cache->count--;
+	}
+	mtx_unlock(&slab->lock->mutex);
+}
+
+void* slab_cache_allocate(SlabCache* cache) {
+	if (cache->free_list == NULL) slab_cache_refill(cache);
+	void* slot = cache->free_list;
+	cache->free_list = *(void**)slot;
+	cache->count--;
+	return slot;
+}
+
+void slab_cache_free(SlabCache* cache, void* slot) {
+	ASSERT(slot != NULL);
+	*(void**)slot = cache->free_list;
+	cache->free_list = slot;
+	cache->count++;
+	// Keeps a thread that only frees from hoarding slots.
+	if (cache->count >= 2 * SLAB_CACHE_BATCH) slab_cache_drain(cache, SLAB_CACHE_BATCH);
+}
+
+static void slab_cache_alloc_allocate(void* allocator, void** ptr, size_t size) {
+	SlabCache* cache = allocator;
+	ASSERT(size <= cache->slab->slot_size);
+	*ptr = slab_cache_allocate(cache);
+}
+
+static void slab_cache_alloc_reallocate(void* allocator, void** ptr, size_t size) {
+	SlabCache* cache = allocator;
+	ASSERT(size <= cache->slab->slot_size);
+	if (*ptr == NULL) *ptr = slab_cache_allocate(cache);
+}
+
+static void slab_cache_alloc_deallocate(void* allocator, void** ptr) {
+	if (*ptr != NULL) slab_cache_free(allocator, *ptr);
+	*ptr = NULL;
+}
+
+void slab_cache_init(SlabCache* cache, Slab* slab) {
+	*cache = (SlabCache){
+		.alloc = {
+			.allocator = cache,
+			.allocate = slab_cache_alloc_allocate,
+			.reallocate = slab_cache_alloc_reallocate,
+			.deallocate = slab_cache_alloc_deallocate,
+		},
+		.slab = slab,
+	};
+}
+
+void slab_cache_deinit(SlabCache* cache) {
+	slab_cache_drain(cache, cache->count);
+	*cache = (SlabCache){0};
+}
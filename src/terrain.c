@@ -0,0 +1,114 @@
+#include "terrain.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#define ASSERT(x) assert(x)
+
+// Offsets samples from integer coordinates, where gradient noise is always zero.
+#define TERRAIN_SAMPLE_OFFSET 0.31415f
+
+_Static_assert(
+	(TERRAIN_LATTICE_CACHE_SIZE & (TERRAIN_LATTICE_CACHE_SIZE - 1)) == 0,
+	"TERRAIN_LATTICE_CACHE_SIZE must be a power of two");
+_Static_assert(
+	(TERRAIN_COLUMN_CACHE_SIZE & (TERRAIN_COLUMN_CACHE_SIZE - 1)) == 0,
+	"TERRAIN_COLUMN_CACHE_SIZE must be a power of two");
+
+void terrain_init(
+	Terrain *terrain,
+	const Perlin *perlin,
+	TerrainSettings settings,
+	Alloc *alloc)
+{
+	ASSERT(perlin != NULL);
+	ASSERT(settings.kind < terrain_kind_count);
+	size_t lattice_size = TERRAIN_LATTICE_CACHE_SIZE * sizeof(TerrainLatticeSample);
+	TerrainLatticeSample *lattice;
+	allocate(alloc, (void**)&lattice, lattice_size);
+	memset(lattice, 0, lattice_size);
+	size_t columns_size = TERRAIN_COLUMN_CACHE_SIZE * sizeof(TerrainColumn);
+	TerrainColumn *columns;
+	allocate(alloc, (void**)&columns, columns_size);
+	memset(columns, 0, columns_size);
+	*terrain = (Terrain){
+		.perlin = perlin,
+		.settings = settings,
+		.lattice = lattice,
+		.columns = columns,
+		.alloc = alloc,
+	};
+}
+
+void terrain_deinit(Terrain *terrain)
+{
+	deallocate(terrain->alloc, (void**)&terrain->columns);
+	deallocate(terrain->alloc, (void**)&terrain->lattice);
+	*terrain = (Terrain){0};
+}
+
+static u32 lattice_hash(i32 x, i32 y, i32 z)
+{
+	u32 h = (u32)x * 0x8da6b343u ^ (u32)y * 0xd8163841u ^ (u32)z * 0xcb1ab31fu;
+	return h ^ (h >> 15);
+}
+
+const float *terrain_column_heights(Terrain *terrain, i32 x, i32 y, u8 lod)
+{
+	ASSERT((CHUNK_SIDELEN >> lod) > 0);
+	u32 idx = lattice_hash(x, y, lod) & (TERRAIN_COLUMN_CACHE_SIZE - 1);
+	TerrainColumn *column = &terrain->columns[idx];
+	if (column->is_valid && column->x == x && column->y == y && column->lod == lod)
+	{
+		return column->heights;
+	}
+
+	// Coarse levels are seen from far away, where fine octaves are invisible.
+	Fbm fbm = terrain->settings.heightmap;
+	fbm.octave_count = (fbm.octave_count > lod) ? fbm.octave_count - lod : 1;
+	int sidelen = CHUNK_SIDELEN >> lod;
+	i32 min_x = x * CHUNK_SIDELEN;
+	i32 min_y = y * CHUNK_SIDELEN;
+	for (int cy = 0; cy < sidelen; cy++)
+	{
+		for (int cx = 0; cx < sidelen; cx++)
+		{
+			column->heights[cy * sidelen + cx] = fbm2(
+				terrain->perlin,
+				fbm,
+				(float)(min_x + (cx << lod)) + TERRAIN_SAMPLE_OFFSET,
+				(float)(min_y + (cy << lod)) + TERRAIN_SAMPLE_OFFSET);
+		}
+	}
+	column->x = x;
+	column->y = y;
+	column->lod = lod;
+	column->is_valid = true;
+	return column->heights;
+}
+
+float terrain_lattice_density(Terrain *terrain, i32 x, i32 y, i32 z)
+{
+	u32 idx = lattice_hash(x, y, z) & (TERRAIN_LATTICE_CACHE_SIZE - 1);
+	TerrainLatticeSample *sample = &terrain->lattice[idx];
+	if (sample->is_valid && sample->x == x && sample->y == y && sample->z == z)
+	{
+		return sample->density;
+	}
+
+	TerrainSettings s = terrain->settings;
+	float world_z = (float)(z * TERRAIN_LATTICE_STEP);
+	float noise = fbm3(
+		terrain->perlin,
+		s.density,
+		(float)(x * TERRAIN_LATTICE_STEP) + TERRAIN_SAMPLE_OFFSET,
+		(float)(y * TERRAIN_LATTICE_STEP) + TERRAIN_SAMPLE_OFFSET,
+		world_z + TERRAIN_SAMPLE_OFFSET);
+	*sample = (TerrainLatticeSample){
+		.x = x,
+		.y = y,
+		.z = z,
+		.density = noise - s.density_threshold - world_z * s.density_falloff,
+		.is_valid = true,
+	};
+	return sample->density;
+}
@@ -0,0 +1,154 @@
+#include "codec.h"
+#include "chunk.h"
+#include <stdio.h>
+#include <string.h>
+
+#define CODEC_TEST_MAX_COUNT (CHUNK_SIDELEN * CHUNK_SIDELEN * CHUNK_SIDELEN * 4)
+#define CODEC_TEST_RANDOM_ROUNDS 4000
+#define CODEC_TEST_CORRUPTIONS 16
+
+static u8 in[CODEC_TEST_MAX_COUNT];
+static u8 out[CODEC_BOUND(CODEC_TEST_MAX_COUNT)];
+static u8 corrupted[CODEC_BOUND(CODEC_TEST_MAX_COUNT)];
+static u8 back[CODEC_TEST_MAX_COUNT];
+static u8 lz[CODEC_LZ_BOUND(CODEC_TEST_MAX_COUNT)];
+static u8 rle[CODEC_RLE_BOUND(CODEC_TEST_MAX_COUNT)];
+
+static u32 rng_state = 1;
+
+// Xorshift, so failures reproduce on every platform.
+static u32 rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int fail(const char *what, size_t round, size_t count)
+{
+	fprintf(
+		stderr,
+		"\nCaught runtime error:\n"
+		"\t%s\n"
+		"\tround = `%zu`\n"
+		"\tcount = `%zu`\n",
+		what,
+		round,
+		count);
+	return 0;
+}
+
+// Decoding must reject or survive flipped bits and cut off input,
+// which is all the journal and the residency can be handed back.
+static void decode_corrupted(size_t size, size_t count)
+{
+	Alloc *scratch = std_allocator_alloc();
+	for (int i = 0; i < CODEC_TEST_CORRUPTIONS; i++)
+	{
+		memcpy(corrupted, out, size);
+		corrupted[rng() % size] ^= (u8)(1u << (rng() % 8));
+		size_t corrupted_size = i % 2 ? size - rng() % size : size;
+		codec_decode_blocks(corrupted, corrupted_size, back, count, scratch);
+		codec_lz_decode(corrupted, corrupted_size, back, count);
+		codec_rle_decode(corrupted, corrupted_size, back, count);
+	}
+}
+
+static int round_trip(const u8 *blocks, size_t count, size_t round)
+{
+	Alloc *scratch = std_allocator_alloc();
+	size_t size = codec_encode_blocks(blocks, count, out, scratch);
+	if (size > CODEC_BOUND(count)) return fail("Encoded blocks exceed their bound.", round, count);
+	if (!codec_decode_blocks(out, size, back, count, scratch) || memcmp(blocks, back, count))
+		return fail("Blocks did not round trip.", round, count);
+
+	size_t lz_size = codec_lz_encode(blocks, count, lz);
+	if (lz_size > CODEC_LZ_BOUND(count)) return fail("LZ output exceeds its bound.", round, count);
+	if (!codec_lz_decode(lz, lz_size, back, count) || memcmp(blocks, back, count))
+		return fail("LZ did not round trip.", round, count);
+
+	size_t rle_size = codec_rle_encode(blocks, count, rle);
+	if (rle_size > CODEC_RLE_BOUND(count)) return fail("RLE output exceeds its bound.", round, count);
+	if (!codec_rle_decode(rle, rle_size, back, count) || memcmp(blocks, back, count))
+		return fail("RLE did not round trip.", round, count);
+
+	decode_corrupted(size, count);
+	return 1;
+}
+
+// Blocks of random counts, palettes and run lengths, including palettes
+// larger than any chunk has, so every branch of the codec is taken.
+static int test_random_blocks(void)
+{
+	for (size_t round = 0; round < CODEC_TEST_RANDOM_ROUNDS; round++)
+	{
+		size_t count = 1 + rng() % CODEC_TEST_MAX_COUNT;
+		u32 palette_size = 1 + rng() % (round % 4 ? 4 : 256);
+		u32 run_chance = rng() % 64;
+		for (size_t i = 0; i < count; i++)
+		{
+			in[i] = i && rng() % 64 < run_chance ? in[i - 1] : (u8)(rng() % palette_size);
+		}
+		if (!round_trip(in, count, round)) return 0;
+	}
+	return 1;
+}
+
+// Chunks generated by both kinds of terrain at every level of detail.
+static int test_terrain_chunks(void)
+{
+	static Chunk chunk;
+	Perlin perlin;
+	perlin_init(&perlin, 3);
+	size_t round = 0;
+	for (TerrainKind kind = 0; kind < terrain_kind_count; kind++)
+	{
+		TerrainSettings settings = {
+			.kind = kind,
+			.heightmap = {
+				.octave_count = 1,
+				.frequency = 0.2f,
+				.intensity = 8,
+				.persistance = 1,
+				.lacunarity = 1,
+			},
+			.density = {
+				.octave_count = 2,
+				.frequency = 0.08f,
+				.intensity = 16,
+				.persistance = 0.5f,
+				.lacunarity = 2,
+				.noise = fbm_noise_simplex,
+			},
+			.density_threshold = 8,
+			.density_falloff = 0.5f,
+		};
+		Terrain terrain;
+		terrain_init(&terrain, &perlin, settings, std_allocator_alloc());
+		for (int z = -2; z < 2; z++)
+			for (int y = -2; y < 2; y++)
+				for (int x = -2; x < 2; x++)
+					for (u8 lod = 0; lod < CHUNK_LOD_COUNT; lod++, round++)
+					{
+						BPos min = cp2bp((CPos){x, y, z});
+						chunk_init(&chunk);
+						chunk_generate_blocks(&chunk, &terrain, min, lod);
+						size_t sidelen = CHUNK_LOD_SIDELEN(lod);
+						if (!round_trip(chunk.blocks, sidelen * sidelen * sidelen, round))
+						{
+							terrain_deinit(&terrain);
+							return 0;
+						}
+					}
+		terrain_deinit(&terrain);
+	}
+	return 1;
+}
+
+int main(void)
+{
+	if (!test_random_blocks()) return 1;
+	if (!test_terrain_chunks()) return 1;
+	return 0;
+}
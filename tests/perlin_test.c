@@ -0,0 +1,111 @@
+#include "perlin.h"
+#include <math.h>
+#include <stdio.h>
+
+// Largest difference from the expected samples, which covers rounding of
+// different compilers and optimization levels.
+#define PERLIN_TEST_TOLERANCE 1e-5f
+#define PERLIN_TEST_RANGE_SAMPLES 200000
+
+typedef struct NoiseSample NoiseSample;
+struct NoiseSample
+{
+	uint32_t seed;
+	float x;
+	float y;
+	float z;
+	float simplex2;
+	float simplex3;
+};
+
+// Worlds are generated from these, so any change to them changes the
+// terrain of existing saves, whose edits are stored relative to it.
+static const NoiseSample noise_samples[] = {
+	{1, 0.5f, 0.25f, 0.125f, 0.1114819f, 0.3161597f},
+	{1, 1.75f, -3.5f, 2.25f, 0.1293979f, 0.4156884f},
+	{1, -12.3f, 45.6f, -7.8f, 0.1570189f, 0.7904356f},
+	{1, 100.01f, 200.02f, 300.03f, 0.1955580f, 0.4794682f},
+	{1, 0.0f, 0.0f, 0.0f, 0.5000000f, 0.5000000f},
+	{1, -0.6f, 0.9f, 3.3f, 0.2816955f, 0.5045236f},
+	{42, 0.5f, 0.25f, 0.125f, 0.2553343f, 0.5248750f},
+	{42, 1.75f, -3.5f, 2.25f, 0.1472582f, 0.5793658f},
+	{42, -12.3f, 45.6f, -7.8f, 0.7531369f, 0.1553051f},
+	{42, 100.01f, 200.02f, 300.03f, 0.6193980f, 0.4383574f},
+	{42, 0.0f, 0.0f, 0.0f, 0.5000000f, 0.5000000f},
+	{42, -0.6f, 0.9f, 3.3f, 0.8228632f, 0.2853261f},
+};
+#define NOISE_SAMPLE_COUNT (sizeof(noise_samples) / sizeof(*noise_samples))
+
+static int check_sample(const char *name, const NoiseSample *sample, float value, float expected)
+{
+	if (fabsf(value - expected) <= PERLIN_TEST_TOLERANCE) return 1;
+	fprintf(
+		stderr,
+		"\nCaught runtime error:\n"
+		"\tNoise sample changed.\n"
+		"\tnoise = `%s`\n"
+		"\tseed = `%u`\n"
+		"\tposition = `%g, %g, %g`\n"
+		"\tvalue = `%.7f`\n"
+		"\texpected = `%.7f`\n",
+		name,
+		(unsigned)sample->seed,
+		sample->x,
+		sample->y,
+		sample->z,
+		value,
+		expected);
+	return 0;
+}
+
+static int test_fixed_samples(void)
+{
+	int ok = 1;
+	for (size_t i = 0; i < NOISE_SAMPLE_COUNT; i++)
+	{
+		const NoiseSample *sample = &noise_samples[i];
+		Perlin perlin;
+		perlin_init(&perlin, sample->seed);
+		float value2 = simplex2(&perlin, sample->x, sample->y);
+		float value3 = simplex3(&perlin, sample->x, sample->y, sample->z);
+		ok = check_sample("simplex2", sample, value2, sample->simplex2) && ok;
+		ok = check_sample("simplex3", sample, value3, sample->simplex3) && ok;
+	}
+	return ok;
+}
+
+// Noise is remapped to [0, 1] like Perlin noise, which terrain relies on.
+static int test_range(void)
+{
+	Perlin perlin;
+	perlin_init(&perlin, 7);
+	float min = 1.0f;
+	float max = 0.0f;
+	for (int i = 0; i < PERLIN_TEST_RANGE_SAMPLES; i++)
+	{
+		float x = (float)i * 0.0137f - 500.0f;
+		float y = (float)i * 0.0071f;
+		float z = (float)i * 0.0191f;
+		float value2 = simplex2(&perlin, x, y);
+		float value3 = simplex3(&perlin, x, y, z);
+		min = fminf(min, fminf(value2, value3));
+		max = fmaxf(max, fmaxf(value2, value3));
+	}
+	if (min >= 0.0f && max <= 1.0f) return 1;
+	fprintf(
+		stderr,
+		"\nCaught runtime error:\n"
+		"\tSimplex noise left its range.\n"
+		"\tmin = `%f`\n"
+		"\tmax = `%f`\n",
+		min,
+		max);
+	return 0;
+}
+
+int main(void)
+{
+	int ok = test_fixed_samples();
+	ok = test_range() && ok;
+	return ok ? 0 : 1;
+}